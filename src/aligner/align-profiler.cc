@@ -0,0 +1,220 @@
+// aligner/align-profiler.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <time.h>
+
+#include "aligner/align-profiler.h"
+#include "util/kaldi-io.h"
+#include "util/text-utils.h"
+
+namespace kaldi {
+
+const char *AlignStageName(AlignStage stage) {
+  static const char *names[kNumAlignStages] = {
+    "wav-read", "mfcc", "pitch", "cmvn-deltas", "segment", "compile",
+    "decode", "write"
+  };
+  KALDI_ASSERT(stage >= 0 && stage < kNumAlignStages);
+  return names[stage];
+}
+
+double ThreadCpuTime() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0.0;
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+void AlignProfiler::Add(const UtteranceProfile &profile) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  utts_.push_back(profile);
+}
+
+namespace {
+
+double TotalWallTime(const UtteranceProfile &u) {
+  double ans = 0.0;
+  for (int32 s = 0; s < kNumAlignStages; s++)
+    ans += u.wall_time[s];
+  return ans;
+}
+
+// Upper bounds of the histogram buckets, 1-2-5 steps; a last bucket takes
+// everything larger.
+const double kBucketBounds[] = {
+  0.1, 0.2, 0.5, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000,
+  20000, 50000, 100000
+};
+const int32 kNumBucketBounds = sizeof(kBucketBounds) / sizeof(kBucketBounds[0]);
+
+// Writes summary statistics and a histogram of "values" (which get sorted) as
+// JSON.
+void WriteDistribution(std::vector<double> *values, const std::string &unit,
+                       std::ostream &os) {
+  std::sort(values->begin(), values->end());
+  size_t n = values->size();
+  double sum = 0.0;
+  for (size_t i = 0; i < n; i++)
+    sum += (*values)[i];
+  // nearest-rank percentiles.
+  std::string p[] = { "p50", "p90", "p99" };
+  double q[] = { 0.5, 0.9, 0.99 };
+  os << "{\"mean_" << unit << "\": " << (n > 0 ? sum / n : 0.0);
+  for (int32 i = 0; i < 3; i++) {
+    size_t rank = static_cast<size_t>(std::ceil(q[i] * n));
+    os << ", \"" << p[i] << "_" << unit << "\": "
+       << (n > 0 ? (*values)[std::max<size_t>(rank, 1) - 1] : 0.0);
+  }
+  os << ", \"max_" << unit << "\": " << (n > 0 ? values->back() : 0.0);
+  std::vector<int64> counts(kNumBucketBounds + 1, 0);
+  for (size_t i = 0; i < n; i++)
+    counts[std::lower_bound(kBucketBounds, kBucketBounds + kNumBucketBounds,
+                            (*values)[i]) - kBucketBounds]++;
+  os << ", \"histogram\": {\"upper_bounds_" << unit << "\": [";
+  for (int32 b = 0; b < kNumBucketBounds; b++)
+    os << (b > 0 ? ", " : "") << kBucketBounds[b];
+  os << ", null], \"counts\": [";
+  for (int32 b = 0; b <= kNumBucketBounds; b++)
+    os << (b > 0 ? ", " : "") << counts[b];
+  os << "]}}";
+}
+
+}  // namespace
+
+void AlignProfiler::WriteJson(std::ostream &os) const {
+  double run_time = run_timer_.Elapsed(), audio = 0.0;
+  int64 num_frames = 0, num_success = 0, num_retries = 0;
+  int32 peak_tokens = 0;
+  for (size_t i = 0; i < utts_.size(); i++) {
+    const UtteranceProfile &u = utts_[i];
+    audio += u.duration;
+    num_frames += u.num_frames;
+    num_success += u.success;
+    num_retries += u.num_retries;
+    peak_tokens = std::max(peak_tokens, u.peak_tokens);
+  }
+  os << std::setprecision(6);
+  os << "{\n\"summary\": {\"num_utterances\": " << utts_.size()
+     << ", \"num_success\": " << num_success
+     << ", \"num_retries\": " << num_retries
+     << ", \"peak_tokens\": " << peak_tokens
+     << ", \"wall_seconds\": " << run_time
+     << ", \"audio_seconds\": " << audio
+     << ", \"frames\": " << num_frames
+     << ", \"frames_per_second\": "
+     << (run_time > 0.0 ? num_frames / run_time : 0.0)
+     << ", \"real_time_factor\": " << (audio > 0.0 ? run_time / audio : 0.0)
+     << "},\n\"stages\": {";
+  for (int32 s = 0; s < kNumAlignStages; s++) {
+    std::vector<double> ms(utts_.size());
+    double wall = 0.0, cpu = 0.0;
+    for (size_t i = 0; i < utts_.size(); i++) {
+      wall += utts_[i].wall_time[s];
+      cpu += utts_[i].cpu_time[s];
+      ms[i] = utts_[i].wall_time[s] * 1000.0;
+    }
+    os << (s > 0 ? "," : "") << "\n  \""
+       << AlignStageName(static_cast<AlignStage>(s))
+       << "\": {\"wall_seconds\": " << wall << ", \"cpu_seconds\": " << cpu
+       << ", \"per_utterance\": ";
+    WriteDistribution(&ms, "ms", os);
+    os << "}";
+  }
+  // Real-time factor of each utterance: its time in all stages over its
+  // duration.
+  std::vector<double> rtf;
+  for (size_t i = 0; i < utts_.size(); i++)
+    if (utts_[i].duration > 0.0)
+      rtf.push_back(TotalWallTime(utts_[i]) / utts_[i].duration);
+  os << "\n},\n\"utterance_real_time_factor\": ";
+  WriteDistribution(&rtf, "rtf", os);
+  os << ",\n\"utterances\": [";
+  for (size_t i = 0; i < utts_.size(); i++) {
+    const UtteranceProfile &u = utts_[i];
+    os << (i > 0 ? "," : "") << "\n  {\"utt\": ";
+    WriteJsonString(u.utt, os);
+    os << ", \"duration\": " << u.duration << ", \"frames\": " << u.num_frames
+       << ", \"success\": " << (u.success ? "true" : "false")
+       << ", \"retries\": " << u.num_retries
+       << ", \"peak_tokens\": " << u.peak_tokens << ", \"wall_seconds\": {";
+    for (int32 s = 0; s < kNumAlignStages; s++)
+      os << (s > 0 ? ", " : "") << "\""
+         << AlignStageName(static_cast<AlignStage>(s)) << "\": "
+         << u.wall_time[s];
+    os << "}, \"cpu_seconds\": {";
+    for (int32 s = 0; s < kNumAlignStages; s++)
+      os << (s > 0 ? ", " : "") << "\""
+         << AlignStageName(static_cast<AlignStage>(s)) << "\": "
+         << u.cpu_time[s];
+    os << "}}";
+  }
+  os << "\n]\n}\n";
+}
+
+void AlignProfiler::WriteCsv(std::ostream &os) const {
+  os << std::setprecision(6);
+  os << "utt,duration,frames,success,retries,peak_tokens";
+  for (int32 s = 0; s < kNumAlignStages; s++)
+    os << "," << AlignStageName(static_cast<AlignStage>(s)) << "_wall";
+  for (int32 s = 0; s < kNumAlignStages; s++)
+    os << "," << AlignStageName(static_cast<AlignStage>(s)) << "_cpu";
+  os << ",total_wall,rtf\n";
+  for (size_t i = 0; i < utts_.size(); i++) {
+    const UtteranceProfile &u = utts_[i];
+    double total = TotalWallTime(u);
+    os << u.utt << "," << u.duration << "," << u.num_frames << ","
+       << (u.success ? 1 : 0) << "," << u.num_retries << "," << u.peak_tokens;
+    for (int32 s = 0; s < kNumAlignStages; s++)
+      os << "," << u.wall_time[s];
+    for (int32 s = 0; s < kNumAlignStages; s++)
+      os << "," << u.cpu_time[s];
+    os << "," << total << ","
+       << (u.duration > 0.0 ? total / u.duration : 0.0) << "\n";
+  }
+}
+
+void AlignProfiler::WriteReports(const AlignProfilerOptions &opts) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!opts.json_wxfilename.empty()) {
+    Output ko(opts.json_wxfilename, false, false);
+    WriteJson(ko.Stream());
+  }
+  if (!opts.csv_wxfilename.empty()) {
+    Output ko(opts.csv_wxfilename, false, false);
+    WriteCsv(ko.Stream());
+  }
+  double wall[kNumAlignStages] = { 0.0 }, cpu[kNumAlignStages] = { 0.0 };
+  for (size_t i = 0; i < utts_.size(); i++)
+    for (int32 s = 0; s < kNumAlignStages; s++) {
+      wall[s] += utts_[i].wall_time[s];
+      cpu[s] += utts_[i].cpu_time[s];
+    }
+  std::ostringstream msg;
+  msg << std::fixed << std::setprecision(2);
+  for (int32 s = 0; s < kNumAlignStages; s++)
+    msg << " " << AlignStageName(static_cast<AlignStage>(s)) << " "
+        << wall[s] << "s (cpu " << cpu[s] << "s)";
+  KALDI_LOG << "Time per stage, summed over utterances:" << msg.str();
+}
+
+}  // namespace kaldi
@@ -0,0 +1,141 @@
+// aligner/align-profiler.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_ALIGN_PROFILER_H_
+#define KALDI_ALIGNER_ALIGN_PROFILER_H_ 1
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "itf/options-itf.h"
+#include "util/trace-recorder.h"
+
+namespace kaldi {
+
+/// The stages of aligning one utterance, as timed by AlignProfiler.
+enum AlignStage {
+  kStageWavRead,
+  kStageMfcc,
+  kStagePitch,      // pitch extraction and processing, and appending to mfcc.
+  kStageCmvnDeltas,
+  kStageSegment,    // transcript to word ids.
+  kStageCompile,    // decoding graph, with transition probs.
+  kStageDecode,     // Viterbi alignment, including the likelihoods.
+  kStageWrite,
+  kNumAlignStages
+};
+
+/// Name of "stage" in the reports, e.g. "cmvn-deltas".
+const char *AlignStageName(AlignStage stage);
+
+/// Returns the CPU time used so far by the calling thread, in seconds.
+double ThreadCpuTime();
+
+/// What was measured for one utterance.
+struct UtteranceProfile {
+  std::string utt;
+  double wall_time[kNumAlignStages];  // seconds.
+  double cpu_time[kNumAlignStages];   // seconds, of the thread doing the stage.
+  BaseFloat duration;  // of the audio, in seconds.
+  int32 num_frames;
+  int32 num_retries;   // decodes retried with --retry-beam.
+  int32 peak_tokens;   // most decoder tokens active on one frame.
+  bool success;
+
+  UtteranceProfile(): duration(0.0), num_frames(0), num_retries(0),
+                      peak_tokens(0), success(false) {
+    for (int32 s = 0; s < kNumAlignStages; s++)
+      wall_time[s] = cpu_time[s] = 0.0;
+  }
+};
+
+/// StageTimer adds the wall and CPU time from its construction to its
+/// destruction to a stage of "profile"; it does nothing if "profile" is NULL,
+/// which is how the timing is turned off.  Use it as a scoped object:
+///   { StageTimer timer(profile, kStageMfcc); ... }
+/// It also records the stage as a span of the TraceRecorder, if that is on.
+class StageTimer {
+ public:
+  StageTimer(UtteranceProfile *profile, AlignStage stage):
+      profile_(profile), stage_(stage), timer_(profile != NULL),
+      cpu_start_(profile != NULL ? ThreadCpuTime() : 0.0),
+      trace_(AlignStageName(stage)) { }
+
+  ~StageTimer() {
+    if (profile_ != NULL) {
+      profile_->wall_time[stage_] += timer_.Elapsed();
+      profile_->cpu_time[stage_] += ThreadCpuTime() - cpu_start_;
+    }
+  }
+ private:
+  UtteranceProfile *profile_;
+  AlignStage stage_;
+  Timer timer_;
+  double cpu_start_;
+  TraceScope trace_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(StageTimer);
+};
+
+struct AlignProfilerOptions {
+  std::string json_wxfilename;
+  std::string csv_wxfilename;
+
+  bool Enabled() const {
+    return !json_wxfilename.empty() || !csv_wxfilename.empty();
+  }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("profile-json", &json_wxfilename, "If set, time each "
+                   "stage of each utterance and write a report here at the "
+                   "end: totals, frames per second, real-time factor, "
+                   "retries, peak decoder tokens, latency percentiles and "
+                   "histograms per stage, and the per-utterance figures.");
+    opts->Register("profile-csv", &csv_wxfilename, "If set, write the "
+                   "per-utterance timings here as CSV, one row per "
+                   "utterance.");
+  }
+};
+
+/// AlignProfiler collects the UtteranceProfile of each utterance of a run and
+/// writes the reports at the end.  Add() may be called from several threads.
+class AlignProfiler {
+ public:
+  /// The run is timed from construction.
+  AlignProfiler(): run_timer_() { }
+
+  void Add(const UtteranceProfile &profile);
+
+  /// Writes the reports selected in "opts", and logs a summary.
+  void WriteReports(const AlignProfilerOptions &opts) const;
+
+ private:
+  void WriteJson(std::ostream &os) const;
+  void WriteCsv(std::ostream &os) const;
+
+  mutable std::mutex mutex_;
+  std::vector<UtteranceProfile> utts_;
+  Timer run_timer_;
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_ALIGN_PROFILER_H_
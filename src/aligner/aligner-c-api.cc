@@ -0,0 +1,92 @@
+// aligner/aligner-c-api.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdlib>
+#include <cstring>
+
+#include "aligner/aligner-c-api.h"
+#include "aligner/aligner.h"
+
+struct SpeechAligner {
+  kaldi::SpeechAlignerOptions opts;
+  kaldi::Aligner *aligner;
+};
+
+SpeechAligner *speech_aligner_create(const char *config_file) {
+  SpeechAligner *ans = new SpeechAligner();
+  ans->aligner = NULL;
+  try {
+    kaldi::ReadSpeechAlignerConfig(config_file, &ans->opts);
+    ans->aligner = new kaldi::Aligner(ans->opts);
+  } catch (const std::exception &e) {
+    KALDI_WARN << "Could not create aligner from " << config_file << ": "
+               << e.what();
+    delete ans;
+    return NULL;
+  }
+  return ans;
+}
+
+void speech_aligner_destroy(SpeechAligner *aligner) {
+  if (aligner == NULL)
+    return;
+  delete aligner->aligner;
+  delete aligner;
+}
+
+int speech_aligner_align(SpeechAligner *aligner, const float *samples,
+                         int num_samples, float sample_rate, const char *text,
+                         SpeechAlignerSegment **segments, int *num_segments) {
+  using namespace kaldi;
+  *segments = NULL;
+  *num_segments = 0;
+  if (aligner == NULL || samples == NULL || num_samples <= 0 || text == NULL)
+    return 1;
+  std::vector<PhoneSegment> phones;
+  try {
+    // SubVector has no const constructor; the samples are only read.
+    SubVector<BaseFloat> waveform(const_cast<float*>(samples), num_samples);
+    if (!aligner->aligner->Align(waveform, sample_rate, text, &phones))
+      return 1;
+  } catch (const std::exception &e) {
+    KALDI_WARN << "Alignment failed: " << e.what();
+    return 1;
+  }
+  SpeechAlignerSegment *ans = static_cast<SpeechAlignerSegment*>(
+      malloc(sizeof(SpeechAlignerSegment) * phones.size()));
+  if (ans == NULL)
+    return 1;
+  for (size_t i = 0; i < phones.size(); i++) {
+    ans[i].phone = strdup(phones[i].phone.c_str());
+    ans[i].start = phones[i].start;
+    ans[i].end = phones[i].end;
+  }
+  *segments = ans;
+  *num_segments = phones.size();
+  return 0;
+}
+
+void speech_aligner_free_segments(SpeechAlignerSegment *segments,
+                                  int num_segments) {
+  if (segments == NULL)
+    return;
+  for (int i = 0; i < num_segments; i++)
+    free(segments[i].phone);
+  free(segments);
+}
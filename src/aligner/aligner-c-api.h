@@ -0,0 +1,71 @@
+// aligner/aligner-c-api.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_ALIGNER_C_API_H_
+#define KALDI_ALIGNER_ALIGNER_C_API_H_ 1
+
+// A plain C interface to kaldi::Aligner, for calling the aligner in-process
+// from other languages.  A typical use is
+//
+//   SpeechAligner *aligner = speech_aligner_create("conf/align.conf");
+//   SpeechAlignerSegment *segments;
+//   int num_segments;
+//   if (speech_aligner_align(aligner, samples, num_samples, 16000, text,
+//                            &segments, &num_segments) == 0) {
+//     ...
+//     speech_aligner_free_segments(segments, num_segments);
+//   }
+//   speech_aligner_destroy(aligner);
+//
+// An aligner may be used from several threads at once.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct SpeechAligner SpeechAligner;
+
+typedef struct SpeechAlignerSegment {
+  char *phone;
+  float start;  // seconds.
+  float end;
+} SpeechAlignerSegment;
+
+// Loads the models named in "config_file" (the options of speech-aligner, as
+// in --config).  Returns NULL on failure.
+SpeechAligner *speech_aligner_create(const char *config_file);
+
+void speech_aligner_destroy(SpeechAligner *aligner);
+
+// Aligns the UTF-8 transcript "text" against the mono "samples", which are
+// scaled like 16-bit integers.  On success returns 0 and outputs an array of
+// "*num_segments" phones, to be freed with speech_aligner_free_segments();
+// returns nonzero if the alignment failed.
+int speech_aligner_align(SpeechAligner *aligner, const float *samples,
+                         int num_samples, float sample_rate, const char *text,
+                         SpeechAlignerSegment **segments, int *num_segments);
+
+void speech_aligner_free_segments(SpeechAlignerSegment *segments,
+                                  int num_segments);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // KALDI_ALIGNER_ALIGNER_C_API_H_
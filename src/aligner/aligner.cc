@@ -0,0 +1,542 @@
+// aligner/aligner.cc
+
+// Copyright 2009-2012  Microsoft Corporation
+//           2012-2015  Johns Hopkins University (Author: Daniel Povey)
+//           2018       Meixu Song
+//           2018       open-speech
+//
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <fst/util.h>
+
+#include "aligner/aligner.h"
+#include "transform/cmvn.h"
+#include "hmm/hmm-utils.h"
+
+namespace kaldi {
+
+using std::vector;
+using std::string;
+
+// returns true if successfully appended.
+bool AppendFeats(const std::vector<Matrix<BaseFloat> > &in,
+                 const std::string &utt,
+                 int32 tolerance,
+                 Matrix<BaseFloat> *out) {
+  // Check the lengths
+  int32 min_len = in[0].NumRows(),
+      max_len = in[0].NumRows(),
+      tot_dim = in[0].NumCols();
+  for (int32 i = 1; i < in.size(); i++) {
+    int32 len = in[i].NumRows(), dim = in[i].NumCols();
+    tot_dim += dim;
+    if(len < min_len) min_len = len;
+    if(len > max_len) max_len = len;
+  }
+  if (max_len - min_len > tolerance || min_len == 0) {
+    KALDI_WARN << "Length mismatch " << max_len << " vs. " << min_len
+               << (utt.empty() ? "" : " for utt ") << utt
+               << " exceeds tolerance " << tolerance;
+    out->Resize(0, 0);
+    return false;
+  }
+  if (max_len - min_len > 0) {
+    KALDI_VLOG(2) << "Length mismatch " << max_len << " vs. " << min_len
+                  << (utt.empty() ? "" : " for utt ") << utt
+                  << " within tolerance " << tolerance;
+  }
+  out->Resize(min_len, tot_dim);
+  int32 dim_offset = 0;
+  for (const auto i : in) {
+    int32 this_dim = i.NumCols();
+    out->Range(0, min_len, dim_offset, this_dim).CopyFromMat(
+        i.Range(0, min_len, 0, this_dim));
+    dim_offset += this_dim;
+  }
+  return true;
+}
+
+void ReadSpeechAlignerConfig(const std::string &config_file,
+                             SpeechAlignerOptions *opts) {
+  ParseOptions po("");
+  opts->Register(&po);
+  po.ReadConfigFile(config_file);
+}
+
+void AlignmentToPhoneSegments(const TransitionModel &trans_model,
+                              const HashSymbolTable &phone_syms,
+                              BaseFloat frame_shift,
+                              const std::vector<int32> &alignment,
+                              std::vector<PhoneSegment> *segments) {
+  std::vector<std::vector<int32> > split;
+  SplitToPhones(trans_model, alignment, &split);
+  segments->clear();
+  BaseFloat et = 0.0;
+  for (size_t i = 0; i < split.size(); i++) {
+    KALDI_ASSERT(!split[i].empty());
+    int32 phone_id = trans_model.TransitionIdToPhone(split[i][0]);
+    int32 num_repeats = split[i].size();
+    PhoneSegment segment;
+    segment.phone = phone_syms.Symbol(phone_id);
+    segment.start = et;
+    et += num_repeats * frame_shift;
+    segment.end = et;
+    segments->push_back(segment);
+  }
+}
+
+Aligner::Aligner(const SpeechAlignerOptions &opts):
+    opts_(opts), mfcc_(opts.mfcc_opts), pitch_opts_(opts.pitch_opts),
+    lex_fst_(NULL), gopts_(opts.gopts), hmm_cache_(NULL),
+    graph_cache_(NULL), context_lexicon_(NULL), word_segmenter_(NULL) {
+  using fst::VectorFst;
+  using fst::StdArc;
+  pitch_opts_.frame_shift_ms = opts.mfcc_opts.frame_opts.frame_shift_ms;
+
+  if (!opts.disambig_rxfilename.empty())
+    if (!ReadIntegerVectorSimple(opts.disambig_rxfilename, &disambig_syms_))
+      KALDI_ERR << "fstcomposecontext: Could not read disambiguation symbols from "
+                << opts.disambig_rxfilename;
+  SortAndUniq(&disambig_syms_);
+
+  // The lexicon is prepared for the graph compilers once, and they all share
+  // it; with a bundle, that was done when the bundle was made.
+  uint64 lexicon_hash = 0;
+  if (!opts.model_bundle_filename.empty()) {
+    bundle_.Open(opts.model_bundle_filename);
+    bundle_.ReadTree(&ctx_dep_);
+    bundle_.ReadTransitionModel(&trans_model_);
+    bundle_.GetGmm(&am_gmm_);
+    lex_fst_ = bundle_.ReadLexicon();
+    lexicon_hash = bundle_.LexiconHash();
+    std::vector<int32> bundle_disambig_syms;
+    bundle_.ReadLexiconDisambigSyms(&bundle_disambig_syms);
+    if (bundle_disambig_syms != disambig_syms_)
+      KALDI_ERR << "The lexicon in the model bundle was prepared for other "
+                << "disambiguation symbols; rerun make-model-bundle with "
+                << "the same --read-disambig-syms.";
+  } else {
+    ReadKaldiObject(opts.tree_rxfilename, &ctx_dep_);
+    {
+      bool binary;
+      Input ki(opts.model_rxfilename, &binary);
+      trans_model_.Read(ki.Stream(), binary);
+      AmDiagGmm am_gmm;
+      am_gmm.Read(ki.Stream(), binary);
+      am_gmm_.CopyFromAmDiagGmm(am_gmm);
+    }
+    fst::VectorFst<fst::StdArc> *lex_fst;
+    if (opts.opt_sil) {
+      lex_fst = fst::ReadFstKaldi(opts.lex_rxfilename);
+    } else {
+      lex_fst = fst::ReadFstKaldi(opts.lex_no_opt_sil_rxfilename);
+    }
+    if (!opts.graph_cache_dir.empty())
+      lexicon_hash = FstHash(*lex_fst);
+    TrainingGraphCompiler::PrepareLexicon(trans_model_, ctx_dep_,
+                                          disambig_syms_, lex_fst);
+    lex_fst_ = lex_fst;
+  }
+
+  gopts_.transition_scale = 0.0;  // Change the default to 0.0 since we will generally add the
+  // transition probs in the alignment phase (since they change eacm time)
+  gopts_.self_loop_scale = 0.0;  // Ditto for self-loop probs.
+
+  HTransducerConfig h_cfg;
+  h_cfg.transition_scale = gopts_.transition_scale;
+  hmm_cache_ = new HmmFsaCache(ctx_dep_, trans_model_, h_cfg,
+                               gopts_.hmm_cache_size);
+  if (!opts.context_lexicon_rxfilename.empty()) {
+    context_lexicon_ = new ContextLexicon();
+    ReadKaldiObject(opts.context_lexicon_rxfilename, context_lexicon_);
+    context_lexicon_->Check(ctx_dep_);
+  }
+  if (!opts.graph_cache_dir.empty())
+    graph_cache_ = new GraphCache(
+        opts.graph_cache_dir,
+        GraphModelHash(ctx_dep_, trans_model_, lexicon_hash, disambig_syms_,
+                       gopts_, context_lexicon_ != NULL ?
+                       ContextLexiconHash(*context_lexicon_) : 0));
+
+  std::vector<int32> silence_phones = {1};
+  if (opts.boost_sil != 1.0) { // Do the modification to the am_gmm object.
+    std::vector<int32> pdfs;
+    bool ans = GetPdfsForPhones(trans_model_, silence_phones, &pdfs);
+    if (!ans) {
+      KALDI_WARN << "The pdfs for the silence phones may be shared by other phones "
+                 << "(note: this probably does not matter.)";
+    }
+    for (size_t i = 0; i < pdfs.size(); i++)
+      am_gmm_.BoostPdf(pdfs[i], opts.boost_sil);
+    KALDI_LOG << "Boosted weights for " << pdfs.size()
+              << " pdfs, by factor of " << opts.boost_sil;
+  }
+
+  ReadKaldiObject(opts.word_syms_filename, &word_syms_);
+  word_segmenter_ = new WordSegmenter(word_syms_);
+  ReadKaldiObject(opts.phone_syms_filename, &phone_syms_);
+}
+
+Aligner::~Aligner() {
+  for (size_t i = 0; i < all_compilers_.size(); i++)
+    delete all_compilers_[i];
+  delete hmm_cache_;
+  delete graph_cache_;
+  delete context_lexicon_;
+  delete lex_fst_;
+  delete word_segmenter_;
+}
+
+TrainingGraphCompiler *Aligner::GetCompiler() {
+  std::lock_guard<std::mutex> lock(compiler_mutex_);
+  if (!free_compilers_.empty()) {
+    TrainingGraphCompiler *gc = free_compilers_.back();
+    free_compilers_.pop_back();
+    return gc;
+  }
+  TrainingGraphCompiler *gc = new TrainingGraphCompiler(
+      trans_model_, ctx_dep_, *lex_fst_, disambig_syms_, gopts_);
+  gc->SetHmmCache(hmm_cache_);
+  if (context_lexicon_ != NULL)
+    gc->SetContextLexicon(&(context_lexicon_->Fst()),
+                          &(context_lexicon_->ILabelInfo()));
+  all_compilers_.push_back(gc);
+  return gc;
+}
+
+void Aligner::ReturnCompiler(TrainingGraphCompiler *gc) {
+  std::lock_guard<std::mutex> lock(compiler_mutex_);
+  free_compilers_.push_back(gc);
+}
+
+bool Aligner::ComputeFeatures(const std::string &utt,
+                              const WaveData &wave_data,
+                              BaseFloat vtln_warp,
+                              Matrix<BaseFloat> *features,
+                              UtteranceProfile *profile) const {
+  if (profile != NULL)
+    profile->duration = wave_data.Duration();
+  if (wave_data.Duration() < opts_.min_duration) {
+    KALDI_WARN << "File: " << utt << " is too short ("
+               << wave_data.Duration() << " sec): producing no output.";
+    return false;
+  }
+  int32 num_chan = wave_data.Data().NumRows(), this_chan = opts_.channel;
+  {  // This block works out the channel (0=left, 1=right...)
+    KALDI_ASSERT(num_chan > 0);  // should have been caught in
+    // reading code if no channels.
+    if (opts_.channel == -1) {
+      this_chan = 0;
+      if (num_chan != 1)
+        KALDI_WARN << "Channel not specified but you have data with "
+                   << num_chan << " channels; defaulting to zero";
+    } else {
+      if (this_chan >= num_chan) {
+        KALDI_WARN << "File with id " << utt << " has "
+                   << num_chan << " channels but you specified channel "
+                   << opts_.channel << ", producing no output.";
+        return false;
+      }
+    }
+  }
+  SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
+  Matrix<BaseFloat> mfcc_feat;
+  {  /// mfcc
+    StageTimer timer(profile, kStageMfcc);
+    try {
+      mfcc_.ComputeFeatures(waveform, wave_data.SampFreq(), vtln_warp, &mfcc_feat);
+    } catch (...) {
+      KALDI_WARN << "Failed to compute features for utterance "
+                 << utt;
+      return false;
+    }
+    if (opts_.subtract_mean) {
+      Vector<BaseFloat> mean(mfcc_feat.NumCols());
+      mean.AddRowSumMat(1.0, mfcc_feat);
+      mean.Scale(1.0f / mfcc_feat.NumRows());
+      for (int32 i = 0; i < mfcc_feat.NumRows(); i++)
+        mfcc_feat.Row(i).AddVec(-1.0f, mean);
+    }
+  }
+  /// pitch
+  if (pitch_opts_.samp_freq != wave_data.SampFreq())
+    KALDI_ERR << "Sample frequency mismatch: you specified "
+              << pitch_opts_.samp_freq << " but data has "
+              << wave_data.SampFreq() << " (use --sample-frequency "
+              << "option).  Utterance is " << utt;
+  Matrix<BaseFloat> base_feats;
+  try {
+    StageTimer timer(profile, kStagePitch);
+    Matrix<BaseFloat> pitch;
+    ComputeKaldiPitch(pitch_opts_, waveform, &pitch);
+    Matrix<BaseFloat> processed_pitch(pitch);
+    ProcessPitch(opts_.process_opts, pitch, &processed_pitch);
+
+    std::vector<Matrix<BaseFloat> > feats(2);
+    feats[0] = mfcc_feat;
+    feats[1] = processed_pitch;
+    if (!AppendFeats(feats, utt, opts_.length_tolerance, &base_feats)) {
+      KALDI_WARN << "Failed to combine mfcc and pitch for utterance "
+                 << utt;
+      return false; // it will have printed a warning.
+    }
+  } catch (...) {
+    KALDI_WARN << "Failed to compute pitch for utterance "
+               << utt;
+    return false;
+  }
+  StageTimer timer(profile, kStageCmvnDeltas);
+  Matrix<double> cmvn_stats;
+  InitCmvnStats(base_feats.NumCols(), &cmvn_stats);
+  AccCmvnStats(base_feats, nullptr, &cmvn_stats);
+  ApplyCmvn(cmvn_stats, opts_.norm_vars, &base_feats);
+  ComputeDeltas(opts_.delta_opts, base_feats, features);
+  if (profile != NULL)
+    profile->num_frames = features->NumRows();
+  return true;
+}
+
+void Aligner::TextToWordIds(const std::vector<std::string> &transcript,
+                            std::vector<int32> *word_ids,
+                            UtteranceProfile *profile) const {
+  StageTimer timer(profile, kStageSegment);
+  word_segmenter_->Segment(transcript, opts_.text_case_sensitive,
+                           opts_.spell_en_oov, NULL, word_ids);
+}
+
+bool Aligner::CompileGraph(const std::string &utt,
+                           const std::vector<int32> &word_ids,
+                           fst::VectorFst<fst::StdArc> *decode_fst,
+                           UtteranceProfile *profile) {
+  //graph, decode_fst
+  StageTimer timer(profile, kStageCompile);
+  bool ans = true;
+  if (graph_cache_ == NULL || !graph_cache_->Lookup(word_ids, decode_fst)) {
+    TrainingGraphCompiler *gc = GetCompiler();
+    try {
+      ans = gc->CompileGraphFromText(word_ids, decode_fst);
+    } catch (...) {
+      ReturnCompiler(gc);
+      throw;
+    }
+    ReturnCompiler(gc);
+    // Cached before the transition probs are added, as they may change.
+    if (ans && graph_cache_ != NULL && decode_fst->Start() != fst::kNoStateId)
+      graph_cache_->Insert(word_ids, *decode_fst);
+  }
+  if (!ans) {
+    decode_fst->DeleteStates();  // Just make it empty.
+  }
+  if (decode_fst->Start() == fst::kNoStateId) {
+    KALDI_WARN << "Empty decoding graph for utterance "
+               << utt;
+    return false;
+  }
+  {  // Add transition-probs to the FST.
+    std::vector<int32> disambig_syms_empty;  // empty.
+    AddTransitionProbs(trans_model_, disambig_syms_empty,
+                       opts_.transition_scale, opts_.self_loop_scale,
+                       decode_fst);
+  }
+  return true;
+}
+
+void Aligner::AlignGraph(const std::string &utt,
+                         const Matrix<BaseFloat> &features,
+                         fst::VectorFst<fst::StdArc> *decode_fst,
+                         std::vector<int32> *alignment,
+                         AlignStats *stats,
+                         UtteranceProfile *profile) const {
+  // align,
+  StageTimer timer(profile, kStageDecode);
+  if (features.NumRows() == 0) {
+    KALDI_WARN << "Zero-length utterance: " << utt;
+    stats->num_err++;
+    return;
+  }
+  std::vector<int32> pdfs;
+  GetGraphPdfs(trans_model_, *decode_fst, &pdfs);
+  DecodableFlatAmDiagGmmPrecomputed gmm_decodable(am_gmm_, trans_model_,
+                                                  features, pdfs,
+                                                  opts_.acoustic_scale);
+  Vector<BaseFloat> per_frame_acwt;
+  BaseFloat score;
+  int32 num_retry = 0, peak_num_tokens = 0;
+  AlignOneUtteranceWrapper(opts_.align_config, utt,
+                           opts_.acoustic_scale, decode_fst, &gmm_decodable,
+                           *alignment, &score,
+                           &stats->num_success, &stats->num_err,
+                           &num_retry, &stats->tot_like,
+                           &stats->frame_count, &per_frame_acwt,
+                           &peak_num_tokens);
+  stats->num_retry += num_retry;
+  if (profile != NULL) {
+    profile->num_retries += num_retry;
+    profile->peak_tokens = std::max(profile->peak_tokens, peak_num_tokens);
+    profile->success = !alignment->empty();
+  }
+}
+
+void Aligner::Align(const std::string &utt,
+                    const std::vector<int32> &word_ids,
+                    const Matrix<BaseFloat> &features,
+                    std::vector<int32> *alignment,
+                    AlignStats *stats,
+                    UtteranceProfile *profile) {
+  fst::VectorFst<fst::StdArc> decode_fst;
+  if (!CompileGraph(utt, word_ids, &decode_fst, profile)) {
+    stats->num_err++;
+    return;
+  }
+  AlignGraph(utt, features, &decode_fst, alignment, stats, profile);
+}
+
+bool Aligner::Align(const VectorBase<BaseFloat> &waveform,
+                    BaseFloat sample_rate, const std::string &text,
+                    std::vector<PhoneSegment> *segments) {
+  const std::string utt = "utterance";  // for the log messages.
+  segments->clear();
+  Matrix<BaseFloat> data(1, waveform.Dim(), kUndefined);
+  data.Row(0).CopyFromVec(waveform);
+  WaveData wave_data(sample_rate, data);
+
+  std::vector<std::string> transcript;
+  SplitStringToVector(text, " \t\r\n", true, &transcript);
+  std::vector<int32> word_ids;
+  TextToWordIds(transcript, &word_ids);
+
+  Matrix<BaseFloat> features;
+  if (!ComputeFeatures(utt, wave_data, opts_.vtln_warp, &features))
+    return false;
+  std::vector<int32> alignment;
+  AlignStats stats;
+  Align(utt, word_ids, features, &alignment, &stats);
+  if (alignment.empty())
+    return false;
+  AlignmentToPhoneSegments(trans_model_, phone_syms_, opts_.frame_shift,
+                           alignment, segments);
+  return true;
+}
+
+void AlignmentFormatter::Format(const std::string &utt,
+                                const std::vector<int32> &alignment,
+                                std::ostream &output) const {
+  const TransitionModel &trans_model = trans_model_;
+  BaseFloat frame_shift = opts_.frame_shift;
+  std::vector<std::vector<int32> > split;
+  SplitToPhones(trans_model, alignment, &split);
+
+  if (opts_.custom_output) {
+    std::vector<PhoneSegment> segments;
+    AlignmentToPhoneSegments(trans_model, phone_syms_, frame_shift, alignment,
+                             &segments);
+    output << utt << std::endl;
+    for (size_t i = 0; i < segments.size(); i++)
+      output << std::fixed << std::setprecision(3) << segments[i].start << " "
+             << segments[i].end << " " << segments[i].phone << std::endl;
+    output << "." << std::endl;
+  } else if (opts_.mlf_output) {
+    int st = 0, et = 0;
+    output << "\"*/" << utt << ".lab\"" << std::endl;
+    for (size_t i = 0; i < split.size(); i++) {
+      KALDI_ASSERT(!split[i].empty());
+      int32 phone_id = trans_model.TransitionIdToPhone(split[i][0]);
+      const std::string &phone = phone_syms_.Symbol(phone_id);
+      int32 num_pdf_class_frames = 0;
+      int32 last_pdf_class = -1;
+      for (size_t j = 0; j < split[i].size(); ++j) {
+        int32 trans_id = split[i][j];
+        int32 cur_pdf_class = trans_model.TransitionIdToPdfClass(trans_id);
+        if (last_pdf_class != cur_pdf_class) {
+          if (num_pdf_class_frames > 0) {
+            et += num_pdf_class_frames * round(frame_shift * 1e3) * 1e4;
+            output << st << " " << et << " s" << last_pdf_class + 2;
+            if (last_pdf_class == 0) {
+              output << " " << phone << std::endl;
+            } else {
+              output << std::endl;
+            }
+            st = et;
+            num_pdf_class_frames = 0;
+          }
+          last_pdf_class = cur_pdf_class;
+        }
+        ++num_pdf_class_frames;
+      }
+      et += num_pdf_class_frames * round(frame_shift * 1e3) * 1e4;
+      output << st << " " << et << " s" << last_pdf_class + 2 << std::endl;
+      st = et;
+    }
+    output << "." << std::endl;
+  } else if (opts_.ctm_output) {
+    output << std::fixed << std::setprecision(frame_shift >= 0.01 ? 2 : 3);
+    BaseFloat phone_start = 0.0;
+    for (size_t i = 0; i < split.size(); i++) {
+      KALDI_ASSERT(!split[i].empty());
+      int32 phone = trans_model.TransitionIdToPhone(split[i][0]);
+      int32 num_repeats = split[i].size();
+      output << utt << " 1 " << phone_start << " "
+             << (frame_shift * num_repeats) << " " << phone << std::endl;
+      phone_start += frame_shift * num_repeats;
+    }
+  } else if (!opts_.write_lengths) {
+    std::vector<int32> phones;
+    PhoneSequence(alignment, &phones);
+    output << utt << ' ';
+    BasicVectorHolder<int32>::Write(output, false, phones);
+  } else {
+    std::vector<std::pair<int32, int32> > pairs;
+    PhoneLengths(alignment, &pairs);
+    output << utt << ' ';
+    BasicPairVectorHolder<int32>::Write(output, false, pairs);
+  }
+}
+
+void AlignmentFormatter::PhoneSequence(const std::vector<int32> &alignment,
+                                       std::vector<int32> *phones) const {
+  std::vector<std::vector<int32> > split;
+  SplitToPhones(trans_model_, alignment, &split);
+  for (size_t i = 0; i < split.size(); i++) {
+    KALDI_ASSERT(!split[i].empty());
+    int32 phone = trans_model_.TransitionIdToPhone(split[i][0]);
+    int32 num_repeats = split[i].size();
+    //KALDI_ASSERT(num_repeats!=0);
+    if (opts_.per_frame)
+      for(int32 j = 0; j < num_repeats; j++)
+        phones->push_back(phone);
+    else
+      phones->push_back(phone);
+  }
+}
+
+void AlignmentFormatter::PhoneLengths(
+    const std::vector<int32> &alignment,
+    std::vector<std::pair<int32, int32> > *pairs) const {
+  std::vector<std::vector<int32> > split;
+  SplitToPhones(trans_model_, alignment, &split);
+  for (size_t i = 0; i < split.size(); i++) {
+    KALDI_ASSERT(!split[i].empty());
+    int32 phone = trans_model_.TransitionIdToPhone(split[i][0]);
+    int32 num_repeats = split[i].size();
+    //KALDI_ASSERT(num_repeats!=0);
+    pairs->push_back(std::make_pair(phone, num_repeats));
+  }
+}
+
+}  // namespace kaldi
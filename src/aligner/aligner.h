@@ -0,0 +1,343 @@
+// aligner/aligner.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_ALIGNER_H_
+#define KALDI_ALIGNER_ALIGNER_H_ 1
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "feat/feature-mfcc.h"
+#include "feat/pitch-functions.h"
+#include "feat/wave-reader.h"
+#include "feat/feature-functions.h"
+#include "tree/context-dep.h"
+#include "hmm/transition-model.h"
+#include "fstext/fstext-lib.h"
+#include "decoder/training-graph-compiler.h"
+#include "decoder/decoder-wrappers.h"
+#include "gmm/am-diag-gmm.h"
+#include "aligner/align-profiler.h"
+#include "aligner/context-lexicon.h"
+#include "aligner/flat-am-diag-gmm.h"
+#include "aligner/graph-cache.h"
+#include "aligner/model-bundle.h"
+#include "aligner/symbol-table.h"
+#include "aligner/word-segmenter.h"
+
+namespace kaldi {
+
+struct SpeechAlignerOptions {
+  // feats
+  MfccOptions mfcc_opts;
+  PitchExtractionOptions pitch_opts;
+  ProcessPitchOptions process_opts;
+  DeltaFeaturesOptions delta_opts;
+  bool subtract_mean;
+  BaseFloat vtln_warp;
+  std::string vtln_map_rspecifier;
+  std::string utt2spk_rspecifier;
+  int32 channel;
+  BaseFloat min_duration;
+  int32 length_tolerance;
+  bool norm_vars;
+  bool norm_means;
+
+  // graph
+  std::string tree_rxfilename;
+  std::string model_rxfilename;
+  std::string lex_rxfilename;
+  std::string lex_no_opt_sil_rxfilename;
+  std::string disambig_rxfilename;
+  std::string model_bundle_filename;
+  std::string word_syms_filename;
+  std::string graph_cache_dir;
+  std::string context_lexicon_rxfilename;
+  TrainingGraphCompilerOptions gopts;
+
+  // align
+  AlignConfig align_config;
+  BaseFloat acoustic_scale;
+  BaseFloat transition_scale;
+  BaseFloat self_loop_scale;
+  BaseFloat boost_sil;
+  bool text_case_sensitive;
+  bool spell_en_oov;
+  bool opt_sil;
+  bool per_frame;
+  bool write_lengths;
+  bool ctm_output;
+  bool custom_output;
+  bool mlf_output;
+  BaseFloat frame_shift;
+  std::string phone_syms_filename;
+
+  SpeechAlignerOptions(): subtract_mean(false), vtln_warp(1.0), channel(-1),
+                          min_duration(0.0), length_tolerance(0),
+                          norm_vars(false), norm_means(true),
+                          acoustic_scale(0.1), transition_scale(1.0),
+                          self_loop_scale(0.1), boost_sil(1.0),
+                          text_case_sensitive(false), spell_en_oov(true),
+                          opt_sil(true), per_frame(false),
+                          write_lengths(false), ctm_output(false),
+                          custom_output(true), mlf_output(false),
+                          frame_shift(0.005) { }
+
+  void Register(ParseOptions *opts) {
+    mfcc_opts.Register(opts);
+    process_opts.Register(opts);
+    gopts.Register(opts);
+    align_config.Register(opts);
+
+    // feats
+    opts->Register("subtract-mean", &subtract_mean, "Subtract mean of each "
+                   "feature file [CMS]; not recommended to do it this way. ");
+    opts->Register("vtln-warp", &vtln_warp, "Vtln warp factor (only applicable "
+                   "if vtln-map not specified)");
+    opts->Register("vtln-map", &vtln_map_rspecifier, "Map from utterance or "
+                   "speaker-id to vtln warp factor (rspecifier)");
+    opts->Register("utt2spk", &utt2spk_rspecifier, "Utterance to speaker-id map "
+                   "rspecifier (if doing VTLN and you have warps per speaker)");
+    opts->Register("channel", &channel, "Channel to extract (-1 -> expect mono, "
+                   "0 -> left, 1 -> right)");
+    opts->Register("min-duration", &min_duration, "Minimum duration of segments "
+                   "to process (in seconds).");
+    opts->Register("length-tolerance", &length_tolerance,
+                   "If length is different, trim as shortest up to a frame "
+                   " difference of length-tolerance, otherwise exclude segment.");
+    opts->Register("norm-vars", &norm_vars, "If true, normalize variances.");
+    opts->Register("norm-means", &norm_means, "You can set this to false to turn off mean "
+                   "normalization.  Note, the same can be achieved by using 'fake' CMVN stats; "
+                   "see the --fake option to compute_cmvn_stats.sh");
+
+    // graph
+    opts->Register("tree-rxfilename", &tree_rxfilename, "tree");
+    opts->Register("model-rxfilename", &model_rxfilename, "model");
+    opts->Register("lex-rxfilename", &lex_rxfilename, "lexicon");
+    opts->Register("lex-no-opt-sil-rxfilename", &lex_no_opt_sil_rxfilename, "lexicon without optional sil");
+    opts->Register("read-disambig-syms", &disambig_rxfilename, "File containing "
+                   "list of disambiguation symbols in phone symbol table");
+    opts->Register("model-bundle", &model_bundle_filename, "Model bundle from "
+                   "make-model-bundle; if set, the tree, model and lexicon are "
+                   "mapped from it instead of read from --tree-rxfilename, "
+                   "--model-rxfilename and --lex-rxfilename (so --opt-sil is "
+                   "decided when the bundle is made)");
+    opts->Register("word-symbol-table", &word_syms_filename,
+                   "Symbol table for words");
+    opts->Register("graph-cache", &graph_cache_dir, "If set, a directory "
+                   "in which the compiled graphs are kept, by transcript and "
+                   "models, so that later runs load them instead of "
+                   "compiling them; entries for other models (a different "
+                   "tree, topology, lexicon or graph options) are not used.");
+    opts->Register("context-lexicon", &context_lexicon_rxfilename, "If set, "
+                   "the context FST composed with the lexicon, from "
+                   "make-context-lexicon (with the lexicon of --opt-sil); "
+                   "graphs are then compiled from it, which takes the "
+                   "place of --fast-linear-graph.");
+
+    // align
+    opts->Register("acoustic-scale", &acoustic_scale,
+                   "Scaling factor for acoustic likelihoods");
+    opts->Register("boost-sil", &boost_sil, "Factor by which to boost silence probs");
+    opts->Register("ctm-output", &ctm_output,
+                   "If true, output the alignments in ctm format "
+                   "(the confidences will be set to 1)");
+    opts->Register("per-frame", &per_frame,
+                   "If true, write out the frame-level phone alignment "
+                   "(else phone sequence)");
+    opts->Register("write-lengths", &write_lengths,
+                   "If true, write the #frames for each phone (different format)");
+    opts->Register("phone-symbol-table", &phone_syms_filename,
+                   "Symbol table for phones");
+    opts->Register("text-case-sensitive", &text_case_sensitive,
+                   "If true, distinguish lower and upper words in text");
+    opts->Register("spell-en-oov", &spell_en_oov,
+                   "If true, for english oov words, make its pronouciation with each letters");
+    opts->Register("opt-sil", &opt_sil,
+                   "If true, use lexicon fst that with optional sil");
+    opts->Register("custom-output", &custom_output,
+                   "If true, output in the custom format");
+    opts->Register("mlf-output", &mlf_output,
+                   "If true, output in the custom format");
+  }
+};
+
+/// Reads the options from "config_file", as --config would.
+void ReadSpeechAlignerConfig(const std::string &config_file,
+                             SpeechAlignerOptions *opts);
+
+struct AlignStats {
+  int32 num_success;
+  int32 num_err;
+  int32 num_retry;
+  double tot_like;
+  int64 frame_count;
+  AlignStats(): num_success(0), num_err(0), num_retry(0), tot_like(0.0),
+                frame_count(0) { }
+
+  void Add(const AlignStats &other) {
+    num_success += other.num_success;
+    num_err += other.num_err;
+    num_retry += other.num_retry;
+    tot_like += other.tot_like;
+    frame_count += other.frame_count;
+  }
+};
+
+/// One phone of an alignment, with its times in seconds.
+struct PhoneSegment {
+  std::string phone;
+  BaseFloat start;
+  BaseFloat end;
+};
+
+/// Splits "alignment" into phones, with times as in the --custom-output
+/// format (frames of "frame_shift" seconds).
+void AlignmentToPhoneSegments(const TransitionModel &trans_model,
+                              const HashSymbolTable &phone_syms,
+                              BaseFloat frame_shift,
+                              const std::vector<int32> &alignment,
+                              std::vector<PhoneSegment> *segments);
+
+/// Aligner holds the models, which are loaded once and then only read,
+/// so that several utterances can be aligned at the same time.  The only
+/// per-thread state is the TrainingGraphCompiler (its lexicon compose cache
+/// is not thread-safe); a compiler is handed to each concurrent caller
+/// from a pool.  The compilers share one cache of the HMMs of phones in
+/// context, which is thread-safe.
+class Aligner {
+ public:
+  explicit Aligner(const SpeechAlignerOptions &opts);
+
+  /// Aligns "text" (the transcript, as in the text file but without the
+  /// utterance-id) against "waveform", sampled at "sample_rate" and scaled
+  /// like 16-bit samples (as WaveData holds them), and outputs the phones with
+  /// their start and end times.  Returns false, with a warning, if the
+  /// alignment failed.  May be called from several threads at once.  The
+  /// calls below do the same in stages, for callers that schedule them; if
+  /// they are given an UtteranceProfile, they add their timings (and the
+  /// other figures they know) to it.
+  bool Align(const VectorBase<BaseFloat> &waveform, BaseFloat sample_rate,
+             const std::string &text, std::vector<PhoneSegment> *segments);
+
+  /// Computes mfcc+pitch features with cmvn and deltas.  Returns false, with a
+  /// warning, if the utterance should be skipped.
+  bool ComputeFeatures(const std::string &utt, const WaveData &wave_data,
+                       BaseFloat vtln_warp, Matrix<BaseFloat> *features,
+                       UtteranceProfile *profile = NULL) const;
+
+  /// Segments the transcript into word ids (see WordSegmenter).
+  void TextToWordIds(const std::vector<std::string> &transcript,
+                     std::vector<int32> *word_ids,
+                     UtteranceProfile *profile = NULL) const;
+
+  /// Compiles the decoding graph for "word_ids", with transition probs added.
+  /// Returns false, with a warning, if the graph is empty.
+  bool CompileGraph(const std::string &utt, const std::vector<int32> &word_ids,
+                    fst::VectorFst<fst::StdArc> *decode_fst,
+                    UtteranceProfile *profile = NULL);
+
+  /// Aligns "features" against a graph from CompileGraph().  Leaves
+  /// "alignment" empty if the alignment failed.
+  void AlignGraph(const std::string &utt, const Matrix<BaseFloat> &features,
+                  fst::VectorFst<fst::StdArc> *decode_fst,
+                  std::vector<int32> *alignment, AlignStats *stats,
+                  UtteranceProfile *profile = NULL) const;
+
+  /// Does CompileGraph() and AlignGraph().
+  void Align(const std::string &utt, const std::vector<int32> &word_ids,
+             const Matrix<BaseFloat> &features,
+             std::vector<int32> *alignment, AlignStats *stats,
+             UtteranceProfile *profile = NULL);
+
+  const TransitionModel &TransModel() const { return trans_model_; }
+  const HashSymbolTable &PhoneSymbols() const { return phone_syms_; }
+
+  ~Aligner();
+ private:
+  TrainingGraphCompiler *GetCompiler();
+  void ReturnCompiler(TrainingGraphCompiler *gc);
+
+  SpeechAlignerOptions opts_;
+  Mfcc mfcc_;
+  PitchExtractionOptions pitch_opts_;
+  ContextDependency ctx_dep_;  // the tree.
+  TransitionModel trans_model_;
+  ModelBundle bundle_;  // if --model-bundle; am_gmm_ and lex_fst_ use it.
+  FlatAmDiagGmm am_gmm_;
+  fst::Fst<fst::StdArc> *lex_fst_;  // prepared for, and shared by, the
+                                    // compilers.
+  std::vector<int32> disambig_syms_;
+  TrainingGraphCompilerOptions gopts_;
+  HmmFsaCache *hmm_cache_;  // shared by the compilers.
+  GraphCache *graph_cache_;  // if --graph-cache.
+  ContextLexicon *context_lexicon_;  // if --context-lexicon.
+  HashSymbolTable word_syms_;
+  WordSegmenter *word_segmenter_;  // refers to word_syms_.
+  HashSymbolTable phone_syms_;
+
+  std::mutex compiler_mutex_;
+  std::vector<TrainingGraphCompiler*> free_compilers_;
+  std::vector<TrainingGraphCompiler*> all_compilers_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(Aligner);
+};
+
+/// AlignmentFormatter turns the alignment of one utterance into the text of
+/// whichever output format was selected.  It only reads the models, so it can
+/// be used from several threads at once.
+class AlignmentFormatter {
+ public:
+  AlignmentFormatter(const SpeechAlignerOptions &opts,
+                     const TransitionModel &trans_model,
+                     const HashSymbolTable &phone_syms):
+      opts_(opts), trans_model_(trans_model), phone_syms_(phone_syms) { }
+
+  /// Writes the alignment to "os" as --custom-output, --mlf-output (without
+  /// the "#!MLF!#" header) or --ctm-output would, or else as a line of the
+  /// text-mode phone (or --write-lengths) archive.
+  void Format(const std::string &utt, const std::vector<int32> &alignment,
+              std::ostream &os) const;
+
+  /// The phone sequence (one per frame if --per-frame) for the Kaldi archive.
+  void PhoneSequence(const std::vector<int32> &alignment,
+                     std::vector<int32> *phones) const;
+
+  /// The (phone, num-frames) pairs for the --write-lengths archive.
+  void PhoneLengths(const std::vector<int32> &alignment,
+                    std::vector<std::pair<int32, int32> > *pairs) const;
+
+  /// True if the output is a Kaldi table (phones or lengths) rather than text.
+  bool TableOutput() const {
+    return !(opts_.custom_output || opts_.mlf_output || opts_.ctm_output);
+  }
+
+  const SpeechAlignerOptions &Options() const { return opts_; }
+ private:
+  const SpeechAlignerOptions &opts_;
+  const TransitionModel &trans_model_;
+  const HashSymbolTable &phone_syms_;
+};
+
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_ALIGNER_H_
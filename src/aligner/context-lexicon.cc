@@ -0,0 +1,80 @@
+// aligner/context-lexicon.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "aligner/context-lexicon.h"
+
+namespace kaldi {
+
+void ContextLexicon::Build(const ContextDependency &ctx_dep,
+                           const std::vector<int32> &disambig_syms,
+                           const fst::Fst<fst::StdArc> &lex_fst) {
+  using namespace fst;
+  context_width_ = ctx_dep.ContextWidth();
+  central_position_ = ctx_dep.CentralPosition();
+  VectorFst<StdArc> lex(lex_fst), cl;
+  // ComposeContext() adds the subsequential loop to "lex", which lets the
+  // context of the last phones be completed after the last word.
+  ComposeContext(disambig_syms, context_width_, central_position_, &lex, &cl,
+                 &ilabel_info_);
+  ArcSort(&cl, OLabelCompare<StdArc>());
+  // Known properties are stored with the FST, so the threads that share it
+  // need not test them.
+  cl.Properties(kFstProperties, true);
+  fst_.reset(new ConstFst<StdArc>(cl));
+}
+
+void ContextLexicon::Write(std::ostream &os, bool binary) const {
+  KALDI_ASSERT(fst_ != NULL);
+  if (!binary)
+    KALDI_ERR << "ContextLexicon can only be written in binary mode.";
+  WriteToken(os, binary, "<ContextLexicon>");
+  WriteBasicType(os, binary, context_width_);
+  WriteBasicType(os, binary, central_position_);
+  fst::WriteILabelInfo(os, binary, ilabel_info_);
+  if (!fst_->Write(os, fst::FstWriteOptions("context lexicon")))
+    KALDI_ERR << "Error writing the FST of the context lexicon.";
+  WriteToken(os, binary, "</ContextLexicon>");
+}
+
+void ContextLexicon::Read(std::istream &is, bool binary) {
+  if (!binary)
+    KALDI_ERR << "ContextLexicon can only be read in binary mode.";
+  ExpectToken(is, binary, "<ContextLexicon>");
+  ReadBasicType(is, binary, &context_width_);
+  ReadBasicType(is, binary, &central_position_);
+  fst::ReadILabelInfo(is, binary, &ilabel_info_);
+  fst_.reset(fst::ConstFst<fst::StdArc>::Read(
+      is, fst::FstReadOptions("context lexicon")));
+  if (fst_ == NULL)
+    KALDI_ERR << "Error reading the FST of the context lexicon.";
+  ExpectToken(is, binary, "</ContextLexicon>");
+}
+
+void ContextLexicon::Check(const ContextDependency &ctx_dep) const {
+  if (ctx_dep.ContextWidth() != context_width_ ||
+      ctx_dep.CentralPosition() != central_position_)
+    KALDI_ERR << "The context lexicon is for context width "
+              << context_width_ << " and central position "
+              << central_position_ << ", but the tree has "
+              << ctx_dep.ContextWidth() << " and "
+              << ctx_dep.CentralPosition()
+              << "; rebuild it with make-context-lexicon.";
+}
+
+}  // namespace kaldi
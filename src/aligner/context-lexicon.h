@@ -0,0 +1,71 @@
+// aligner/context-lexicon.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_CONTEXT_LEXICON_H_
+#define KALDI_ALIGNER_CONTEXT_LEXICON_H_ 1
+
+#include <memory>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "fstext/fstext-lib.h"
+#include "tree/context-dep.h"
+
+namespace kaldi {
+
+/// ContextLexicon is the context FST composed with the lexicon, C o L, with
+/// the information on its input labels (phones in context).  Built once, by
+/// make-context-lexicon, it saves the aligner the composition of each
+/// transcript with the lexicon and the on-demand expansion of the context:
+/// see TrainingGraphCompiler::SetContextLexicon().  The FST is a ConstFst
+/// sorted on output labels (words), as TableCompose() needs.
+class ContextLexicon {
+ public:
+  ContextLexicon(): context_width_(0), central_position_(0) { }
+
+  /// Builds C o L for the context of "ctx_dep" from "lex_fst", which has
+  /// optional silence (if wanted) and no disambiguation symbols but
+  /// "disambig_syms".
+  void Build(const ContextDependency &ctx_dep,
+             const std::vector<int32> &disambig_syms,
+             const fst::Fst<fst::StdArc> &lex_fst);
+
+  /// Binary only, as the FST is.
+  void Write(std::ostream &os, bool binary) const;
+  void Read(std::istream &is, bool binary);
+
+  /// It is an error if the context of "ctx_dep" is not that of C.
+  void Check(const ContextDependency &ctx_dep) const;
+
+  const fst::Fst<fst::StdArc> &Fst() const { return *fst_; }
+  const std::vector<std::vector<int32> > &ILabelInfo() const {
+    return ilabel_info_;
+  }
+
+ private:
+  int32 context_width_;
+  int32 central_position_;
+  std::vector<std::vector<int32> > ilabel_info_;
+  std::unique_ptr<fst::ConstFst<fst::StdArc> > fst_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ContextLexicon);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_CONTEXT_LEXICON_H_
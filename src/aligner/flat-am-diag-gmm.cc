@@ -0,0 +1,580 @@
+// aligner/flat-am-diag-gmm.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KALDI_FLAT_GMM_X86 1
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+
+#include "aligner/flat-am-diag-gmm.h"
+
+namespace kaldi {
+
+namespace {
+
+// A kernel computes the log-likelihood of "num_gauss" Gaussians with the
+// given gconsts and interleaved parameters (see FlatAmDiagGmm::interleaved_)
+// for "data", all "padded_dim" long.  The Gaussians are taken kChunk at a
+// time: their scores go to the stack, and are folded into a running maximum
+// and sum of exponentials, so there is one pass and no scratch space.
+typedef BaseFloat (*GmmKernel)(const BaseFloat *gconsts,
+                               const BaseFloat *params, int32 num_gauss,
+                               int32 padded_dim, const BaseFloat *data);
+
+// A log-sum-exp kernel returns log(sum_i exp(x[i])) for i < n, as
+// VectorBase::LogSumExp() does with no pruning.
+typedef BaseFloat (*LogSumExpKernel)(const BaseFloat *x, int32 n);
+
+const int32 kChunk = 8;
+
+// Folds "n" scores into the running log-sum (max + Log(sum)).
+inline void AddToLogSum(const BaseFloat *scores, int32 n,
+                        BaseFloat *max, BaseFloat *sum) {
+  BaseFloat chunk_max = scores[0];
+  for (int32 i = 1; i < n; i++)
+    chunk_max = std::max(chunk_max, scores[i]);
+  if (chunk_max > *max) {
+    *sum *= Exp(*max - chunk_max);
+    *max = chunk_max;
+  }
+  for (int32 i = 0; i < n; i++)
+    *sum += Exp(scores[i] - *max);
+}
+
+BaseFloat GenericKernel(const BaseFloat *gconsts, const BaseFloat *params,
+                        int32 num_gauss, int32 padded_dim,
+                        const BaseFloat *data) {
+  BaseFloat max = -std::numeric_limits<BaseFloat>::infinity(), sum = 0.0,
+      scores[kChunk];
+  for (int32 g0 = 0; g0 < num_gauss; g0 += kChunk) {
+    int32 n = std::min(kChunk, num_gauss - g0);
+    for (int32 j = 0; j < n; j++, params += 2 * padded_dim) {
+      const BaseFloat *means_invvars = params, *inv_vars = params + padded_dim;
+      BaseFloat score = gconsts[g0 + j];
+      for (int32 d = 0; d < padded_dim; d++)
+        score += data[d] * (means_invvars[d] + inv_vars[d] * data[d]);
+      scores[j] = score;
+    }
+    AddToLogSum(scores, n, &max, &sum);
+  }
+  return max + Log(sum);
+}
+
+BaseFloat GenericLogSumExp(const BaseFloat *x, int32 n) {
+  // The data is only read, but SubVector takes a non-const pointer.
+  return SubVector<BaseFloat>(const_cast<BaseFloat*>(x), n).LogSumExp();
+}
+
+#if defined(KALDI_FLAT_GMM_X86) && !KALDI_DOUBLEPRECISION
+
+BaseFloat SseKernel(const BaseFloat *gconsts, const BaseFloat *params,
+                    int32 num_gauss, int32 padded_dim,
+                    const BaseFloat *data) {
+  BaseFloat max = -std::numeric_limits<BaseFloat>::infinity(), sum = 0.0,
+      scores[kChunk];
+  for (int32 g0 = 0; g0 < num_gauss; g0 += kChunk) {
+    int32 n = std::min(kChunk, num_gauss - g0);
+    for (int32 j = 0; j < n; j++, params += 2 * padded_dim) {
+      const BaseFloat *means_invvars = params, *inv_vars = params + padded_dim;
+      __m128 acc = _mm_setzero_ps();
+      for (int32 d = 0; d < padded_dim; d += 4) {
+        __m128 x = _mm_loadu_ps(data + d);
+        __m128 t = _mm_add_ps(_mm_loadu_ps(means_invvars + d),
+                              _mm_mul_ps(_mm_loadu_ps(inv_vars + d), x));
+        acc = _mm_add_ps(acc, _mm_mul_ps(x, t));
+      }
+      acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+      acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+      scores[j] = gconsts[g0 + j] + _mm_cvtss_f32(acc);
+    }
+    AddToLogSum(scores, n, &max, &sum);
+  }
+  return max + Log(sum);
+}
+
+// exp() of 8 floats, the Cephes expf polynomial (relative error about 2e-7,
+// like the scalar one); inputs below about -87.3 come out as 0.
+__attribute__((target("avx2,fma")))
+inline __m256 Exp256(__m256 x) {
+  const __m256 min_x = _mm256_set1_ps(-87.3f);
+  __m256 underflow = _mm256_cmp_ps(x, min_x, _CMP_LT_OQ);
+  x = _mm256_min_ps(_mm256_max_ps(x, min_x), _mm256_set1_ps(88.3f));
+  __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(
+      x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+  x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+  __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+  y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+  y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x),
+                      _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+  __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(
+      _mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+  y = _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n));
+  return _mm256_andnot_ps(underflow, y);
+}
+
+__attribute__((target("avx2,fma")))
+inline BaseFloat HorizontalMax256(__m256 x) {
+  __m128 m = _mm_max_ps(_mm256_castps256_ps128(x),
+                        _mm256_extractf128_ps(x, 1));
+  m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+  m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+  return _mm_cvtss_f32(m);
+}
+
+__attribute__((target("avx2,fma")))
+inline BaseFloat HorizontalSum256(__m256 x) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(x),
+                        _mm256_extractf128_ps(x, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+// The scores of the chunk are computed eight Gaussians side by side, and
+// their exponentials in one vector, so the only calls into libm are the Log()
+// at the end and, for pdfs of more than kChunk Gaussians, one Exp() per chunk.
+__attribute__((target("avx2,fma")))
+BaseFloat Avx2Kernel(const BaseFloat *gconsts, const BaseFloat *params,
+                     int32 num_gauss, int32 padded_dim,
+                     const BaseFloat *data) {
+  BaseFloat max = -std::numeric_limits<BaseFloat>::infinity(), sum = 0.0;
+  bool any_nan = false;
+  for (int32 g0 = 0; g0 < num_gauss; g0 += kChunk) {
+    int32 n = std::min(kChunk, num_gauss - g0);
+    __m256 acc[kChunk];
+    BaseFloat chunk_gconsts[kChunk];
+    for (int32 j = 0; j < kChunk; j++) {
+      acc[j] = _mm256_setzero_ps();
+      chunk_gconsts[j] = (j < n ? gconsts[g0 + j] :
+                          -std::numeric_limits<BaseFloat>::infinity());
+    }
+    for (int32 j = 0; j < n; j++, params += 2 * padded_dim) {
+      const BaseFloat *means_invvars = params, *inv_vars = params + padded_dim;
+      for (int32 d = 0; d < padded_dim; d += 8) {
+        __m256 x = _mm256_loadu_ps(data + d);
+        __m256 t = _mm256_fmadd_ps(_mm256_loadu_ps(inv_vars + d), x,
+                                   _mm256_loadu_ps(means_invvars + d));
+        acc[j] = _mm256_fmadd_ps(x, t, acc[j]);
+      }
+    }
+    // Transposing sum: lane j of "scores" is the sum of acc[j].
+    __m256 h01 = _mm256_hadd_ps(acc[0], acc[1]),
+        h23 = _mm256_hadd_ps(acc[2], acc[3]),
+        h45 = _mm256_hadd_ps(acc[4], acc[5]),
+        h67 = _mm256_hadd_ps(acc[6], acc[7]),
+        h0123 = _mm256_hadd_ps(h01, h23), h4567 = _mm256_hadd_ps(h45, h67);
+    __m256 scores = _mm256_add_ps(
+        _mm256_add_ps(_mm256_permute2f128_ps(h0123, h4567, 0x20),
+                      _mm256_permute2f128_ps(h0123, h4567, 0x31)),
+        _mm256_loadu_ps(chunk_gconsts));
+    any_nan = any_nan || _mm256_movemask_ps(
+        _mm256_cmp_ps(scores, scores, _CMP_UNORD_Q)) != 0;
+    BaseFloat chunk_max = HorizontalMax256(scores);
+    if (chunk_max > max) {
+      if (sum != 0.0) {
+        _mm256_zeroupper();  // libm is non-VEX code.
+        sum *= Exp(max - chunk_max);
+      }
+      max = chunk_max;
+    }
+    if (max == -std::numeric_limits<BaseFloat>::infinity())
+      continue;  // all Gaussians so far have zero likelihood.
+    // Lanes that are -inf (padding) give 0 from Exp256().
+    sum += HorizontalSum256(Exp256(_mm256_sub_ps(scores,
+                                                 _mm256_set1_ps(max))));
+  }
+  _mm256_zeroupper();
+  if (any_nan)
+    return std::numeric_limits<BaseFloat>::quiet_NaN();
+  return max + Log(sum);
+}
+
+// Two passes over "x": the maximum, then the sum of the exponentials, eight
+// at a time with Exp256(); the tail is padded with -inf, which gives 0.
+__attribute__((target("avx2,fma")))
+BaseFloat Avx2LogSumExp(const BaseFloat *x, int32 n) {
+  const BaseFloat kNegInf = -std::numeric_limits<BaseFloat>::infinity();
+  int32 n8 = n - n % 8;
+  BaseFloat tail[8];
+  for (int32 i = 0; i < 8; i++)
+    tail[i] = (n8 + i < n ? x[n8 + i] : kNegInf);
+  __m256 vmax = _mm256_loadu_ps(tail), nan_mask = _mm256_cmp_ps(
+      vmax, vmax, _CMP_UNORD_Q);
+  for (int32 i = 0; i < n8; i += 8) {
+    __m256 v = _mm256_loadu_ps(x + i);
+    nan_mask = _mm256_or_ps(nan_mask, _mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    vmax = _mm256_max_ps(vmax, v);
+  }
+  BaseFloat max = HorizontalMax256(vmax);
+  if (_mm256_movemask_ps(nan_mask) != 0) {
+    _mm256_zeroupper();
+    return std::numeric_limits<BaseFloat>::quiet_NaN();
+  }
+  if (max == kNegInf) {
+    _mm256_zeroupper();
+    return kNegInf;
+  }
+  __m256 vmax_all = _mm256_set1_ps(max),
+      vsum = Exp256(_mm256_sub_ps(_mm256_loadu_ps(tail), vmax_all));
+  for (int32 i = 0; i < n8; i += 8)
+    vsum = _mm256_add_ps(vsum, Exp256(_mm256_sub_ps(_mm256_loadu_ps(x + i),
+                                                    vmax_all)));
+  BaseFloat sum = HorizontalSum256(vsum);
+  _mm256_zeroupper();  // libm is non-VEX code.
+  return max + Log(sum);
+}
+
+#endif
+
+struct KernelChoice {
+  GmmKernel kernel;
+  LogSumExpKernel log_sum_exp;
+  const char *name;
+  KernelChoice(): kernel(&GenericKernel), log_sum_exp(&GenericLogSumExp),
+                  name("generic") {
+#if defined(KALDI_FLAT_GMM_X86) && !KALDI_DOUBLEPRECISION
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      kernel = &Avx2Kernel;
+      log_sum_exp = &Avx2LogSumExp;
+      name = "avx2";
+    } else {
+      kernel = &SseKernel;  // we are built with -msse2.
+      name = "sse";
+    }
+#endif
+  }
+};
+
+const KernelChoice &GetKernelChoice() {
+  static const KernelChoice choice;
+  return choice;
+}
+
+}  // namespace
+
+const char *FlatAmDiagGmmKernel() {
+  return GetKernelChoice().name;
+}
+
+void FlatAmDiagGmm::CopyFromAmDiagGmm(const AmDiagGmm &am_gmm) {
+  num_pdfs_ = am_gmm.NumPdfs();
+  dim_ = am_gmm.Dim();
+  offsets_storage_.resize(num_pdfs_ + 1);
+  offsets_storage_[0] = 0;
+  for (int32 pdf = 0; pdf < num_pdfs_; pdf++)
+    offsets_storage_[pdf + 1] = offsets_storage_[pdf] +
+        am_gmm.GetPdf(pdf).NumGauss();
+  size_t total = offsets_storage_[num_pdfs_];
+  gconsts_storage_.resize(total);
+  weights_storage_.resize(total);
+  means_invvars_storage_.resize(total * dim_);
+  inv_vars_storage_.resize(total * dim_);
+  for (int32 pdf = 0; pdf < num_pdfs_; pdf++) {
+    const DiagGmm &gmm = am_gmm.GetPdf(pdf);
+    if (!gmm.valid_gconsts())
+      KALDI_ERR << "State " << pdf << ": Must call ComputeGconsts() "
+                   "before computing likelihood.";
+    int32 offset = offsets_storage_[pdf], num_gauss = gmm.NumGauss();
+    for (int32 i = 0; i < num_gauss; i++) {
+      gconsts_storage_[offset + i] = gmm.gconsts()(i);
+      weights_storage_[offset + i] = gmm.weights()(i);
+      SubVector<BaseFloat> means_invvars(
+          &(means_invvars_storage_[(offset + i) * dim_]), dim_),
+          inv_vars(&(inv_vars_storage_[(offset + i) * dim_]), dim_);
+      means_invvars.CopyFromVec(gmm.means_invvars().Row(i));
+      inv_vars.CopyFromVec(gmm.inv_vars().Row(i));
+    }
+  }
+  offsets_ = &(offsets_storage_[0]);
+  gconsts_ = (total > 0 ? &(gconsts_storage_[0]) : NULL);
+  weights_ = (total > 0 ? &(weights_storage_[0]) : NULL);
+  means_invvars_ = (total > 0 ? &(means_invvars_storage_[0]) : NULL);
+  inv_vars_ = (total > 0 ? &(inv_vars_storage_[0]) : NULL);
+  ComputeMaxComponents();
+}
+
+void FlatAmDiagGmm::SetExternal(int32 num_pdfs, int32 dim,
+                                const int32 *offsets,
+                                const BaseFloat *gconsts,
+                                const BaseFloat *weights,
+                                const BaseFloat *means_invvars,
+                                const BaseFloat *inv_vars) {
+  num_pdfs_ = num_pdfs;
+  dim_ = dim;
+  offsets_ = offsets;
+  gconsts_ = gconsts;
+  weights_ = weights;
+  means_invvars_ = means_invvars;
+  inv_vars_ = inv_vars;
+  offsets_storage_.clear();
+  gconsts_storage_.clear();
+  weights_storage_.clear();
+  means_invvars_storage_.clear();
+  inv_vars_storage_.clear();
+  ComputeMaxComponents();
+}
+
+void FlatAmDiagGmm::ComputeMaxComponents() {
+  max_components_ = 0;
+  for (int32 pdf = 0; pdf < num_pdfs_; pdf++) {
+    if (offsets_[pdf + 1] < offsets_[pdf])
+      KALDI_ERR << "Bad component offsets for pdf " << pdf;
+    max_components_ = std::max(max_components_, NumComponents(pdf));
+  }
+  padded_dim_ = (dim_ + 7) / 8 * 8;
+  std::vector<BaseFloat>().swap(interleaved_);
+  interleaved_once_.reset(new std::once_flag);
+}
+
+void FlatAmDiagGmm::PrepareFusedKernel() const {
+  std::call_once(*interleaved_once_, &FlatAmDiagGmm::ComputeInterleaved,
+                 this);
+}
+
+void FlatAmDiagGmm::ComputeInterleaved() const {
+  size_t total = TotalComponents();
+  interleaved_.assign(total * 2 * padded_dim_, 0.0);
+  for (size_t i = 0; i < total; i++) {
+    BaseFloat *params = &(interleaved_[i * 2 * padded_dim_]);
+    const BaseFloat *means_invvars = means_invvars_ + i * dim_,
+        *inv_vars = inv_vars_ + i * dim_;
+    for (int32 d = 0; d < dim_; d++) {
+      params[d] = means_invvars[d];
+      params[padded_dim_ + d] = -0.5 * inv_vars[d];
+    }
+  }
+}
+
+BaseFloat FlatAmDiagGmm::LogLikelihood(int32 pdf, const BaseFloat *data) const {
+  int32 offset = offsets_[pdf], num_gauss = offsets_[pdf + 1] - offset;
+  if (num_gauss == 0)
+    return -std::numeric_limits<BaseFloat>::infinity();
+  KALDI_ASSERT(!interleaved_.empty() && "Call PrepareFusedKernel() first");
+  return GetKernelChoice().kernel(
+      gconsts_ + offset,
+      &(interleaved_[static_cast<size_t>(offset) * 2 * padded_dim_]),
+      num_gauss, padded_dim_, data);
+}
+
+void FlatAmDiagGmm::BoostPdf(int32 pdf, BaseFloat factor) {
+  KALDI_ASSERT(pdf >= 0 && pdf < num_pdfs_);
+  size_t total = TotalComponents();
+  if (gconsts_storage_.empty() && total > 0) {  // copy-on-write.
+    gconsts_storage_.assign(gconsts_, gconsts_ + total);
+    weights_storage_.assign(weights_, weights_ + total);
+    gconsts_ = &(gconsts_storage_[0]);
+    weights_ = &(weights_storage_[0]);
+  }
+  // As DiagGmm::ComputeGconsts().
+  BaseFloat offset = -0.5 * M_LOG_2PI * dim_;  // constant term in gconst.
+  for (int32 mix = offsets_[pdf]; mix < offsets_[pdf + 1]; mix++) {
+    weights_storage_[mix] *= factor;
+    KALDI_ASSERT(weights_storage_[mix] >= 0);  // Cannot have negative weights.
+    BaseFloat gc = Log(weights_storage_[mix]) + offset;
+    const BaseFloat *means_invvars = means_invvars_ + mix * dim_,
+        *inv_vars = inv_vars_ + mix * dim_;
+    for (int32 d = 0; d < dim_; d++) {
+      gc += 0.5 * Log(inv_vars[d]) - 0.5 * means_invvars[d]
+        * means_invvars[d] / inv_vars[d];
+    }
+    if (KALDI_ISNAN(gc)) {  // negative infinity is OK but NaN is not acceptable
+      KALDI_ERR << "At component "  << mix
+                << ", not a number in gconst computation";
+    }
+    if (KALDI_ISINF(gc) && gc > 0)
+      gc = -gc;
+    gconsts_storage_[mix] = gc;
+  }
+}
+
+DecodableFlatAmDiagGmmScaled::DecodableFlatAmDiagGmmScaled(
+    const FlatAmDiagGmm &am, const TransitionModel &tm,
+    const Matrix<BaseFloat> &feats, BaseFloat scale,
+    BaseFloat log_sum_exp_prune):
+    acoustic_model_(am), trans_model_(tm), feature_matrix_(feats),
+    scale_(scale), previous_frame_(-1),
+    log_sum_exp_prune_(log_sum_exp_prune),
+    data_(am.PaddedDim()), data_squared_(feats.NumCols()),
+    loglikes_(am.MaxComponents()) {
+  if (log_sum_exp_prune_ <= 0.0)
+    am.PrepareFusedKernel();
+  LikelihoodCacheRecord empty = { 0.0, -1 };
+  log_like_cache_.resize(am.NumPdfs(), empty);
+}
+
+BaseFloat DecodableFlatAmDiagGmmScaled::LogLikelihoodZeroBased(int32 frame,
+                                                               int32 pdf) {
+  KALDI_ASSERT(static_cast<size_t>(frame) <
+               static_cast<size_t>(NumFramesReady()));
+  KALDI_ASSERT(static_cast<size_t>(pdf) <
+               static_cast<size_t>(acoustic_model_.NumPdfs()) &&
+               "Likely graph/model mismatch, e.g. using wrong HCLG.fst");
+
+  if (log_like_cache_[pdf].hit_time == frame) {
+    return log_like_cache_[pdf].log_like;  // return cached value, if found
+  }
+
+  const VectorBase<BaseFloat> &data = feature_matrix_.Row(frame);
+  int32 dim = acoustic_model_.Dim(),
+      num_gauss = acoustic_model_.NumComponents(pdf);
+  if (dim != data.Dim()) {
+    KALDI_ERR << "Dim mismatch: data dim = "  << data.Dim()
+        << " vs. model dim = " << dim;
+  }
+
+  if (frame != previous_frame_) {  // cache the (padded or squared) frame.
+    if (log_sum_exp_prune_ > 0.0) {
+      data_squared_.CopyFromVec(data);
+      data_squared_.ApplyPow(2.0);
+    } else {
+      data_.Range(0, dim).CopyFromVec(data);
+    }
+    previous_frame_ = frame;
+  }
+
+  if (log_sum_exp_prune_ <= 0.0) {
+    BaseFloat log_sum = acoustic_model_.LogLikelihood(pdf, data_.Data());
+    if (KALDI_ISNAN(log_sum) || KALDI_ISINF(log_sum))
+      KALDI_ERR << "Invalid answer (overflow or invalid variances/features?)";
+    log_like_cache_[pdf].log_like = log_sum;
+    log_like_cache_[pdf].hit_time = frame;
+    return log_sum;
+  }
+  // The arrays are only read, but SubMatrix and SubVector take non-const
+  // pointers.
+  SubVector<BaseFloat> gconsts(
+      const_cast<BaseFloat*>(acoustic_model_.Gconsts(pdf)), num_gauss);
+  SubMatrix<BaseFloat> means_invvars(
+      const_cast<BaseFloat*>(acoustic_model_.MeansInvVars(pdf)),
+      num_gauss, dim, dim),
+      inv_vars(const_cast<BaseFloat*>(acoustic_model_.InvVars(pdf)),
+               num_gauss, dim, dim);
+  SubVector<BaseFloat> loglikes(loglikes_, 0, num_gauss);
+  loglikes.CopyFromVec(gconsts);
+  // loglikes +=  means * inv(vars) * data.
+  loglikes.AddMatVec(1.0, means_invvars, kNoTrans, data, 1.0);
+  // loglikes += -0.5 * inv(vars) * data_sq.
+  loglikes.AddMatVec(-0.5, inv_vars, kNoTrans, data_squared_, 1.0);
+
+  BaseFloat log_sum = loglikes.LogSumExp(log_sum_exp_prune_);
+  if (KALDI_ISNAN(log_sum) || KALDI_ISINF(log_sum))
+    KALDI_ERR << "Invalid answer (overflow or invalid variances/features?)";
+
+  log_like_cache_[pdf].log_like = log_sum;
+  log_like_cache_[pdf].hit_time = frame;
+
+  return log_sum;
+}
+
+void GetGraphPdfs(const TransitionModel &tm, const fst::Fst<fst::StdArc> &fst,
+                  std::vector<int32> *pdfs) {
+  std::vector<bool> seen(tm.NumPdfs(), false);
+  for (fst::StateIterator<fst::Fst<fst::StdArc> > siter(fst); !siter.Done();
+       siter.Next()) {
+    for (fst::ArcIterator<fst::Fst<fst::StdArc> > aiter(fst, siter.Value());
+         !aiter.Done(); aiter.Next()) {
+      int32 tid = aiter.Value().ilabel;
+      if (tid != 0)
+        seen[tm.TransitionIdToPdf(tid)] = true;
+    }
+  }
+  pdfs->clear();
+  for (int32 pdf = 0; pdf < tm.NumPdfs(); pdf++)
+    if (seen[pdf])
+      pdfs->push_back(pdf);
+}
+
+DecodableFlatAmDiagGmmPrecomputed::DecodableFlatAmDiagGmmPrecomputed(
+    const FlatAmDiagGmm &am, const TransitionModel &tm,
+    const MatrixBase<BaseFloat> &feats, const std::vector<int32> &pdfs,
+    BaseFloat scale) {
+  int32 dim = am.Dim(), num_frames = feats.NumRows(),
+      num_pdfs = pdfs.size();
+  if (feats.NumCols() != dim)
+    KALDI_ERR << "Dim mismatch: data dim = "  << feats.NumCols()
+              << " vs. model dim = " << dim;
+
+  // Gather the Gaussians of "pdfs"; those of column c are offsets[c] to
+  // offsets[c + 1] - 1.
+  std::vector<int32> pdf_to_col(am.NumPdfs(), -1), offsets(num_pdfs + 1, 0);
+  for (int32 c = 0; c < num_pdfs; c++) {
+    KALDI_ASSERT(pdfs[c] >= 0 && pdfs[c] < am.NumPdfs() &&
+                 "Likely graph/model mismatch, e.g. using wrong HCLG.fst");
+    pdf_to_col[pdfs[c]] = c;
+    offsets[c + 1] = offsets[c] + am.NumComponents(pdfs[c]);
+  }
+  int32 num_gauss = offsets[num_pdfs];
+  Vector<BaseFloat> gconsts(num_gauss);
+  Matrix<BaseFloat> means_invvars(num_gauss, dim, kUndefined),
+      inv_vars(num_gauss, dim, kUndefined);
+  for (int32 c = 0; c < num_pdfs; c++) {
+    int32 pdf = pdfs[c], n = am.NumComponents(pdf);
+    if (n == 0) continue;
+    // The arrays are only read, but SubMatrix and SubVector take non-const
+    // pointers.
+    gconsts.Range(offsets[c], n).CopyFromVec(SubVector<BaseFloat>(
+        const_cast<BaseFloat*>(am.Gconsts(pdf)), n));
+    means_invvars.RowRange(offsets[c], n).CopyFromMat(SubMatrix<BaseFloat>(
+        const_cast<BaseFloat*>(am.MeansInvVars(pdf)), n, dim, dim));
+    inv_vars.RowRange(offsets[c], n).CopyFromMat(SubMatrix<BaseFloat>(
+        const_cast<BaseFloat*>(am.InvVars(pdf)), n, dim, dim));
+  }
+
+  loglikes_.Resize(num_frames, num_pdfs, kUndefined);
+  LogSumExpKernel log_sum_exp = GetKernelChoice().log_sum_exp;
+  Matrix<BaseFloat> data_sq, scores;
+  for (int32 t0 = 0; num_gauss > 0 && t0 < num_frames; t0 += kFrameBlock) {
+    int32 n = std::min<int32>(kFrameBlock, num_frames - t0);
+    SubMatrix<BaseFloat> data(feats, t0, n, 0, dim);
+    data_sq.Resize(n, dim, kUndefined);
+    data_sq.CopyFromMat(data);
+    data_sq.ApplyPow(2.0);
+    scores.Resize(n, num_gauss, kUndefined);
+    scores.CopyRowsFromVec(gconsts);
+    // scores += data * (means * inv(vars))^T - 0.5 * data^2 * inv(vars)^T.
+    scores.AddMatMat(1.0, data, kNoTrans, means_invvars, kTrans, 1.0);
+    scores.AddMatMat(-0.5, data_sq, kNoTrans, inv_vars, kTrans, 1.0);
+    for (int32 r = 0; r < n; r++) {
+      const BaseFloat *row = scores.RowData(r);
+      for (int32 c = 0; c < num_pdfs; c++) {
+        BaseFloat log_sum = log_sum_exp(row + offsets[c],
+                                        offsets[c + 1] - offsets[c]);
+        if (KALDI_ISNAN(log_sum) || KALDI_ISINF(log_sum))
+          KALDI_ERR << "Invalid answer (overflow or invalid "
+                    << "variances/features?)";
+        loglikes_(t0 + r, c) = scale * log_sum;
+      }
+    }
+  }
+
+  tid_to_col_.resize(tm.NumTransitionIds() + 1, -1);
+  for (int32 tid = 1; tid <= tm.NumTransitionIds(); tid++)
+    tid_to_col_[tid] = pdf_to_col[tm.TransitionIdToPdf(tid)];
+}
+
+}  // namespace kaldi
@@ -0,0 +1,235 @@
+// aligner/flat-am-diag-gmm.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_FLAT_AM_DIAG_GMM_H_
+#define KALDI_ALIGNER_FLAT_AM_DIAG_GMM_H_ 1
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "fst/fstlib.h"
+#include "gmm/am-diag-gmm.h"
+#include "hmm/transition-model.h"
+#include "itf/decodable-itf.h"
+
+namespace kaldi {
+
+/// FlatAmDiagGmm holds the parameters that likelihood computation needs from
+/// an AmDiagGmm (gconsts, means times inverse variances and inverse
+/// variances, plus the weights) in flat arrays: the components of all pdfs
+/// one after another, and the rows of the mean and variance arrays packed
+/// with no padding.  The arrays are either owned (CopyFromAmDiagGmm()) or
+/// belong to a memory-mapped ModelBundle (SetExternal()).  LogLikelihood()
+/// also needs an interleaved copy of the means and variances, which is owned
+/// and as large as both; it is only made by PrepareFusedKernel(), so users
+/// of the arrays alone (e.g. DecodableFlatAmDiagGmmPrecomputed) do not pay
+/// for it.
+class FlatAmDiagGmm {
+ public:
+  FlatAmDiagGmm(): num_pdfs_(0), dim_(0), padded_dim_(0), max_components_(0),
+                   offsets_(NULL), gconsts_(NULL), weights_(NULL),
+                   means_invvars_(NULL), inv_vars_(NULL),
+                   interleaved_once_(new std::once_flag) { }
+
+  void CopyFromAmDiagGmm(const AmDiagGmm &am_gmm);
+
+  /// Uses arrays held elsewhere, which must outlive this object.  "offsets"
+  /// has num_pdfs + 1 entries: the components of pdf p are offsets[p] to
+  /// offsets[p + 1] - 1.
+  void SetExternal(int32 num_pdfs, int32 dim, const int32 *offsets,
+                   const BaseFloat *gconsts, const BaseFloat *weights,
+                   const BaseFloat *means_invvars, const BaseFloat *inv_vars);
+
+  /// Scales the weights of "pdf" by "factor" and recomputes its gconsts,
+  /// exactly as DiagGmm::SetWeights() and ComputeGconsts() would.  The
+  /// gconsts are first copied if they are not owned.
+  void BoostPdf(int32 pdf, BaseFloat factor);
+
+  int32 NumPdfs() const { return num_pdfs_; }
+  int32 Dim() const { return dim_; }
+  /// Dim() rounded up to a multiple of 8: the length of the frames that
+  /// LogLikelihood() takes.
+  int32 PaddedDim() const { return padded_dim_; }
+  int32 NumComponents(int32 pdf) const {
+    return offsets_[pdf + 1] - offsets_[pdf];
+  }
+  int32 MaxComponents() const { return max_components_; }
+
+  /// Arrays for "pdf"; the mean and variance rows are Dim() apart.
+  const BaseFloat *Gconsts(int32 pdf) const {
+    return gconsts_ + offsets_[pdf];
+  }
+  const BaseFloat *MeansInvVars(int32 pdf) const {
+    return means_invvars_ + static_cast<size_t>(offsets_[pdf]) * dim_;
+  }
+  const BaseFloat *InvVars(int32 pdf) const {
+    return inv_vars_ + static_cast<size_t>(offsets_[pdf]) * dim_;
+  }
+
+  /// Whole arrays, e.g. for writing a ModelBundle.
+  const int32 *Offsets() const { return offsets_; }
+  const BaseFloat *Gconsts() const { return gconsts_; }
+  const BaseFloat *Weights() const { return weights_; }
+  const BaseFloat *MeansInvVars() const { return means_invvars_; }
+  const BaseFloat *InvVars() const { return inv_vars_; }
+  int32 TotalComponents() const { return offsets_[num_pdfs_]; }
+
+  /// Makes the interleaved parameters that LogLikelihood() reads, the first
+  /// time it is called after CopyFromAmDiagGmm() or SetExternal().  It may be
+  /// called from several threads; DecodableFlatAmDiagGmmScaled calls it.
+  void PrepareFusedKernel() const;
+
+  /// Log-likelihood of "pdf" for the frame "data", which is PaddedDim() long
+  /// with zeros after Dim().  For each Gaussian, gconst + data . means_invvars
+  /// - 0.5 data^2 . inv_vars and a running log-sum-exp are computed in one
+  /// pass over the interleaved parameters, with SIMD (AVX2 and FMA, or SSE,
+  /// whichever the CPU has) and no allocation.  PrepareFusedKernel() must
+  /// have been called first, by this thread.
+  BaseFloat LogLikelihood(int32 pdf, const BaseFloat *data) const;
+
+ private:
+  // Sets max_components_ and padded_dim_, and forgets any interleaved_.
+  void ComputeMaxComponents();
+  void ComputeInterleaved() const;
+
+  int32 num_pdfs_;
+  int32 dim_;
+  int32 padded_dim_;
+  int32 max_components_;
+  const int32 *offsets_;
+  const BaseFloat *gconsts_;
+  const BaseFloat *weights_;
+  const BaseFloat *means_invvars_;
+  const BaseFloat *inv_vars_;
+
+  // Storage, if the arrays are owned.
+  std::vector<int32> offsets_storage_;
+  std::vector<BaseFloat> gconsts_storage_;
+  std::vector<BaseFloat> weights_storage_;
+  std::vector<BaseFloat> means_invvars_storage_;
+  std::vector<BaseFloat> inv_vars_storage_;
+  // For each Gaussian, its row of means_invvars_ and then -0.5 times its row
+  // of inv_vars_, each padded with zeros to PaddedDim(); empty until
+  // PrepareFusedKernel().  The flag is replaced when the arrays change.
+  mutable std::vector<BaseFloat> interleaved_;
+  std::unique_ptr<std::once_flag> interleaved_once_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(FlatAmDiagGmm);
+};
+
+/// Name of the LogLikelihood() kernel this CPU uses: "avx2", "sse" or
+/// "generic".
+const char *FlatAmDiagGmmKernel();
+
+/// DecodableFlatAmDiagGmmScaled is DecodableAmDiagGmmScaled for a
+/// FlatAmDiagGmm: it gives the same likelihoods, with the same per-frame
+/// cache, but computes them with FlatAmDiagGmm::LogLikelihood() (unless
+/// "log_sum_exp_prune" is set, when it does what DecodableAmDiagGmmScaled
+/// does), and needs no allocation per likelihood.
+class DecodableFlatAmDiagGmmScaled: public DecodableInterface {
+ public:
+  DecodableFlatAmDiagGmmScaled(const FlatAmDiagGmm &am,
+                               const TransitionModel &tm,
+                               const Matrix<BaseFloat> &feats,
+                               BaseFloat scale,
+                               BaseFloat log_sum_exp_prune = -1.0);
+
+  // Note, frames are numbered from zero but transition-ids from one.
+  virtual BaseFloat LogLikelihood(int32 frame, int32 tid) {
+    return scale_ * LogLikelihoodZeroBased(frame,
+                                           trans_model_.TransitionIdToPdf(tid));
+  }
+  virtual int32 NumFramesReady() const { return feature_matrix_.NumRows(); }
+  // Indices are one-based!  This is for compatibility with OpenFst.
+  virtual int32 NumIndices() const { return trans_model_.NumTransitionIds(); }
+  virtual bool IsLastFrame(int32 frame) const {
+    KALDI_ASSERT(frame < NumFramesReady());
+    return (frame == NumFramesReady() - 1);
+  }
+
+  BaseFloat LogLikelihoodZeroBased(int32 frame, int32 pdf);
+
+ private:
+  const FlatAmDiagGmm &acoustic_model_;
+  const TransitionModel &trans_model_;
+  const Matrix<BaseFloat> &feature_matrix_;
+  BaseFloat scale_;
+  int32 previous_frame_;
+  BaseFloat log_sum_exp_prune_;
+
+  struct LikelihoodCacheRecord {
+    BaseFloat log_like;  ///< Cache value
+    int32 hit_time;      ///< Frame for which this value is relevant
+  };
+  std::vector<LikelihoodCacheRecord> log_like_cache_;
+  Vector<BaseFloat> data_;  ///< The frame, zero-padded to PaddedDim().
+  Vector<BaseFloat> data_squared_;  ///< Cache for fast likelihood calculation
+  Vector<BaseFloat> loglikes_;  ///< Scratch space, MaxComponents() long.
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableFlatAmDiagGmmScaled);
+};
+
+/// Outputs the pdfs of the transition-ids on the arcs of "fst", sorted.
+void GetGraphPdfs(const TransitionModel &tm, const fst::Fst<fst::StdArc> &fst,
+                  std::vector<int32> *pdfs);
+
+/// DecodableFlatAmDiagGmmPrecomputed computes the scaled log-likelihoods of
+/// all frames for just the pdfs given (those of the decoding graph, from
+/// GetGraphPdfs()) when it is constructed, and the decoder then only looks
+/// them up.  The Gaussians of those pdfs are gathered into matrices, and the
+/// scores of a block of frames take two matrix multiplications, as in
+/// DiagGmm::LogLikelihoods(const MatrixBase&), instead of two matrix-vector
+/// products per (frame, pdf); a log-sum-exp over each pdf's components
+/// follows.  A forced-alignment graph has few pdfs, most of which the search
+/// visits on most frames, so little of this is wasted; and a second decode
+/// (--retry-beam) costs nothing extra.
+class DecodableFlatAmDiagGmmPrecomputed: public DecodableInterface {
+ public:
+  DecodableFlatAmDiagGmmPrecomputed(const FlatAmDiagGmm &am,
+                                    const TransitionModel &tm,
+                                    const MatrixBase<BaseFloat> &feats,
+                                    const std::vector<int32> &pdfs,
+                                    BaseFloat scale);
+
+  /// Only the transition-ids of the pdfs given have scores; it is an error
+  /// to ask for any other, although NumIndices() counts them all.
+  virtual BaseFloat LogLikelihood(int32 frame, int32 tid) {
+    KALDI_ASSERT(tid_to_col_[tid] >= 0 &&
+                 "Transition-id whose pdf is not in the decoding graph");
+    return loglikes_(frame, tid_to_col_[tid]);
+  }
+  virtual int32 NumFramesReady() const { return loglikes_.NumRows(); }
+  // Indices are one-based!  This is for compatibility with OpenFst.
+  virtual int32 NumIndices() const { return tid_to_col_.size() - 1; }
+  virtual bool IsLastFrame(int32 frame) const {
+    KALDI_ASSERT(frame < NumFramesReady());
+    return (frame == NumFramesReady() - 1);
+  }
+
+ private:
+  static const int32 kFrameBlock = 256;  // rows of scores at a time.
+
+  std::vector<int32> tid_to_col_;  // column of loglikes_, or -1.
+  Matrix<BaseFloat> loglikes_;  // frames by the pdfs given, scaled.
+  KALDI_DISALLOW_COPY_AND_ASSIGN(DecodableFlatAmDiagGmmPrecomputed);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_FLAT_AM_DIAG_GMM_H_
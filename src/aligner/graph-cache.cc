@@ -0,0 +1,278 @@
+// aligner/graph-cache.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "aligner/graph-cache.h"
+
+namespace kaldi {
+
+namespace {
+
+// Changes whenever the graphs for the same inputs would change, e.g. the
+// format of the entries or the way graphs are compiled.
+const int32 kGraphCacheVersion = 1;
+
+// 64-bit FNV-1a, as HashSymbolTable uses the 32-bit one, with a final mix
+// so that inputs differing at the end give unrelated hashes.
+class Fnv64 {
+ public:
+  Fnv64(): hash_(14695981039346656037ULL) { }
+
+  void Add(const void *data, size_t size) {
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash_ ^= p[i];
+      hash_ *= 1099511628211ULL;
+    }
+  }
+  void Add(const std::string &s) { Add(s.data(), s.size()); }
+  template<class T> void AddValue(T value) { Add(&value, sizeof(value)); }
+
+  uint64 Value() const {
+    uint64 h = hash_;  // the finalizer of MurmurHash3.
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+ private:
+  uint64 hash_;
+};
+
+std::string ToHex(uint64 value) {
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx",
+           static_cast<unsigned long long>(value));
+  return buf;
+}
+
+}  // namespace
+
+uint64 FstHash(const fst::Fst<fst::StdArc> &fst) {
+  using namespace fst;
+  Fnv64 hash;
+  hash.AddValue(fst.Start());
+  for (StateIterator<Fst<StdArc> > siter(fst); !siter.Done(); siter.Next()) {
+    StdArc::StateId s = siter.Value();
+    hash.AddValue(s);
+    hash.AddValue(fst.Final(s).Value());
+    for (ArcIterator<Fst<StdArc> > aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      const StdArc &arc = aiter.Value();
+      hash.AddValue(arc.ilabel);
+      hash.AddValue(arc.olabel);
+      hash.AddValue(arc.weight.Value());
+      hash.AddValue(arc.nextstate);
+    }
+  }
+  return hash.Value();
+}
+
+uint64 ContextLexiconHash(const ContextLexicon &context_lexicon) {
+  Fnv64 hash;
+  hash.AddValue(FstHash(context_lexicon.Fst()));
+  const std::vector<std::vector<int32> > &ilabel_info =
+      context_lexicon.ILabelInfo();
+  hash.AddValue(ilabel_info.size());
+  for (size_t i = 0; i < ilabel_info.size(); i++) {
+    hash.AddValue(ilabel_info[i].size());
+    for (size_t j = 0; j < ilabel_info[i].size(); j++)
+      hash.AddValue(ilabel_info[i][j]);
+  }
+  return hash.Value();
+}
+
+std::string GraphModelHash(const ContextDependency &ctx_dep,
+                           const TransitionModel &trans_model,
+                           uint64 lexicon_hash,
+                           const std::vector<int32> &disambig_syms,
+                           const TrainingGraphCompilerOptions &gopts,
+                           uint64 context_lexicon_hash) {
+  Fnv64 hash;
+  hash.AddValue(kGraphCacheVersion);
+  {
+    std::ostringstream os;
+    ctx_dep.Write(os, true);
+    trans_model.GetTopo().Write(os, true);
+    hash.Add(os.str());
+  }
+  for (int32 t = 1; t <= trans_model.NumTransitionStates(); t++) {
+    hash.AddValue(trans_model.TransitionStateToPhone(t));
+    hash.AddValue(trans_model.TransitionStateToHmmState(t));
+    hash.AddValue(trans_model.TransitionStateToForwardPdf(t));
+    hash.AddValue(trans_model.TransitionStateToSelfLoopPdf(t));
+  }
+  hash.AddValue(lexicon_hash);
+  for (size_t i = 0; i < disambig_syms.size(); i++)
+    hash.AddValue(disambig_syms[i]);
+  hash.AddValue(gopts.transition_scale);
+  hash.AddValue(gopts.self_loop_scale);
+  hash.AddValue(gopts.rm_eps);
+  hash.AddValue(gopts.reorder);
+  hash.AddValue(gopts.fast_linear);
+  hash.AddValue(context_lexicon_hash);
+  return ToHex(hash.Value());
+}
+
+GraphCache::GraphCache(const std::string &dir, const std::string &model_hash):
+    dir_(dir), model_hash_(model_hash), num_hits_(0), num_misses_(0),
+    num_inserted_(0) {
+  KALDI_ASSERT(!dir.empty() && !model_hash.empty());
+  if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+    KALDI_ERR << "Could not create graph cache directory " << dir << ": "
+              << strerror(errno);
+  ReadIndex();
+}
+
+uint64 GraphCache::Key(const std::vector<int32> &word_ids) const {
+  Fnv64 hash;
+  hash.Add(model_hash_);
+  if (!word_ids.empty())
+    hash.Add(&(word_ids[0]), word_ids.size() * sizeof(int32));
+  return hash.Value();
+}
+
+void GraphCache::ReadIndex() {
+  std::string filename = dir_ + "/index";
+  std::ifstream is(filename.c_str());
+  if (!is.is_open()) {
+    KALDI_LOG << "Graph cache " << dir_ << " is empty.";
+    return;
+  }
+  int64 num_stale = 0, num_bad = 0;
+  std::string line;
+  while (std::getline(is, line)) {
+    std::istringstream ls(line);
+    std::string key, model_hash;
+    Location location;
+    if (!(ls >> key >> model_hash >> location.archive >> location.offset) ||
+        key.size() != 16) {
+      num_bad++;
+      continue;
+    }
+    if (model_hash != model_hash_) {
+      num_stale++;
+      continue;
+    }
+    index_[strtoull(key.c_str(), NULL, 16)] = location;
+  }
+  if (num_bad > 0)
+    KALDI_WARN << "Ignoring " << num_bad << " malformed lines of " << filename;
+  KALDI_LOG << "Graph cache " << dir_ << " has " << index_.size()
+            << " graphs for these models and " << num_stale
+            << " stale ones, for other models.";
+}
+
+bool GraphCache::Lookup(const std::vector<int32> &word_ids,
+                        fst::VectorFst<fst::StdArc> *graph) {
+  uint64 key = Key(word_ids);
+  Location location;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unordered_map<uint64, Location>::const_iterator iter = index_.find(key);
+    if (iter == index_.end()) {
+      num_misses_++;
+      return false;
+    }
+    location = iter->second;
+  }
+  std::string filename = dir_ + "/" + location.archive;
+  std::ifstream is(filename.c_str(), std::ios::binary);
+  std::vector<int32> entry_word_ids;
+  fst::ConstFst<fst::StdArc> *entry_graph = NULL;
+  if (is.is_open() && is.seekg(location.offset)) {
+    try {
+      ReadIntegerVector(is, true, &entry_word_ids);
+      if (entry_word_ids == word_ids)
+        entry_graph = fst::ConstFst<fst::StdArc>::Read(
+            is, fst::FstReadOptions(filename));
+    } catch (const std::exception &e) {
+      entry_graph = NULL;
+    }
+  }
+  if (entry_graph == NULL) {
+    // A hash collision, or the archive was removed or damaged.
+    KALDI_WARN << "Could not read the graph cache entry at " << filename
+               << ':' << location.offset << "; compiling the graph.";
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_misses_++;
+    return false;
+  }
+  *graph = *entry_graph;
+  delete entry_graph;
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_hits_++;
+  return true;
+}
+
+void GraphCache::Insert(const std::vector<int32> &word_ids,
+                        const fst::Fst<fst::StdArc> &graph) {
+  uint64 key = Key(word_ids);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index_.count(key) != 0)
+    return;  // another thread got there first.
+  if (archive_.empty()) {
+    std::ostringstream name;
+    name << "graphs-" << model_hash_ << '-' << getpid() << '-'
+         << time(NULL) << ".ark";
+    archive_ = name.str();
+    std::string filename = dir_ + "/" + archive_;
+    archive_os_.open(filename.c_str(), std::ios::binary);
+    index_os_.open((dir_ + "/index").c_str(), std::ios::app);
+    if (!archive_os_.is_open() || !index_os_.is_open())
+      KALDI_ERR << "Could not open " << filename << " or the index of the "
+                << "graph cache for writing.";
+  }
+  Location location;
+  location.archive = archive_;
+  location.offset = archive_os_.tellp();
+  WriteIntegerVector(archive_os_, true, word_ids);
+  fst::ConstFst<fst::StdArc> const_graph(graph);
+  const_graph.Write(archive_os_, fst::FstWriteOptions(archive_));
+  archive_os_.flush();
+  if (!archive_os_.good())
+    KALDI_ERR << "Error writing graph cache archive " << dir_ << "/"
+              << archive_;
+  // The index line goes last, so it never points at a partial entry.
+  index_os_ << ToHex(key) << ' ' << model_hash_ << ' ' << location.archive
+            << ' ' << location.offset << std::endl;
+  index_[key] = location;
+  num_inserted_++;
+}
+
+GraphCache::~GraphCache() {
+  if (num_hits_ + num_misses_ > 0)
+    KALDI_LOG << "Graph cache " << dir_ << ": " << num_hits_ << " hits, "
+              << num_misses_ << " misses, " << num_inserted_
+              << " graphs added.";
+}
+
+}  // namespace kaldi
@@ -0,0 +1,120 @@
+// aligner/graph-cache.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_GRAPH_CACHE_H_
+#define KALDI_ALIGNER_GRAPH_CACHE_H_ 1
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "aligner/context-lexicon.h"
+#include "base/kaldi-common.h"
+#include "decoder/training-graph-compiler.h"
+#include "fstext/fstext-lib.h"
+#include "hmm/transition-model.h"
+#include "tree/context-dep.h"
+#include "util/stl-utils.h"
+
+namespace kaldi {
+
+/// Returns a hash of the states and arcs of "fst", so that a VectorFst and a
+/// ConstFst (as in a model bundle) of the same FST hash the same.  It reads
+/// the whole FST, so it is worth keeping, e.g. in the model bundle for the
+/// lexicon.
+uint64 FstHash(const fst::Fst<fst::StdArc> &fst);
+
+/// Returns a hash of the C o L FST of "context_lexicon" (its FstHash()) and of
+/// its ilabel_info, the phone window of each input symbol.
+uint64 ContextLexiconHash(const ContextLexicon &context_lexicon);
+
+/// Returns a hash, as 16 hex digits, of everything that a graph from
+/// TrainingGraphCompiler depends on besides the words: the tree, the HMM
+/// topology and transition-ids of "trans_model" (but not its probabilities,
+/// which the aligner adds after compiling), the lexicon (by its FstHash(),
+/// "lexicon_hash"), the disambiguation symbols and the graph options, and
+/// the context lexicon the graphs are compiled with, if any (by its
+/// ContextLexiconHash(), "context_lexicon_hash", or 0 for none).
+std::string GraphModelHash(const ContextDependency &ctx_dep,
+                           const TransitionModel &trans_model,
+                           uint64 lexicon_hash,
+                           const std::vector<int32> &disambig_syms,
+                           const TrainingGraphCompilerOptions &gopts,
+                           uint64 context_lexicon_hash);
+
+/// GraphCache keeps compiled graphs on disk, so that aligning the same
+/// transcripts again (after updating the GMMs, tuning the beams or changing
+/// the output format) loads each graph instead of compiling it.  A graph is
+/// found by a hash of its word ids and of the models (GraphModelHash()), so
+/// the entries of other models are never used; they are counted as stale when
+/// the cache is opened.
+///
+/// The cache is a directory holding archives of entries (the word ids, to
+/// catch hash collisions, and the graph as a ConstFst) and a text index with
+/// a line "<key> <model-hash> <archive> <offset>" per entry.  Each run
+/// appends to an archive of its own, and adds the index line only once the
+/// entry is written, so an interrupted run leaves no broken entries and
+/// several processes can share the directory.  Lookup() and Insert() may be
+/// called from several threads.
+class GraphCache {
+ public:
+  /// Opens the cache in directory "dir", creating the directory if needed,
+  /// for the models whose GraphModelHash() is "model_hash".
+  GraphCache(const std::string &dir, const std::string &model_hash);
+
+  /// If there is a graph for "word_ids", outputs it and returns true.
+  bool Lookup(const std::vector<int32> &word_ids,
+              fst::VectorFst<fst::StdArc> *graph);
+
+  /// Adds "graph" as the graph for "word_ids".
+  void Insert(const std::vector<int32> &word_ids,
+              const fst::Fst<fst::StdArc> &graph);
+
+  /// Logs the number of hits, misses and insertions.
+  ~GraphCache();
+
+ private:
+  struct Location {
+    std::string archive;  // file name, in dir_.
+    int64 offset;
+  };
+
+  uint64 Key(const std::vector<int32> &word_ids) const;
+
+  // Reads the index lines for model_hash_ into index_.
+  void ReadIndex();
+
+  std::string dir_;
+  std::string model_hash_;
+
+  std::mutex mutex_;
+  unordered_map<uint64, Location> index_;
+  std::string archive_;  // this run's archive, opened by the first Insert().
+  std::ofstream archive_os_;
+  std::ofstream index_os_;
+  int64 num_hits_;
+  int64 num_misses_;
+  int64 num_inserted_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(GraphCache);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_GRAPH_CACHE_H_
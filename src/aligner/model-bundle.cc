@@ -0,0 +1,297 @@
+// aligner/model-bundle.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "aligner/model-bundle.h"
+#include "aligner/graph-cache.h"
+#include "decoder/training-graph-compiler.h"
+
+namespace kaldi {
+
+namespace {
+
+const char kBundleMagic[8] = { 'K', 'A', 'L', 'D', 'I', 'B', 'N', 'D' };
+const uint32 kBundleVersion = 2;
+const uint32 kMaxSections = 16;
+const size_t kSectionAlignment = 64;
+
+struct BundleHeader {
+  char magic[8];
+  uint32 version;
+  uint32 num_sections;
+};
+
+struct BundleSection {
+  char name[24];
+  uint64 offset;
+  uint64 size;
+};
+
+// Helps ModelBundle::Write() lay out the sections.
+class BundleWriter {
+ public:
+  BundleWriter(std::ofstream *os): os_(os) {
+    std::vector<char> zeros(sizeof(BundleHeader) +
+                            kMaxSections * sizeof(BundleSection), 0);
+    os_->write(&(zeros[0]), zeros.size());
+  }
+
+  // Starts a section at the next aligned offset.
+  void Begin(const char *name) {
+    KALDI_ASSERT(sections_.size() < kMaxSections &&
+                 strlen(name) < sizeof(BundleSection().name));
+    size_t pos = os_->tellp();
+    for (; pos % kSectionAlignment != 0; pos++)
+      os_->put('\0');
+    BundleSection section;
+    memset(&section, 0, sizeof(section));
+    strncpy(section.name, name, sizeof(section.name) - 1);
+    section.offset = pos;
+    sections_.push_back(section);
+  }
+
+  void End() {
+    sections_.back().size = static_cast<size_t>(os_->tellp()) -
+        sections_.back().offset;
+  }
+
+  template<class T>
+  void WriteArray(const char *name, const T *data, size_t n) {
+    Begin(name);
+    os_->write(reinterpret_cast<const char*>(data), n * sizeof(T));
+    End();
+  }
+
+  void Finish() {
+    BundleHeader header;
+    memcpy(header.magic, kBundleMagic, sizeof(header.magic));
+    header.version = kBundleVersion;
+    header.num_sections = sections_.size();
+    os_->seekp(0);
+    os_->write(reinterpret_cast<const char*>(&header), sizeof(header));
+    os_->write(reinterpret_cast<const char*>(&(sections_[0])),
+               sections_.size() * sizeof(BundleSection));
+  }
+
+ private:
+  std::ofstream *os_;
+  std::vector<BundleSection> sections_;
+};
+
+}  // namespace
+
+void ModelBundle::Write(const std::string &filename,
+                        const ContextDependency &ctx_dep,
+                        const TransitionModel &trans_model,
+                        const AmDiagGmm &am_gmm,
+                        const fst::Fst<fst::StdArc> &lex_fst,
+                        const std::vector<int32> &disambig_syms) {
+  std::ofstream os(filename.c_str(), std::ios::out | std::ios::binary);
+  if (!os)
+    KALDI_ERR << "Could not open " << filename << " for writing.";
+  FlatAmDiagGmm gmm;
+  gmm.CopyFromAmDiagGmm(am_gmm);
+  BundleWriter writer(&os);
+
+  writer.Begin("tree");
+  ctx_dep.Write(os, true);
+  writer.End();
+  writer.Begin("transition-model");
+  trans_model.Write(os, true);
+  writer.End();
+
+  int32 info[3] = { gmm.NumPdfs(), gmm.Dim(),
+                    static_cast<int32>(sizeof(BaseFloat)) };
+  size_t total = gmm.TotalComponents(), dim = gmm.Dim();
+  writer.WriteArray("gmm-info", info, 3);
+  writer.WriteArray("gmm-offsets", gmm.Offsets(), gmm.NumPdfs() + 1);
+  writer.WriteArray("gmm-gconsts", gmm.Gconsts(), total);
+  writer.WriteArray("gmm-weights", gmm.Weights(), total);
+  writer.WriteArray("gmm-means-invvars", gmm.MeansInvVars(), total * dim);
+  writer.WriteArray("gmm-inv-vars", gmm.InvVars(), total * dim);
+
+  uint64 lexicon_hash = FstHash(lex_fst);
+  writer.WriteArray("lexicon-hash", &lexicon_hash, 1);
+  std::vector<int32> sorted_disambig_syms(disambig_syms);
+  SortAndUniq(&sorted_disambig_syms);
+  writer.WriteArray("lexicon-disambig", sorted_disambig_syms.data(),
+                    sorted_disambig_syms.size());
+  // The aligned ConstFst format is what lets OpenFst map the arrays.
+  writer.Begin("lexicon");
+  fst::VectorFst<fst::StdArc> prepared_lex(lex_fst);
+  TrainingGraphCompiler::PrepareLexicon(trans_model, ctx_dep,
+                                        sorted_disambig_syms, &prepared_lex);
+  fst::ConstFst<fst::StdArc> const_lex(prepared_lex);
+  fst::FstWriteOptions write_opts(filename);
+  write_opts.align = true;
+  if (!const_lex.Write(os, write_opts))
+    KALDI_ERR << "Error writing lexicon to " << filename;
+  writer.End();
+
+  writer.Finish();
+  if (!os.flush())
+    KALDI_ERR << "Error writing " << filename;
+}
+
+void ModelBundle::Open(const std::string &filename) {
+  KALDI_ASSERT(data_ == NULL);
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    KALDI_ERR << "Could not open model bundle " << filename << ": "
+              << strerror(errno);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(BundleHeader)) {
+    close(fd);
+    KALDI_ERR << "Could not read model bundle " << filename;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    KALDI_ERR << "Could not map model bundle " << filename << ": "
+              << strerror(errno);
+  filename_ = filename;
+  data_ = static_cast<char*>(map);
+  size_ = st.st_size;
+
+  const BundleHeader *header = reinterpret_cast<const BundleHeader*>(data_);
+  if (memcmp(header->magic, kBundleMagic, sizeof(kBundleMagic)) != 0 ||
+      header->version != kBundleVersion ||
+      header->num_sections > kMaxSections ||
+      size_ < sizeof(BundleHeader) +
+      header->num_sections * sizeof(BundleSection))
+    KALDI_ERR << filename << " is not a model bundle (or is from a "
+              << "different version; rerun make-model-bundle).";
+  const BundleSection *sections = reinterpret_cast<const BundleSection*>(
+      data_ + sizeof(BundleHeader));
+  for (uint32 i = 0; i < header->num_sections; i++)
+    if (sections[i].offset > size_ ||
+        sections[i].size > size_ - sections[i].offset)
+      KALDI_ERR << "Model bundle " << filename << " is truncated.";
+  KALDI_LOG << "Mapped model bundle " << filename << " (" << size_
+            << " bytes)";
+}
+
+ModelBundle::~ModelBundle() {
+  if (data_ != NULL)
+    munmap(data_, size_);
+}
+
+size_t ModelBundle::SectionIndex(const std::string &name) const {
+  KALDI_ASSERT(data_ != NULL);
+  const BundleHeader *header = reinterpret_cast<const BundleHeader*>(data_);
+  const BundleSection *sections = reinterpret_cast<const BundleSection*>(
+      data_ + sizeof(BundleHeader));
+  for (uint32 i = 0; i < header->num_sections; i++)
+    if (name == sections[i].name)
+      return i;
+  KALDI_ERR << "No section " << name << " in model bundle " << filename_;
+  return 0;
+}
+
+const char *ModelBundle::Section(const std::string &name,
+                                 size_t *size) const {
+  const BundleSection *section = reinterpret_cast<const BundleSection*>(
+      data_ + sizeof(BundleHeader)) + SectionIndex(name);
+  *size = section->size;
+  return data_ + section->offset;
+}
+
+void ModelBundle::ReadTree(ContextDependency *ctx_dep) const {
+  size_t size;
+  const char *data = Section("tree", &size);
+  std::istringstream is(std::string(data, size));
+  ctx_dep->Read(is, true);
+}
+
+void ModelBundle::ReadTransitionModel(TransitionModel *trans_model) const {
+  size_t size;
+  const char *data = Section("transition-model", &size);
+  std::istringstream is(std::string(data, size));
+  trans_model->Read(is, true);
+}
+
+void ModelBundle::GetGmm(FlatAmDiagGmm *gmm) const {
+  size_t size;
+  const int32 *info = reinterpret_cast<const int32*>(
+      Section("gmm-info", &size));
+  if (size != 3 * sizeof(int32) || info[2] != sizeof(BaseFloat))
+    KALDI_ERR << "Model bundle " << filename_ << " was written with a "
+              << "different floating-point type.";
+  int32 num_pdfs = info[0], dim = info[1];
+  const int32 *offsets = reinterpret_cast<const int32*>(
+      Section("gmm-offsets", &size));
+  if (size != (num_pdfs + 1) * sizeof(int32))
+    KALDI_ERR << "Corrupted model bundle " << filename_;
+  size_t total = offsets[num_pdfs];
+  const BaseFloat *arrays[4];
+  const char *names[4] = { "gmm-gconsts", "gmm-weights", "gmm-means-invvars",
+                           "gmm-inv-vars" };
+  for (int32 i = 0; i < 4; i++) {
+    arrays[i] = reinterpret_cast<const BaseFloat*>(Section(names[i], &size));
+    if (size != total * (i < 2 ? 1 : dim) * sizeof(BaseFloat))
+      KALDI_ERR << "Corrupted model bundle " << filename_;
+  }
+  gmm->SetExternal(num_pdfs, dim, offsets, arrays[0], arrays[1], arrays[2],
+                   arrays[3]);
+}
+
+fst::ConstFst<fst::StdArc> *ModelBundle::ReadLexicon() const {
+  size_t size;
+  const char *data = Section("lexicon", &size);
+  std::ifstream is(filename_.c_str(), std::ios::in | std::ios::binary);
+  is.seekg(data - data_);
+  fst::FstReadOptions read_opts(filename_);
+  read_opts.mode = fst::FstReadOptions::MAP;
+  fst::ConstFst<fst::StdArc> *ans =
+      fst::ConstFst<fst::StdArc>::Read(is, read_opts);
+  if (ans == NULL)
+    KALDI_ERR << "Could not read lexicon from model bundle " << filename_;
+  return ans;
+}
+
+uint64 ModelBundle::LexiconHash() const {
+  size_t size;
+  const char *data = Section("lexicon-hash", &size);
+  if (size != sizeof(uint64))
+    KALDI_ERR << "Corrupted model bundle " << filename_;
+  uint64 ans;
+  memcpy(&ans, data, sizeof(ans));
+  return ans;
+}
+
+void ModelBundle::ReadLexiconDisambigSyms(
+    std::vector<int32> *disambig_syms) const {
+  size_t size;
+  const int32 *data = reinterpret_cast<const int32*>(
+      Section("lexicon-disambig", &size));
+  if (size % sizeof(int32) != 0)
+    KALDI_ERR << "Corrupted model bundle " << filename_;
+  disambig_syms->assign(data, data + size / sizeof(int32));
+}
+
+}  // namespace kaldi
@@ -0,0 +1,99 @@
+// aligner/model-bundle.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_MODEL_BUNDLE_H_
+#define KALDI_ALIGNER_MODEL_BUNDLE_H_ 1
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "fstext/fstext-lib.h"
+#include "hmm/transition-model.h"
+#include "tree/context-dep.h"
+#include "aligner/flat-am-diag-gmm.h"
+
+namespace kaldi {
+
+/// ModelBundle is a single file with everything the aligner loads from the
+/// tree, final.mdl and L.fst: the tree and transition model (in Kaldi binary
+/// form; they are small), the GMM parameters as the flat arrays of
+/// FlatAmDiagGmm, and the lexicon as an aligned ConstFst, already prepared
+/// for TrainingGraphCompiler (see PrepareLexicon()), with its hash
+/// (FstHash()) and the disambiguation symbols it was prepared for.  Open()
+/// maps the file into memory, and the GMM arrays and the lexicon are used in
+/// place, by all the graph compilers at once, so loading costs almost
+/// nothing and processes on one machine share the pages.  The file is in the machine's native byte order; it is written by
+/// make-model-bundle.
+///
+/// Layout: a header ("KALDIBND", version, number of sections), a table of
+/// (name, offset, size) for each section, and the sections, each starting at
+/// a multiple of 64 bytes.
+class ModelBundle {
+ public:
+  ModelBundle(): data_(NULL), size_(0) { }
+
+  /// Maps "filename", which must be a file (not a pipe or other rxfilename).
+  void Open(const std::string &filename);
+
+  bool IsOpen() const { return data_ != NULL; }
+
+  void ReadTree(ContextDependency *ctx_dep) const;
+  void ReadTransitionModel(TransitionModel *trans_model) const;
+
+  /// Points "gmm" at the arrays in the mapped file, which must stay open for
+  /// as long as "gmm" is used.
+  void GetGmm(FlatAmDiagGmm *gmm) const;
+
+  /// Returns the prepared lexicon, mapped from the file; the caller owns it.
+  fst::ConstFst<fst::StdArc> *ReadLexicon() const;
+
+  /// Returns the FstHash() of the lexicon as it was given to Write(), before
+  /// it was prepared.
+  uint64 LexiconHash() const;
+
+  /// Outputs the disambiguation symbols the lexicon was prepared for.
+  void ReadLexiconDisambigSyms(std::vector<int32> *disambig_syms) const;
+
+  /// Writes the bundle; "lex_fst" is prepared for TrainingGraphCompiler with
+  /// "disambig_syms" before it is written.
+  static void Write(const std::string &filename,
+                    const ContextDependency &ctx_dep,
+                    const TransitionModel &trans_model,
+                    const AmDiagGmm &am_gmm,
+                    const fst::Fst<fst::StdArc> &lex_fst,
+                    const std::vector<int32> &disambig_syms);
+
+  ~ModelBundle();
+
+ private:
+  // Returns the start of section "name" and puts its size in "size"; it is
+  // an error if there is no such section.
+  const char *Section(const std::string &name, size_t *size) const;
+  size_t SectionIndex(const std::string &name) const;
+
+  std::string filename_;
+  char *data_;
+  size_t size_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ModelBundle);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_MODEL_BUNDLE_H_
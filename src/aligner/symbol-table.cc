@@ -0,0 +1,153 @@
+// aligner/symbol-table.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstring>
+
+#include "aligner/symbol-table.h"
+#include "util/text-utils.h"
+
+namespace kaldi {
+
+uint32 HashSymbolTable::Hash(const char *symbol, size_t len) {
+  uint32 hash = 2166136261u;  // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    hash ^= static_cast<unsigned char>(symbol[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+int32 HashSymbolTable::Find(const char *symbol, size_t len) const {
+  if (slots_.empty())
+    return -1;
+  size_t mask = slots_.size() - 1;
+  for (size_t i = Hash(symbol, len) & mask; slots_[i] != -1;
+       i = (i + 1) & mask) {
+    const std::string &s = symbols_[slots_[i]];
+    if (s.size() == len && memcmp(s.data(), symbol, len) == 0)
+      return slots_[i];
+  }
+  return -1;
+}
+
+void HashSymbolTable::Rehash(size_t num_symbols) {
+  size_t size = 16;
+  while (size < 2 * num_symbols)
+    size *= 2;
+  std::vector<int32> old_slots(size, -1);
+  old_slots.swap(slots_);
+  size_t mask = size - 1;
+  for (size_t j = 0; j < old_slots.size(); j++) {
+    int32 id = old_slots[j];
+    if (id == -1)
+      continue;
+    const std::string &s = symbols_[id];
+    size_t i = Hash(s.data(), s.size()) & mask;
+    while (slots_[i] != -1)
+      i = (i + 1) & mask;
+    slots_[i] = id;
+  }
+}
+
+void HashSymbolTable::AddSymbol(const std::string &symbol, int32 id) {
+  if (id < 0 || symbol.empty())
+    KALDI_ERR << "Bad symbol '" << symbol << "' with id " << id;
+  if (2 * (num_symbols_ + 1) > slots_.size())
+    Rehash(2 * (num_symbols_ + 1));
+  if (id >= static_cast<int32>(symbols_.size()))
+    symbols_.resize(id + 1);
+  size_t mask = slots_.size() - 1;
+  size_t i = Hash(symbol.data(), symbol.size()) & mask;
+  for (; slots_[i] != -1; i = (i + 1) & mask) {
+    if (symbols_[slots_[i]] == symbol) {
+      slots_[i] = id;
+      symbols_[id] = symbol;
+      return;
+    }
+  }
+  slots_[i] = id;
+  symbols_[id] = symbol;
+  num_symbols_++;
+}
+
+void HashSymbolTable::Read(std::istream &is, bool binary) {
+  symbols_.clear();
+  slots_.clear();
+  num_symbols_ = 0;
+  if (!binary) {
+    std::string line;
+    std::vector<std::string> items;
+    while (std::getline(is, line)) {
+      SplitStringToVector(line, " \t\r", true, &items);
+      if (items.empty())
+        continue;
+      int32 id;
+      if (items.size() != 2 || !ConvertStringToInteger(items[1], &id))
+        KALDI_ERR << "Bad line in symbol table: " << line;
+      AddSymbol(items[0], id);
+    }
+    return;
+  }
+  ExpectToken(is, binary, "<HashSymbolTable>");
+  ReadBasicType(is, binary, &num_symbols_);
+  std::vector<int32> lengths;
+  ReadIntegerVector(is, binary, &lengths);
+  int64 num_bytes;
+  ReadBasicType(is, binary, &num_bytes);
+  std::string bytes(num_bytes, '\0');
+  if (num_bytes > 0 && !is.read(&(bytes[0]), num_bytes))
+    KALDI_ERR << "Error reading symbol table.";
+  symbols_.resize(lengths.size());
+  for (size_t id = 0, offset = 0; id < lengths.size(); id++) {
+    if (offset + lengths[id] > bytes.size())
+      KALDI_ERR << "Corrupted symbol table.";
+    symbols_[id].assign(bytes, offset, lengths[id]);
+    offset += lengths[id];
+  }
+  ReadIntegerVector(is, binary, &slots_);
+  ExpectToken(is, binary, "</HashSymbolTable>");
+  if ((slots_.size() & (slots_.size() - 1)) != 0)
+    KALDI_ERR << "Corrupted symbol table.";
+}
+
+void HashSymbolTable::Write(std::ostream &os, bool binary) const {
+  if (!binary) {
+    for (size_t id = 0; id < symbols_.size(); id++)
+      if (!symbols_[id].empty() &&
+          Find(symbols_[id]) == static_cast<int32>(id))
+        os << symbols_[id] << ' ' << id << '\n';
+    return;
+  }
+  WriteToken(os, binary, "<HashSymbolTable>");
+  WriteBasicType(os, binary, num_symbols_);
+  std::vector<int32> lengths(symbols_.size());
+  int64 num_bytes = 0;
+  for (size_t id = 0; id < symbols_.size(); id++) {
+    lengths[id] = symbols_[id].size();
+    num_bytes += lengths[id];
+  }
+  WriteIntegerVector(os, binary, lengths);
+  WriteBasicType(os, binary, num_bytes);
+  for (size_t id = 0; id < symbols_.size(); id++)
+    os.write(symbols_[id].data(), symbols_[id].size());
+  WriteIntegerVector(os, binary, slots_);
+  WriteToken(os, binary, "</HashSymbolTable>");
+}
+
+}  // namespace kaldi
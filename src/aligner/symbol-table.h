@@ -0,0 +1,85 @@
+// aligner/symbol-table.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_SYMBOL_TABLE_H_
+#define KALDI_ALIGNER_SYMBOL_TABLE_H_ 1
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+/// HashSymbolTable maps between the symbols of words.txt or phones.txt and
+/// their integer ids.  The symbols are held in a vector indexed by id, so
+/// looking up an id is an array access, and symbols are looked up by an
+/// open-addressing hash table of ids (a flat array, probed linearly).
+///
+/// In text mode Read() and Write() use the "<symbol> <id>" lines of
+/// words.txt; the binary format also holds the hash table, so a large table
+/// in binary form (see copy-symbol-table) loads without any parsing or
+/// hashing.  Like other Kaldi objects, it is read with ReadKaldiObject(),
+/// which works out which format the file is in.
+class HashSymbolTable {
+ public:
+  HashSymbolTable(): num_symbols_(0) { }
+
+  /// Adds "symbol" with id "id".  If the symbol is already present, lookups
+  /// of it return the new id from now on.
+  void AddSymbol(const std::string &symbol, int32 id);
+
+  /// Returns the id of "symbol", or -1 if it is not in the table.
+  int32 Find(const std::string &symbol) const {
+    return Find(symbol.data(), symbol.size());
+  }
+  int32 Find(const char *symbol, size_t len) const;
+
+  /// Returns the symbol with id "id"; it is an error if there is none.
+  const std::string &Symbol(int32 id) const {
+    if (!HasId(id))
+      KALDI_ERR << "No symbol with id " << id << " in symbol table.";
+    return symbols_[id];
+  }
+
+  bool HasId(int32 id) const {
+    return id >= 0 && id < static_cast<int32>(symbols_.size()) &&
+        !symbols_[id].empty();
+  }
+
+  /// Ids run from 0 to NumIds() - 1, with possible gaps (see HasId()).
+  int32 NumIds() const { return symbols_.size(); }
+  int32 NumSymbols() const { return num_symbols_; }
+
+  void Read(std::istream &is, bool binary);
+  void Write(std::ostream &os, bool binary) const;
+
+ private:
+  static uint32 Hash(const char *symbol, size_t len);
+  // Rebuilds slots_ with room for "num_symbols" symbols.
+  void Rehash(size_t num_symbols);
+
+  std::vector<std::string> symbols_;  // indexed by id; empty if no symbol.
+  std::vector<int32> slots_;  // ids, or -1; the size is a power of 2.
+  int32 num_symbols_;
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_SYMBOL_TABLE_H_
@@ -0,0 +1,174 @@
+// aligner/word-segmenter.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cctype>
+#include <deque>
+
+#include "aligner/word-segmenter.h"
+
+namespace kaldi {
+
+// The characters of "\w": English letters, digits and '_'.
+static inline bool IsWordChar(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+      (c >= '0' && c <= '9') || c == '_';
+}
+
+// Orders words bytewise.
+struct WordPtrLess {
+  bool operator () (const std::pair<const std::string*, int32> &a,
+                    const std::pair<const std::string*, int32> &b) const {
+    return *a.first < *b.first;
+  }
+};
+
+WordSegmenter::WordSegmenter(const HashSymbolTable &words_table):
+    words_(words_table) {
+  // Once sorted bytewise, the words below a trie node form a range of the
+  // list, and the nodes can be laid out breadth-first in one pass.
+  std::vector<std::pair<const std::string*, int32> > words;
+  words.reserve(words_table.NumSymbols());
+  for (int32 id = 0; id < words_table.NumIds(); id++)
+    if (words_table.HasId(id) &&
+        words_table.Find(words_table.Symbol(id)) == id)
+      words.push_back(std::make_pair(&(words_table.Symbol(id)), id));
+  std::sort(words.begin(), words.end(), WordPtrLess());
+
+  struct Range {
+    size_t begin, end, depth;
+  };
+  std::deque<Range> queue;
+  Range root = { 0, words.size(), 0 };
+  queue.push_back(root);
+  label_.push_back(0);
+  while (!queue.empty()) {
+    Range r = queue.front();
+    queue.pop_front();
+    first_child_.push_back(label_.size());
+    word_id_.push_back(-1);
+    if (r.begin < r.end && words[r.begin].first->size() == r.depth) {
+      word_id_.back() = words[r.begin].second;
+      r.begin++;
+    }
+    while (r.begin < r.end) {
+      char c = (*words[r.begin].first)[r.depth];
+      Range child = { r.begin, r.begin + 1, r.depth + 1 };
+      while (child.end < r.end && (*words[child.end].first)[r.depth] == c)
+        child.end++;
+      label_.push_back(c);
+      queue.push_back(child);
+      r.begin = child.end;
+    }
+  }
+  first_child_.push_back(label_.size());
+  unk_id_ = WordId("<UNK>");
+  KALDI_VLOG(1) << "Built word trie with " << label_.size() << " nodes for "
+                << words.size() << " words.";
+}
+
+int32 WordSegmenter::Child(int32 node, unsigned char c) const {
+  std::vector<unsigned char>::const_iterator
+      begin = label_.begin() + first_child_[node],
+      end = label_.begin() + first_child_[node + 1],
+      iter = std::lower_bound(begin, end, c);
+  return (iter != end && *iter == c ? iter - label_.begin() : -1);
+}
+
+void WordSegmenter::Add(const char *word, size_t len, int32 id,
+                        std::vector<std::string> *words,
+                        std::vector<int32> *word_ids) const {
+  if (words != NULL)
+    words->push_back(std::string(word, len));
+  word_ids->push_back(id);
+}
+
+void WordSegmenter::Segment(const std::vector<std::string> &transcript,
+                            bool case_sensitive, bool spell_en_oov,
+                            std::vector<std::string> *words,
+                            std::vector<int32> *word_ids) const {
+  std::string str;
+  for (size_t i = 0; i < transcript.size(); i++) {
+    str = transcript[i];
+    if (!case_sensitive)
+      std::transform(str.begin(), str.end(), str.begin(), ::toupper);
+    const char *s = str.data();
+    size_t n = str.size();
+    int32 id = words_.Find(s, n);
+    if (id >= 0) {  // in dict, just add into results
+      Add(s, n, id, words, word_ids);
+      continue;
+    }
+    size_t pos = 0;
+    while (pos < n) {
+      // The run of English characters at "pos" (these are single bytes).
+      size_t run = 0;
+      while (pos + run < n && run < kMaxWordLength && IsWordChar(s[pos + run]))
+        run++;
+      // The longest word starting at "pos", walking one UTF-8 character at a
+      // time.
+      size_t match_chars = 0, match_end = pos;
+      int32 match_id = -1;
+      int32 node = 0;
+      for (size_t b = pos, chars = 0; b < n && chars < kMaxWordLength; ) {
+        size_t e = b + 1;
+        while (e < n && (static_cast<unsigned char>(s[e]) & 0xC0) == 0x80)
+          e++;
+        for (; b < e && node >= 0; b++)
+          node = Child(node, s[b]);
+        if (node < 0)
+          break;
+        chars++;
+        if (word_id_[node] >= 0) {
+          match_chars = chars;
+          match_end = e;
+          match_id = word_id_[node];
+        }
+      }
+
+      if (match_chars > run) {  // a word that is not only English letters.
+        Add(s + pos, match_end - pos, match_id, words, word_ids);
+        pos = match_end;
+      } else if (run > 1 || (run == 1 && pos + 1 == n)) {  // en
+        if (match_chars == run) {  // iv
+          Add(s + pos, run, match_id, words, word_ids);
+        } else if (spell_en_oov) {  // oov
+          for (size_t j = 0; j < run; j++) {
+            int32 letter_id = words_.Find(s + pos + j, 1);
+            Add(s + pos + j, 1, (letter_id < 0 ? 0 : letter_id), words,
+                word_ids);
+          }
+        } else {
+          Add("<UNK>", 5, unk_id_, words, word_ids);
+        }
+        pos += run;
+      } else if (match_chars == 1) {  // a 1-char word
+        Add(s + pos, match_end - pos, match_id, words, word_ids);
+        pos = match_end;
+      } else {  // any 1-char oov
+        Add("<UNK>", 5, unk_id_, words, word_ids);
+        pos++;
+        while (pos < n && (static_cast<unsigned char>(s[pos]) & 0xC0) == 0x80)
+          pos++;
+      }
+    }
+  }
+}
+
+}  // namespace kaldi
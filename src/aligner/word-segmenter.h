@@ -0,0 +1,83 @@
+// aligner/word-segmenter.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_ALIGNER_WORD_SEGMENTER_H_
+#define KALDI_ALIGNER_WORD_SEGMENTER_H_ 1
+
+#include <string>
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "aligner/symbol-table.h"
+
+namespace kaldi {
+
+/// WordSegmenter splits a transcript into the words of the word symbol table
+/// by forward maximum matching, for text such as Chinese that is not
+/// separated into words.  Each whitespace-separated item that is not itself a
+/// word is scanned from left to right, taking at each position the longest
+/// word (of up to 20 characters) that starts there.  A run of English letters
+/// and digits is taken as a whole: if it is not a word it is spelled out
+/// letter by letter (or, without spelling, becomes <UNK>), and any other
+/// character that starts no word becomes <UNK>.
+///
+/// The words are held in a byte-level prefix trie, built once, whose nodes
+/// are stored breadth-first in flat arrays with the children of a node next
+/// to each other; a scan walks the trie over the UTF-8 bytes, so it needs no
+/// conversions or allocation.  Whole items are looked up in the word table,
+/// which must outlive the segmenter.
+class WordSegmenter {
+ public:
+  explicit WordSegmenter(const HashSymbolTable &words);
+
+  /// Appends the word ids of "transcript" to "word_ids", and the words to
+  /// "words" if it is not NULL.  Unless "case_sensitive", the text is
+  /// upper-cased first.
+  void Segment(const std::vector<std::string> &transcript,
+               bool case_sensitive, bool spell_en_oov,
+               std::vector<std::string> *words,
+               std::vector<int32> *word_ids) const;
+
+  /// Returns the id of "word", or 0 (<eps>) if it is not in the table.
+  int32 WordId(const std::string &word) const {
+    int32 id = words_.Find(word);
+    return (id < 0 ? 0 : id);
+  }
+
+  static const int32 kMaxWordLength = 20;  // in characters.
+
+ private:
+  // Returns the child of "node" labelled "c", or -1.
+  int32 Child(int32 node, unsigned char c) const;
+
+  void Add(const char *word, size_t len, int32 id,
+           std::vector<std::string> *words, std::vector<int32> *word_ids) const;
+
+  const HashSymbolTable &words_;
+  // Node 0 is the root.  The children of node n are the nodes
+  // first_child_[n] to first_child_[n + 1] - 1, in order of label_.
+  std::vector<int32> first_child_;
+  std::vector<unsigned char> label_;
+  std::vector<int32> word_id_;  // -1 if no word ends at the node.
+  int32 unk_id_;  // 0 if there is no <UNK>.
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_ALIGNER_WORD_SEGMENTER_H_
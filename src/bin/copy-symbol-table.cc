@@ -0,0 +1,61 @@
+// bin/copy-symbol-table.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "aligner/symbol-table.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+
+    const char *usage =
+        "Copy a symbol table (words.txt or phones.txt), by default to the binary\n"
+        "format, which speech-aligner loads without parsing (give it as\n"
+        "--word-symbol-table or --phone-symbol-table as usual).\n"
+        "\n"
+        "Usage:  copy-symbol-table [options...] <symbol-table-in> <symbol-table-out>\n"
+        "e.g.: \n"
+        " copy-symbol-table res/words.txt res/words.bin\n";
+
+    ParseOptions po(usage);
+    bool binary = true;
+    po.Register("binary", &binary, "Write in binary mode");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string symtab_rxfilename = po.GetArg(1),
+        symtab_wxfilename = po.GetArg(2);
+
+    HashSymbolTable symtab;
+    ReadKaldiObject(symtab_rxfilename, &symtab);
+    WriteKaldiObject(symtab, symtab_wxfilename, binary);
+    KALDI_LOG << "Copied symbol table with " << symtab.NumSymbols()
+              << " symbols to " << symtab_wxfilename;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
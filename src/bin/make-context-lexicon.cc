@@ -0,0 +1,78 @@
+// bin/make-context-lexicon.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "aligner/context-lexicon.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+
+    const char *usage =
+        "Compose the context FST of the tree with the lexicon, once, for\n"
+        "speech-aligner --context-lexicon, which then compiles each graph\n"
+        "from it.  The lexicon is L.fst (with optional silence) or, for\n"
+        "--opt-sil=false, L_nosil.fst.\n"
+        "\n"
+        "Usage:  make-context-lexicon [options...] <tree-rxfilename> "
+        "<lexicon-fst-rxfilename> <context-lexicon-wxfilename>\n"
+        "e.g.: \n"
+        " make-context-lexicon res/tree res/L.fst res/CL.bin\n";
+
+    ParseOptions po(usage);
+    std::string disambig_rxfilename;
+    po.Register("read-disambig-syms", &disambig_rxfilename, "File containing "
+                "list of disambiguation symbols in phone symbol table");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 3) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string tree_rxfilename = po.GetArg(1),
+        lex_rxfilename = po.GetArg(2),
+        cl_wxfilename = po.GetArg(3);
+
+    ContextDependency ctx_dep;
+    ReadKaldiObject(tree_rxfilename, &ctx_dep);
+    fst::VectorFst<fst::StdArc> *lex_fst = fst::ReadFstKaldi(lex_rxfilename);
+    std::vector<int32> disambig_syms;
+    if (!disambig_rxfilename.empty() &&
+        !ReadIntegerVectorSimple(disambig_rxfilename, &disambig_syms))
+      KALDI_ERR << "Could not read disambiguation symbols from "
+                << disambig_rxfilename;
+
+    ContextLexicon context_lexicon;
+    context_lexicon.Build(ctx_dep, disambig_syms, *lex_fst);
+    WriteKaldiObject(context_lexicon, cl_wxfilename, true);
+    KALDI_LOG << "Wrote context lexicon with "
+              << lex_fst->NumStates() << " lexicon states, "
+              << context_lexicon.ILabelInfo().size()
+              << " phones in context and "
+              << fst::CountStates(context_lexicon.Fst()) << " states to "
+              << cl_wxfilename;
+    delete lex_fst;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
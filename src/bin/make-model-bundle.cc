@@ -0,0 +1,85 @@
+// bin/make-model-bundle.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "aligner/model-bundle.h"
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+
+    const char *usage =
+        "Pack the tree, model and lexicon into one model bundle, which\n"
+        "speech-aligner maps into memory instead of parsing (give it as\n"
+        "--model-bundle).  The lexicon is L.fst or, for --opt-sil=false,\n"
+        "L_nosil.fst; it is stored ready for the graph compiler, so give the\n"
+        "same --read-disambig-syms as to speech-aligner.  The bundle is in the\n"
+        "native byte order of this machine.\n"
+        "\n"
+        "Usage:  make-model-bundle [options...] <tree-rxfilename> "
+        "<model-rxfilename> <lexicon-fst-rxfilename> <bundle-filename>\n"
+        "e.g.: \n"
+        " make-model-bundle res/tree res/final.mdl res/L.fst res/model.bundle\n";
+
+    ParseOptions po(usage);
+    std::string disambig_rxfilename;
+    po.Register("read-disambig-syms", &disambig_rxfilename, "File containing "
+                "list of disambiguation symbols in phone symbol table");
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 4) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string tree_rxfilename = po.GetArg(1),
+        model_rxfilename = po.GetArg(2),
+        lex_rxfilename = po.GetArg(3),
+        bundle_filename = po.GetArg(4);
+
+    ContextDependency ctx_dep;
+    ReadKaldiObject(tree_rxfilename, &ctx_dep);
+    TransitionModel trans_model;
+    AmDiagGmm am_gmm;
+    {
+      bool binary;
+      Input ki(model_rxfilename, &binary);
+      trans_model.Read(ki.Stream(), binary);
+      am_gmm.Read(ki.Stream(), binary);
+    }
+    fst::VectorFst<fst::StdArc> *lex_fst = fst::ReadFstKaldi(lex_rxfilename);
+    std::vector<int32> disambig_syms;
+    if (!disambig_rxfilename.empty() &&
+        !ReadIntegerVectorSimple(disambig_rxfilename, &disambig_syms))
+      KALDI_ERR << "Could not read disambiguation symbols from "
+                << disambig_rxfilename;
+
+    ModelBundle::Write(bundle_filename, ctx_dep, trans_model, am_gmm,
+                       *lex_fst, disambig_syms);
+    KALDI_LOG << "Wrote model bundle with " << am_gmm.NumPdfs() << " pdfs and "
+              << lex_fst->NumStates() << " lexicon states to "
+              << bundle_filename;
+    delete lex_fst;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
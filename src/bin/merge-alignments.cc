@@ -0,0 +1,237 @@
+// bin/merge-alignments.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <set>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+
+namespace kaldi {
+
+/// Output format, chosen by the same options as speech-aligner.
+enum AlignmentFormat { kCustomFormat, kMlfFormat, kCtmFormat, kTableFormat };
+
+/// Reads the alignments in a text format (custom, MLF or CTM) into "records",
+/// the text of each utterance's alignment by utterance-id, adding the ids to
+/// "keys" in the order they are first seen.
+void ReadTextAlignments(const std::string &rxfilename, AlignmentFormat format,
+                        std::map<std::string, std::string> *records,
+                        std::vector<std::string> *keys) {
+  Input ki(rxfilename);
+  std::istream &is = ki.Stream();
+  std::string line, key, record;
+  bool in_record = false;
+  int32 num_read = 0;
+  for (size_t line_number = 1; std::getline(is, line); line_number++) {
+    if (format == kCtmFormat) {
+      std::vector<std::string> fields;
+      SplitStringToVector(line, " \t", true, &fields);
+      if (fields.empty())
+        continue;
+      key = fields[0];
+    } else if (!in_record) {
+      if (line.empty() || (format == kMlfFormat && line == "#!MLF!#"))
+        continue;
+      key = line;
+      if (format == kMlfFormat) {
+        // "*/<utt>.lab"
+        if (line.size() < 8 || line.compare(0, 3, "\"*/") != 0 ||
+            line.compare(line.size() - 5, 5, ".lab\"") != 0)
+          KALDI_ERR << "Bad MLF label line " << line_number << " of "
+                    << rxfilename << ": " << line;
+        key = line.substr(3, line.size() - 8);
+      }
+      in_record = true;
+      record = line + "\n";
+      continue;
+    }
+
+    if (format == kCtmFormat) {
+      if (records->count(key) == 0)
+        keys->push_back(key);
+      (*records)[key] += line + "\n";
+      num_read++;
+      continue;
+    }
+    record += line + "\n";
+    if (line == ".") {
+      in_record = false;
+      if (records->count(key) != 0) {
+        KALDI_WARN << "Duplicate utterance " << key << " in " << rxfilename
+                   << ", keeping the first.";
+        continue;
+      }
+      (*records)[key] = record;
+      keys->push_back(key);
+      num_read++;
+    }
+  }
+  if (in_record)
+    KALDI_ERR << "Incomplete alignment for " << key << " at the end of "
+              << rxfilename;
+  KALDI_LOG << "Read " << num_read << (format == kCtmFormat ? " lines" :
+                                       " utterances")
+            << " from " << rxfilename;
+}
+
+/// Reads the utterance-ids, the first field of each line, from "rxfilename".
+void ReadKeyList(const std::string &rxfilename,
+                 std::vector<std::string> *keys) {
+  Input ki(rxfilename);
+  std::string line;
+  while (std::getline(ki.Stream(), line)) {
+    std::vector<std::string> fields;
+    SplitStringToVector(line, " \t\r", true, &fields);
+    if (!fields.empty())
+      keys->push_back(fields[0]);
+  }
+}
+
+/// Puts "keys" in the order of "order", followed, with a warning, by any
+/// that are not in "order".
+void OrderKeys(const std::vector<std::string> &order,
+               const std::vector<std::string> &keys,
+               std::vector<std::string> *ordered) {
+  std::set<std::string> present(keys.begin(), keys.end()),
+      in_order(order.begin(), order.end());
+  for (size_t i = 0; i < order.size(); i++)
+    if (present.count(order[i]) != 0) {
+      ordered->push_back(order[i]);
+      present.erase(order[i]);  // in case of duplicates in "order".
+    }
+  for (size_t i = 0; i < keys.size(); i++)
+    if (in_order.count(keys[i]) == 0) {
+      KALDI_WARN << "Utterance " << keys[i] << " is not in the key list; "
+                 << "writing it at the end.";
+      ordered->push_back(keys[i]);
+    }
+  if (ordered->size() < order.size())
+    KALDI_LOG << (order.size() - ordered->size()) << " of the "
+              << order.size() << " utterances in the key list have no "
+              << "alignment (they failed or were skipped).";
+}
+
+template<class Holder>
+int32 MergeTables(const std::vector<std::string> &order,
+                  const std::vector<std::string> &rspecifiers,
+                  const std::string &wspecifier) {
+  std::map<std::string, typename Holder::T> values;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < rspecifiers.size(); i++) {
+    SequentialTableReader<Holder> reader(rspecifiers[i]);
+    for (; !reader.Done(); reader.Next()) {
+      if (values.count(reader.Key()) != 0) {
+        KALDI_WARN << "Duplicate utterance " << reader.Key() << " in "
+                   << rspecifiers[i] << ", keeping the first.";
+        continue;
+      }
+      values[reader.Key()] = reader.Value();
+      keys.push_back(reader.Key());
+    }
+  }
+  std::vector<std::string> ordered;
+  OrderKeys(order, keys, &ordered);
+  TableWriter<Holder> writer(wspecifier);
+  for (size_t i = 0; i < ordered.size(); i++)
+    writer.Write(ordered[i], values[ordered[i]]);
+  return ordered.size();
+}
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+
+    const char *usage =
+        "Merge the outputs of speech-aligner --shard=i/N runs into the output\n"
+        "of one run: the utterances are put back in the order of <key-list>\n"
+        "(the wav.scp the shards were made from, or any file whose lines start\n"
+        "with the utterance-ids), and an MLF gets a single header.  Give the\n"
+        "same output options (--custom-output, --mlf-output, --ctm-output,\n"
+        "--write-lengths) as to speech-aligner; for the archive formats the\n"
+        "inputs and output are rspecifiers and a wspecifier.\n"
+        "\n"
+        "Usage:  merge-alignments [options...] <key-list> <alignments-out> "
+        "<shard-alignments-1> [<shard-alignments-2> ...]\n"
+        "e.g.: \n"
+        " merge-alignments wav.scp out.ali out.1.ali out.2.ali out.3.ali\n"
+        " merge-alignments --custom-output=false wav.scp ark:out.ali "
+        "ark:out.1.ali ark:out.2.ali\n";
+
+    ParseOptions po(usage);
+    bool custom_output = true, mlf_output = false, ctm_output = false,
+        write_lengths = false;
+    po.Register("custom-output", &custom_output,
+                "If true, the alignments are in the custom format");
+    po.Register("mlf-output", &mlf_output,
+                "If true, the alignments are in MLF format");
+    po.Register("ctm-output", &ctm_output,
+                "If true, the alignments are in ctm format");
+    po.Register("write-lengths", &write_lengths,
+                "If true, the archives hold (phone, #frames) pairs");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() < 3) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string key_list_rxfilename = po.GetArg(1),
+        alignments_out = po.GetArg(2);
+    std::vector<std::string> shards;
+    for (int32 i = 3; i <= po.NumArgs(); i++)
+      shards.push_back(po.GetArg(i));
+
+    std::vector<std::string> order;
+    ReadKeyList(key_list_rxfilename, &order);
+
+    AlignmentFormat format = (custom_output ? kCustomFormat :
+                              mlf_output ? kMlfFormat :
+                              ctm_output ? kCtmFormat : kTableFormat);
+    int32 num_written;
+    if (format == kTableFormat && !write_lengths) {
+      num_written = MergeTables<BasicVectorHolder<int32> >(
+          order, shards, alignments_out);
+    } else if (format == kTableFormat) {
+      num_written = MergeTables<BasicPairVectorHolder<int32> >(
+          order, shards, alignments_out);
+    } else {
+      std::map<std::string, std::string> records;
+      std::vector<std::string> keys, ordered;
+      for (size_t i = 0; i < shards.size(); i++)
+        ReadTextAlignments(shards[i], format, &records, &keys);
+      OrderKeys(order, keys, &ordered);
+      Output ko(alignments_out, false, false);
+      if (format == kMlfFormat && !ordered.empty())
+        ko.Stream() << "#!MLF!#" << std::endl;
+      for (size_t i = 0; i < ordered.size(); i++)
+        ko.Stream() << records[ordered[i]];
+      num_written = ordered.size();
+    }
+    KALDI_LOG << "Merged " << num_written << " alignments from "
+              << shards.size() << " shards into " << alignments_out;
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
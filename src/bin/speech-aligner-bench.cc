@@ -0,0 +1,857 @@
+// bin/speech-aligner-bench.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+#include "util/common-utils.h"
+#include "feat/feature-functions.h"
+#include "feat/feature-mfcc.h"
+#include "feat/pitch-functions.h"
+#include "feat/wave-reader.h"
+#include "gmm/am-diag-gmm.h"
+#include "gmm/decodable-am-diag-gmm.h"
+#include "hmm/hmm-test-utils.h"
+#include "hmm/transition-model.h"
+#include "tree/context-dep.h"
+#include "decoder/banded-viterbi-decoder.h"
+#include "decoder/faster-decoder.h"
+#include "decoder/training-graph-compiler.h"
+#include "aligner/aligner.h"
+#include "aligner/context-lexicon.h"
+
+namespace kaldi {
+
+struct SyntheticCorpusOptions {
+  int32 num_utts;
+  BaseFloat min_duration;
+  BaseFloat max_duration;
+  BaseFloat words_per_second;
+  int32 num_phones;
+  int32 num_context_classes;
+  int32 num_words;
+  int32 num_gauss;
+  int32 seed;
+
+  SyntheticCorpusOptions(): num_utts(20), min_duration(2.0), max_duration(10.0),
+                            words_per_second(2.5), num_phones(60),
+                            num_context_classes(4), num_words(2000),
+                            num_gauss(8), seed(1) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("num-utts", &num_utts, "Number of utterances to generate");
+    opts->Register("min-duration", &min_duration,
+                   "Shortest utterance, in seconds");
+    opts->Register("max-duration", &max_duration,
+                   "Longest utterance, in seconds");
+    opts->Register("words-per-second", &words_per_second,
+                   "Words in each transcript per second of audio");
+    opts->Register("num-phones", &num_phones, "Number of phones, including "
+                   "silence");
+    opts->Register("num-context-classes", &num_context_classes, "The pdf of "
+                   "each state of each (non-silence) phone depends on which "
+                   "of this many classes the left phone is in; the number of "
+                   "pdfs is about 3 * num-phones * num-context-classes");
+    opts->Register("num-words", &num_words, "Number of words in the lexicon");
+    opts->Register("num-gauss", &num_gauss, "Gaussians per pdf");
+    opts->Register("seed", &seed, "Seed for the random generator; the same "
+                   "options and seed give the same corpus");
+  }
+};
+
+/// The model the corpus is generated with, kept in memory for the
+/// micro-benchmarks.
+struct SyntheticModel {
+  ContextDependency *ctx_dep;
+  TransitionModel *trans_model;
+  AmDiagGmm am_gmm;
+  fst::VectorFst<fst::StdArc> lex_fst;
+  SyntheticModel(): ctx_dep(NULL), trans_model(NULL) { }
+  ~SyntheticModel() {
+    delete ctx_dep;
+    delete trans_model;
+  }
+};
+
+/// One utterance, with what each stage of the aligner makes of it.
+struct BenchUtterance {
+  std::string utt;
+  WaveData wave;
+  std::vector<std::string> transcript;
+  std::vector<int32> word_ids;
+  Matrix<BaseFloat> features;  // mfcc+pitch, cmvn and deltas.
+  fst::VectorFst<fst::StdArc> graph;  // with the transition probs.
+  std::vector<int32> pdfs;  // the pdfs in "graph", sorted.
+};
+
+/// Dimension of the features the aligner computes with "opts": mfcc, the
+/// processed pitch, and the deltas of both.
+int32 FeatureDim(const SpeechAlignerOptions &opts) {
+  const ProcessPitchOptions &p = opts.process_opts;
+  int32 pitch_dim = p.add_pov_feature + p.add_normalized_log_pitch +
+      p.add_delta_pitch + p.add_raw_log_pitch;
+  return (opts.mfcc_opts.num_ceps + pitch_dim) * (opts.delta_opts.order + 1);
+}
+
+/// A tree like a small triphone system: phone 1 (silence) has a pdf per HMM
+/// state, and each state of the other phones has "num_classes" pdfs, chosen
+/// by the left phone (its id modulo "num_classes").
+ContextDependency *MakeSyntheticTree(int32 num_phones, int32 num_classes) {
+  std::vector<EventMap*> by_phone(num_phones + 1, NULL);
+  int32 num_pdfs = 0;
+  for (int32 p = 1; p <= num_phones; p++) {
+    std::vector<EventMap*> by_state(3, NULL);
+    for (int32 s = 0; s < 3; s++) {
+      if (p == 1) {
+        by_state[s] = new ConstantEventMap(num_pdfs++);
+        continue;
+      }
+      std::vector<EventMap*> by_left(num_phones + 1, NULL);
+      for (int32 l = 0; l <= num_phones; l++)
+        by_left[l] = new ConstantEventMap(num_pdfs + l % num_classes);
+      num_pdfs += num_classes;
+      by_state[s] = new TableEventMap(0, by_left);
+    }
+    by_phone[p] = new TableEventMap(kPdfClass, by_state);
+  }
+  return new ContextDependency(3, 1, new TableEventMap(1, by_phone));
+}
+
+BaseFloat RandRange(BaseFloat low, BaseFloat high) {
+  return low + (high - low) * RandUniform();
+}
+
+/// Random means, variances and weights; the features are mean-normalized, so
+/// the means are drawn around zero.
+void MakeSyntheticGmm(int32 num_pdfs, int32 dim, int32 num_gauss,
+                      AmDiagGmm *am_gmm) {
+  for (int32 pdf = 0; pdf < num_pdfs; pdf++) {
+    DiagGmm gmm(num_gauss, dim);
+    Matrix<BaseFloat> means(num_gauss, dim), inv_vars(num_gauss, dim);
+    Vector<BaseFloat> weights(num_gauss);
+    for (int32 g = 0; g < num_gauss; g++) {
+      weights(g) = 0.5 + RandUniform();
+      for (int32 d = 0; d < dim; d++) {
+        means(g, d) = RandGauss();
+        inv_vars(g, d) = 1.0 / (0.5 + RandUniform());
+      }
+    }
+    weights.Scale(1.0 / weights.Sum());
+    gmm.SetWeights(weights);
+    gmm.SetInvVarsAndMeans(inv_vars, means);
+    gmm.ComputeGconsts();
+    am_gmm->AddPdf(gmm);
+  }
+}
+
+/// A lexicon with optional silence between words, as Kaldi's L.fst: word w
+/// (ids from 1) has a random pronunciation of one to three non-silence
+/// phones.
+void MakeSyntheticLexicon(int32 num_phones, int32 num_words,
+                          fst::VectorFst<fst::StdArc> *lex_fst) {
+  using fst::StdArc;
+  BaseFloat half = -std::log(0.5);
+  lex_fst->DeleteStates();
+  int32 start = lex_fst->AddState(), loop = lex_fst->AddState(),
+      sil = lex_fst->AddState();
+  lex_fst->SetStart(start);
+  lex_fst->SetFinal(loop, StdArc::Weight::One());
+  lex_fst->AddArc(start, StdArc(0, 0, half, loop));
+  lex_fst->AddArc(start, StdArc(1, 0, half, loop));
+  lex_fst->AddArc(sil, StdArc(1, 0, 0.0, loop));
+  for (int32 w = 1; w <= num_words; w++) {
+    int32 len = RandInt(1, 3), cur = loop;
+    for (int32 i = 0; i < len; i++) {
+      int32 phone = RandInt(2, num_phones), olabel = (i == 0 ? w : 0);
+      if (i + 1 < len) {
+        int32 next = lex_fst->AddState();
+        lex_fst->AddArc(cur, StdArc(phone, olabel, 0.0, next));
+        cur = next;
+      } else {
+        lex_fst->AddArc(cur, StdArc(phone, olabel, half, loop));
+        lex_fst->AddArc(cur, StdArc(phone, olabel, half, sil));
+      }
+    }
+  }
+}
+
+/// Something with the rough statistics of speech, for the feature
+/// extraction: syllables of voiced sound (harmonics of a gliding pitch, under
+/// an envelope), some with a noise burst before them, separated by short
+/// pauses, with background noise and silence at either end.
+void SynthesizeWaveform(BaseFloat duration, BaseFloat samp_freq,
+                        Vector<BaseFloat> *wave) {
+  int32 num_samples = static_cast<int32>(duration * samp_freq);
+  wave->Resize(num_samples);
+  for (int32 i = 0; i < num_samples; i++)
+    (*wave)(i) = 30.0 * RandGauss();
+  int32 pos = static_cast<int32>(RandRange(0.2, 0.4) * samp_freq),
+      end = num_samples - static_cast<int32>(RandRange(0.2, 0.4) *
+                                             samp_freq);
+  while (pos < end) {
+    if (RandUniform() < 0.5) {  // fricative onset.
+      int32 len = static_cast<int32>(RandRange(0.02, 0.06) * samp_freq);
+      for (int32 i = 0; i < len && pos < end; i++, pos++)
+        (*wave)(pos) += 800.0 * RandGauss();
+    }
+    int32 len = std::min<int32>(end - pos, RandRange(0.12, 0.3) * samp_freq);
+    BaseFloat f0 = RandRange(100.0, 250.0), glide = RandRange(-0.3, 0.3),
+        amplitude = RandRange(3000.0, 8000.0), phase = 0.0;
+    for (int32 i = 0; i < len; i++) {
+      BaseFloat t = i / static_cast<BaseFloat>(len),
+          env = std::sin(M_PI * t), sample = 0.0;
+      phase += 2.0 * M_PI * f0 * (1.0 + glide * t) / samp_freq;
+      for (int32 k = 1; k <= 8; k++)
+        sample += std::sin(k * phase) / k;
+      (*wave)(pos + i) += amplitude * env * sample;
+    }
+    pos += len;
+    pos += static_cast<int32>((RandUniform() < 0.2 ? RandRange(0.15, 0.3) :
+                               RandRange(0.0, 0.08)) * samp_freq);
+  }
+  for (int32 i = 0; i < num_samples; i++)  // keep within 16 bits.
+    (*wave)(i) = std::max<BaseFloat>(-32767.0, std::min<BaseFloat>(
+        32767.0, (*wave)(i)));
+}
+
+std::string WordName(int32 w) {
+  std::ostringstream os;
+  os << "W" << std::setw(5) << std::setfill('0') << w;
+  return os.str();
+}
+
+/// Writes the model (tree, final.mdl, L.fst, phones.txt, words.txt), the
+/// corpus (wav/*.wav, wav.scp, text) and an align.conf for them to "dir",
+/// which must exist, so that speech-aligner can be run on it too.  The model
+/// is also returned in "model", and the utterances in "utts".
+void GenerateSyntheticCorpus(const SyntheticCorpusOptions &opts,
+                             const std::string &dir, SyntheticModel *model,
+                             std::vector<BenchUtterance> *utts) {
+  KALDI_ASSERT(opts.num_phones >= 2 && opts.num_context_classes >= 1 &&
+               opts.num_words >= 1 && opts.num_gauss >= 1 &&
+               opts.min_duration > 0.5 &&
+               opts.max_duration >= opts.min_duration);
+  srand(opts.seed);
+  {
+    std::ofstream conf((dir + "/align.conf").c_str());
+    conf << "# feat\n--use-energy=false\n--sample-frequency=16000\n"
+         << "--frame-shift=5\n--length-tolerance=2\n\n# model\n"
+         << "--tree-rxfilename=" << dir << "/tree\n"
+         << "--model-rxfilename=" << dir << "/final.mdl\n"
+         << "--lex-rxfilename=" << dir << "/L.fst\n"
+         << "--phone-symbol-table=" << dir << "/phones.txt\n"
+         << "--word-symbol-table=" << dir << "/words.txt\n\n# align\n"
+         << "--transition-scale=1.0\n--acoustic-scale=0.1\n"
+         << "--self-loop-scale=0.1\n--beam=20\n--retry-beam=40\n"
+         << "--write-lengths=true\n--custom-output=true\n";
+    if (!conf.flush())
+      KALDI_ERR << "Could not write " << dir << "/align.conf";
+  }
+  SpeechAlignerOptions aligner_opts;
+  ReadSpeechAlignerConfig(dir + "/align.conf", &aligner_opts);
+
+  std::vector<int32> phones;
+  for (int32 p = 1; p <= opts.num_phones; p++)
+    phones.push_back(p);
+  model->ctx_dep = MakeSyntheticTree(opts.num_phones,
+                                     opts.num_context_classes);
+  model->trans_model = new TransitionModel(*model->ctx_dep,
+                                           GetDefaultTopology(phones));
+  MakeSyntheticGmm(model->ctx_dep->NumPdfs(), FeatureDim(aligner_opts),
+                   opts.num_gauss, &model->am_gmm);
+  MakeSyntheticLexicon(opts.num_phones, opts.num_words, &model->lex_fst);
+
+  WriteKaldiObject(*model->ctx_dep, dir + "/tree", true);
+  {
+    Output ko(dir + "/final.mdl", true);
+    model->trans_model->Write(ko.Stream(), true);
+    model->am_gmm.Write(ko.Stream(), true);
+  }
+  fst::WriteFstKaldi(model->lex_fst, dir + "/L.fst");
+  {
+    Output ko(dir + "/phones.txt", false);
+    ko.Stream() << "<eps> 0\nsil 1\n";
+    for (int32 p = 2; p <= opts.num_phones; p++)
+      ko.Stream() << "p" << p << " " << p << "\n";
+  }
+  {
+    Output ko(dir + "/words.txt", false);
+    ko.Stream() << "<eps> 0\n";
+    for (int32 w = 1; w <= opts.num_words; w++)
+      ko.Stream() << WordName(w) << " " << w << "\n";
+  }
+
+  mkdir((dir + "/wav").c_str(), 0777);
+  Output scp(dir + "/wav.scp", false), text(dir + "/text", false);
+  BaseFloat samp_freq = aligner_opts.mfcc_opts.frame_opts.samp_freq;
+  utts->resize(opts.num_utts);
+  for (int32 i = 0; i < opts.num_utts; i++) {
+    BenchUtterance &u = (*utts)[i];
+    std::ostringstream utt;
+    utt << "synth-" << std::setw(4) << std::setfill('0') << (i + 1);
+    u.utt = utt.str();
+    BaseFloat duration = RandRange(opts.min_duration, opts.max_duration);
+    Vector<BaseFloat> samples;
+    SynthesizeWaveform(duration, samp_freq, &samples);
+    Matrix<BaseFloat> data(1, samples.Dim());
+    data.Row(0).CopyFromVec(samples);
+    WaveData wave(samp_freq, data);
+    u.wave.Swap(&wave);
+    int32 num_words = std::max<int32>(1, opts.words_per_second * duration);
+    for (int32 w = 0; w < num_words; w++)
+      u.transcript.push_back(WordName(RandInt(1, opts.num_words)));
+
+    std::string wav_filename = dir + "/wav/" + u.utt + ".wav";
+    std::ofstream os(wav_filename.c_str(), std::ios::out | std::ios::binary);
+    u.wave.Write(os);
+    if (!os.flush())
+      KALDI_ERR << "Could not write " << wav_filename;
+    scp.Stream() << u.utt << " " << wav_filename << "\n";
+    text.Stream() << u.utt;
+    for (size_t w = 0; w < u.transcript.size(); w++)
+      text.Stream() << " " << u.transcript[w];
+    text.Stream() << "\n";
+  }
+  KALDI_LOG << "Generated " << opts.num_utts << " utterances, "
+            << opts.num_phones << " phones, " << model->ctx_dep->NumPdfs()
+            << " pdfs of " << opts.num_gauss << " Gaussians and "
+            << opts.num_words << " words in " << dir;
+}
+
+/// Serves log-likelihoods from a matrix with a column per pdf of the graph,
+/// so that the decoder benchmark measures the search alone.
+class PrecomputedDecodable: public DecodableInterface {
+ public:
+  PrecomputedDecodable(const TransitionModel &trans_model,
+                       const std::vector<int32> &pdf_to_col,
+                       const Matrix<BaseFloat> &loglikes):
+      trans_model_(trans_model), pdf_to_col_(pdf_to_col),
+      loglikes_(loglikes) { }
+
+  virtual BaseFloat LogLikelihood(int32 frame, int32 tid) {
+    return loglikes_(frame, pdf_to_col_[trans_model_.TransitionIdToPdf(tid)]);
+  }
+  virtual int32 NumFramesReady() const { return loglikes_.NumRows(); }
+  virtual int32 NumIndices() const { return trans_model_.NumTransitionIds(); }
+  virtual bool IsLastFrame(int32 frame) const {
+    return frame == loglikes_.NumRows() - 1;
+  }
+ private:
+  const TransitionModel &trans_model_;
+  const std::vector<int32> &pdf_to_col_;
+  const Matrix<BaseFloat> &loglikes_;
+};
+
+/// Runs each benchmark a few times untimed and then "num_repeats" times
+/// timed, and reports the spread of the timed runs, so that a change can be
+/// told from noise: the median is what to compare, and the coefficient of
+/// variation says how far to trust it.
+class BenchmarkRunner {
+ public:
+  BenchmarkRunner(int32 num_warmup, int32 num_repeats, double audio_seconds):
+      num_warmup_(num_warmup), num_repeats_(num_repeats),
+      audio_seconds_(audio_seconds) {
+    KALDI_ASSERT(num_repeats > 0);
+  }
+
+  /// "body" does "units" of work (e.g. frames) in "unit", covering the whole
+  /// corpus once.
+  void Run(const std::string &name, const std::string &unit, double units,
+           const std::function<void()> &body) {
+    Result result;
+    result.name = name;
+    result.unit = unit;
+    result.units = units;
+    for (int32 r = 0; r < num_warmup_; r++)
+      body();
+    for (int32 r = 0; r < num_repeats_; r++) {
+      Timer timer;
+      body();
+      result.seconds.push_back(timer.Elapsed());
+    }
+    results_.push_back(result);
+    const Result &res = results_.back();
+    KALDI_LOG << std::fixed << std::setprecision(3) << name << ": median "
+              << res.Median() * 1000.0 << " ms, cv "
+              << res.Cv() * 100.0 << "%, " << std::setprecision(0)
+              << units / res.Median() << " " << unit << "/s, RTF "
+              << std::setprecision(5) << res.Median() / audio_seconds_;
+  }
+
+  void Print(std::ostream &os) const {
+    os << std::left << std::setw(18) << "benchmark" << std::right
+       << std::setw(12) << "median-ms" << std::setw(12) << "min-ms"
+       << std::setw(12) << "mean-ms" << std::setw(8) << "cv%"
+       << std::setw(16) << "per-second" << "  " << std::left
+       << std::setw(12) << "unit" << std::right << std::setw(10) << "rtf"
+       << "\n";
+    for (size_t i = 0; i < results_.size(); i++) {
+      const Result &r = results_[i];
+      os << std::left << std::setw(18) << r.name << std::right << std::fixed
+         << std::setprecision(3) << std::setw(12) << r.Median() * 1000.0
+         << std::setw(12) << r.Min() * 1000.0 << std::setw(12)
+         << r.Mean() * 1000.0 << std::setprecision(2) << std::setw(8)
+         << r.Cv() * 100.0 << std::setprecision(0) << std::setw(16)
+         << r.units / r.Median() << "  " << std::left << std::setw(12)
+         << r.unit << std::right << std::setprecision(5) << std::setw(10)
+         << r.Median() / audio_seconds_ << "\n";
+    }
+  }
+
+  void WriteJson(std::ostream &os) const {
+    os << std::setprecision(6);
+    os << "{\"audio_seconds\": " << audio_seconds_
+       << ", \"num_warmup\": " << num_warmup_
+       << ", \"num_repeats\": " << num_repeats_ << ",\n\"benchmarks\": [";
+    for (size_t i = 0; i < results_.size(); i++) {
+      const Result &r = results_[i];
+      os << (i > 0 ? "," : "") << "\n  {\"name\": \"" << r.name
+         << "\", \"unit\": \"" << r.unit << "\", \"units_per_run\": "
+         << r.units << ", \"median_seconds\": " << r.Median()
+         << ", \"min_seconds\": " << r.Min()
+         << ", \"mean_seconds\": " << r.Mean()
+         << ", \"stddev_seconds\": " << r.Stddev()
+         << ", \"cv\": " << r.Cv()
+         << ", \"units_per_second\": " << r.units / r.Median()
+         << ", \"real_time_factor\": " << r.Median() / audio_seconds_
+         << ", \"seconds\": [";
+      for (size_t j = 0; j < r.seconds.size(); j++)
+        os << (j > 0 ? ", " : "") << r.seconds[j];
+      os << "]}";
+    }
+    os << "\n]}\n";
+  }
+
+ private:
+  struct Result {
+    std::string name, unit;
+    double units;
+    std::vector<double> seconds;
+
+    double Median() const {
+      std::vector<double> s(seconds);
+      std::sort(s.begin(), s.end());
+      size_t n = s.size();
+      return (n % 2 == 1 ? s[n / 2] : 0.5 * (s[n / 2 - 1] + s[n / 2]));
+    }
+    double Min() const {
+      return *std::min_element(seconds.begin(), seconds.end());
+    }
+    double Mean() const {
+      double sum = 0.0;
+      for (size_t i = 0; i < seconds.size(); i++)
+        sum += seconds[i];
+      return sum / seconds.size();
+    }
+    double Stddev() const {
+      if (seconds.size() < 2) return 0.0;
+      double mean = Mean(), sum = 0.0;
+      for (size_t i = 0; i < seconds.size(); i++)
+        sum += (seconds[i] - mean) * (seconds[i] - mean);
+      return std::sqrt(sum / (seconds.size() - 1));
+    }
+    double Cv() const { return Stddev() / Mean(); }
+  };
+
+  int32 num_warmup_, num_repeats_;
+  double audio_seconds_;
+  std::vector<Result> results_;
+};
+
+}  // namespace kaldi
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+    using fst::VectorFst;
+    using fst::StdArc;
+
+    const char *usage =
+        "Benchmark the stages of speech-aligner on a synthetic corpus.  A small\n"
+        "model (tree, final.mdl, L.fst, symbol tables) and a corpus of\n"
+        "speech-like waveforms with random transcripts are generated into\n"
+        "<work-dir> (along with an align.conf, so speech-aligner can be run on\n"
+        "them too), and then each of these is timed over the whole corpus,\n"
+        "several times:\n"
+        "  mfcc            Mfcc::ComputeFeatures\n"
+        "  pitch           ComputeKaldiPitch\n"
+        "  deltas          ComputeDeltas\n"
+        "  gmm-loglike     DecodableAmDiagGmmUnmapped, every (frame, pdf of\n"
+        "                  the utterance's graph)\n"
+        "  gmm-loglike-flat  the same with the aligner's FlatAmDiagGmm\n"
+        "  gmm-loglike-gemm  the same, all at once with matrix products, as\n"
+        "                  the aligner does (DecodableFlatAmDiagGmmPrecomputed)\n"
+        "  compile         TrainingGraphCompiler::CompileGraph\n"
+        "  compile-linear  TrainingGraphCompiler::CompileLinearGraph, as the\n"
+        "                  aligner does by default\n"
+        "  compile-cl      the same from a context lexicon (C o L, built\n"
+        "                  first), as with speech-aligner --context-lexicon\n"
+        "  compile-batch   TrainingGraphCompiler::CompileGraphs on the whole\n"
+        "                  corpus, in --compile-batch-threads threads\n"
+        "  decode          FasterDecoder::Decode, on precomputed likelihoods\n"
+        "  decode-flat     the same on a CsrFst (flat copy) of the graph,\n"
+        "                  as the aligner does with --flat-graph\n"
+        "  decode-banded   BandedViterbiDecoder::Decode, the same way\n"
+        "  end-to-end      Aligner features, segmentation, compile and\n"
+        "                  alignment, one thread; its RTF is the headline\n"
+        "The table gives the median, min and mean time of a pass over the\n"
+        "corpus, the coefficient of variation over the passes, the throughput\n"
+        "and the real-time factor (time over audio duration).\n"
+        "\n"
+        "Usage:  speech-aligner-bench [options...] <work-dir>\n"
+        "e.g.: \n"
+        " speech-aligner-bench --num-repeats=10 /tmp/bench\n"
+        " speech-aligner-bench --benchmarks=gmm-loglike,decode --json=b.json "
+        "/tmp/bench\n";
+
+    ParseOptions po(usage);
+    SyntheticCorpusOptions corpus_opts;
+    int32 num_warmup = 1, num_repeats = 5, compile_batch_threads = 4;
+    std::string benchmarks = "all", json_wxfilename;
+    bool generate_only = false;
+    corpus_opts.Register(&po);
+    po.Register("num-warmup", &num_warmup, "Untimed passes over the corpus "
+                "before each benchmark");
+    po.Register("num-repeats", &num_repeats, "Timed passes over the corpus "
+                "for each benchmark");
+    po.Register("benchmarks", &benchmarks, "Comma-separated list of the "
+                "benchmarks to run, or \"all\"");
+    po.Register("compile-batch-threads", &compile_batch_threads, "Number of "
+                "threads for the compile-batch benchmark");
+    po.Register("json", &json_wxfilename, "If set, also write the results, "
+                "with the time of every pass, here as JSON");
+    po.Register("generate-only", &generate_only, "If true, only generate the "
+                "model and corpus");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 1) {
+      po.PrintUsage();
+      exit(1);
+    }
+    std::string dir = po.GetArg(1);
+    mkdir(dir.c_str(), 0777);
+
+    std::set<std::string> selected;
+    {
+      std::vector<std::string> names;
+      SplitStringToVector(benchmarks, ",", true, &names);
+      selected.insert(names.begin(), names.end());
+    }
+    const char *known[] = { "mfcc", "pitch", "deltas", "gmm-loglike",
+                            "gmm-loglike-flat", "gmm-loglike-gemm", "compile",
+                            "compile-linear", "compile-cl", "compile-batch",
+                            "decode", "decode-flat",
+                            "decode-banded", "end-to-end" };
+    const int32 num_known = sizeof(known) / sizeof(known[0]);
+    for (std::set<std::string>::const_iterator it = selected.begin();
+         it != selected.end(); ++it)
+      if (*it != "all" && std::find(known, known + num_known, *it) ==
+          known + num_known)
+        KALDI_ERR << "Unknown benchmark " << *it;
+    bool all = selected.count("all") != 0;
+    // Returns true if benchmark "name" was asked for.
+    auto wanted = [&](const std::string &name) {
+      return all || selected.count(name) != 0;
+    };
+
+    SyntheticModel model;
+    std::vector<BenchUtterance> utts;
+    GenerateSyntheticCorpus(corpus_opts, dir, &model, &utts);
+    if (generate_only)
+      return 0;
+
+    SpeechAlignerOptions opts;
+    ReadSpeechAlignerConfig(dir + "/align.conf", &opts);
+    Aligner aligner(opts);
+
+    // What each stage makes of each utterance, as input to the next.
+    double audio_seconds = 0.0, num_frames = 0.0, num_pdf_frames = 0.0;
+    for (size_t i = 0; i < utts.size(); i++) {
+      BenchUtterance &u = utts[i];
+      audio_seconds += u.wave.Duration();
+      aligner.TextToWordIds(u.transcript, &u.word_ids);
+      if (!aligner.ComputeFeatures(u.utt, u.wave, 1.0, &u.features) ||
+          !aligner.CompileGraph(u.utt, u.word_ids, &u.graph))
+        KALDI_ERR << "Could not prepare utterance " << u.utt;
+      std::set<int32> pdfs;
+      for (fst::StateIterator<VectorFst<StdArc> > siter(u.graph);
+           !siter.Done(); siter.Next())
+        for (fst::ArcIterator<VectorFst<StdArc> > aiter(u.graph,
+                                                         siter.Value());
+             !aiter.Done(); aiter.Next())
+          if (aiter.Value().ilabel != 0)
+            pdfs.insert(model.trans_model->TransitionIdToPdf(
+                aiter.Value().ilabel));
+      u.pdfs.assign(pdfs.begin(), pdfs.end());
+      num_frames += u.features.NumRows();
+      num_pdf_frames += static_cast<double>(u.features.NumRows()) *
+          u.pdfs.size();
+    }
+    KALDI_LOG << "Corpus: " << audio_seconds << " seconds of audio, "
+              << num_frames << " frames, " << (num_pdf_frames / num_frames)
+              << " pdfs per graph on average; GMM kernel "
+              << FlatAmDiagGmmKernel();
+
+    BenchmarkRunner runner(num_warmup, num_repeats, audio_seconds);
+    double sink = 0.0;  // keeps the results alive.
+
+    if (wanted("mfcc")) {
+      Mfcc mfcc(opts.mfcc_opts);
+      runner.Run("mfcc", "frames", num_frames, [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          Matrix<BaseFloat> feats;
+          mfcc.ComputeFeatures(utts[i].wave.Data().Row(0),
+                               utts[i].wave.SampFreq(), 1.0, &feats);
+          sink += feats(0, 0);
+        }
+      });
+    }
+    if (wanted("pitch")) {
+      PitchExtractionOptions pitch_opts(opts.pitch_opts);
+      pitch_opts.frame_shift_ms = opts.mfcc_opts.frame_opts.frame_shift_ms;
+      runner.Run("pitch", "frames", num_frames, [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          Matrix<BaseFloat> pitch;
+          ComputeKaldiPitch(pitch_opts, utts[i].wave.Data().Row(0), &pitch);
+          sink += pitch(0, 0);
+        }
+      });
+    }
+    if (wanted("deltas")) {
+      runner.Run("deltas", "frames", num_frames, [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          const Matrix<BaseFloat> &f = utts[i].features;
+          Matrix<BaseFloat> deltas;
+          ComputeDeltas(opts.delta_opts,
+                        f.ColRange(0, f.NumCols() / (opts.delta_opts.order + 1)),
+                        &deltas);
+          sink += deltas(0, 0);
+        }
+      });
+    }
+    if (wanted("gmm-loglike")) {
+      runner.Run("gmm-loglike", "pdf-frames", num_pdf_frames, [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          const BenchUtterance &u = utts[i];
+          DecodableAmDiagGmmUnmapped decodable(model.am_gmm, u.features);
+          for (int32 t = 0; t < u.features.NumRows(); t++)
+            for (size_t p = 0; p < u.pdfs.size(); p++)
+              sink += decodable.LogLikelihood(t, u.pdfs[p] + 1);
+        }
+      });
+    }
+    if (wanted("gmm-loglike-flat")) {
+      FlatAmDiagGmm flat_gmm;
+      flat_gmm.CopyFromAmDiagGmm(model.am_gmm);
+      runner.Run("gmm-loglike-flat", "pdf-frames", num_pdf_frames, [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          const BenchUtterance &u = utts[i];
+          DecodableFlatAmDiagGmmScaled decodable(flat_gmm, *model.trans_model,
+                                                 u.features, 1.0);
+          for (int32 t = 0; t < u.features.NumRows(); t++)
+            for (size_t p = 0; p < u.pdfs.size(); p++)
+              sink += decodable.LogLikelihoodZeroBased(t, u.pdfs[p]);
+        }
+      });
+    }
+    if (wanted("gmm-loglike-gemm")) {
+      FlatAmDiagGmm flat_gmm;
+      flat_gmm.CopyFromAmDiagGmm(model.am_gmm);
+      runner.Run("gmm-loglike-gemm", "pdf-frames", num_pdf_frames, [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          const BenchUtterance &u = utts[i];
+          DecodableFlatAmDiagGmmPrecomputed decodable(
+              flat_gmm, *model.trans_model, u.features, u.pdfs, 1.0);
+          sink += decodable.NumFramesReady();
+        }
+      });
+    }
+    for (int32 linear = 0; linear < 2; linear++) {
+      const char *name = (linear ? "compile-linear" : "compile");
+      if (!wanted(name)) continue;
+      TrainingGraphCompilerOptions gopts(opts.gopts);
+      gopts.transition_scale = 0.0;  // as the aligner does.
+      gopts.self_loop_scale = 0.0;
+      gopts.fast_linear = (linear != 0);
+      std::vector<int32> disambig_syms;
+      TrainingGraphCompiler compiler(*model.trans_model, *model.ctx_dep,
+                                     new VectorFst<StdArc>(model.lex_fst),
+                                     disambig_syms, gopts);
+      runner.Run(name, "utterances", utts.size(), [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          VectorFst<StdArc> graph;
+          compiler.CompileGraphFromText(utts[i].word_ids, &graph);
+          sink += graph.NumStates();
+        }
+      });
+    }
+    if (wanted("compile-cl")) {
+      TrainingGraphCompilerOptions gopts(opts.gopts);
+      gopts.transition_scale = 0.0;
+      gopts.self_loop_scale = 0.0;
+      std::vector<int32> disambig_syms;
+      ContextLexicon context_lexicon;
+      Timer timer;
+      context_lexicon.Build(*model.ctx_dep, disambig_syms, model.lex_fst);
+      KALDI_LOG << "compile-cl: built the context lexicon, with "
+                << context_lexicon.ILabelInfo().size()
+                << " phones in context, in " << timer.Elapsed() << " seconds.";
+      TrainingGraphCompiler compiler(*model.trans_model, *model.ctx_dep,
+                                     new VectorFst<StdArc>(model.lex_fst),
+                                     disambig_syms, gopts);
+      compiler.SetContextLexicon(&(context_lexicon.Fst()),
+                                 &(context_lexicon.ILabelInfo()));
+      runner.Run("compile-cl", "utterances", utts.size(), [&]() {
+        for (size_t i = 0; i < utts.size(); i++) {
+          VectorFst<StdArc> graph;
+          compiler.CompileGraphFromText(utts[i].word_ids, &graph);
+          sink += graph.NumStates();
+        }
+      });
+    }
+    if (wanted("compile-batch")) {
+      // All the graphs in one CompileGraphsFromText() call, by composition.
+      TrainingGraphCompilerOptions gopts(opts.gopts);
+      gopts.transition_scale = 0.0;
+      gopts.self_loop_scale = 0.0;
+      gopts.fast_linear = false;
+      gopts.num_threads = compile_batch_threads;
+      std::vector<int32> disambig_syms;
+      TrainingGraphCompiler compiler(*model.trans_model, *model.ctx_dep,
+                                     new VectorFst<StdArc>(model.lex_fst),
+                                     disambig_syms, gopts);
+      std::vector<std::vector<int32> > transcripts(utts.size());
+      for (size_t i = 0; i < utts.size(); i++)
+        transcripts[i] = utts[i].word_ids;
+      KALDI_LOG << "compile-batch: " << gopts.num_threads << " threads.";
+      runner.Run("compile-batch", "utterances", utts.size(), [&]() {
+        std::vector<VectorFst<StdArc>*> graphs;
+        compiler.CompileGraphsFromText(transcripts, &graphs);
+        for (size_t i = 0; i < graphs.size(); i++) {
+          sink += graphs[i]->NumStates();
+          delete graphs[i];
+        }
+      });
+    }
+    if (wanted("decode") || wanted("decode-flat") || wanted("decode-banded")) {
+      std::vector<Matrix<BaseFloat> > loglikes(utts.size());
+      std::vector<std::vector<int32> > pdf_to_col(utts.size());
+      for (size_t i = 0; i < utts.size(); i++) {
+        const BenchUtterance &u = utts[i];
+        DecodableAmDiagGmmUnmapped decodable(model.am_gmm, u.features);
+        loglikes[i].Resize(u.features.NumRows(), u.pdfs.size());
+        pdf_to_col[i].resize(model.trans_model->NumPdfs(), 0);
+        for (size_t p = 0; p < u.pdfs.size(); p++)
+          pdf_to_col[i][u.pdfs[p]] = p;
+        for (int32 t = 0; t < u.features.NumRows(); t++)
+          for (size_t p = 0; p < u.pdfs.size(); p++)
+            loglikes[i](t, p) = opts.acoustic_scale *
+                decodable.LogLikelihood(t, u.pdfs[p] + 1);
+      }
+      FasterDecoderOptions decode_opts;
+      decode_opts.beam = opts.align_config.beam;
+      int32 num_failed = 0;
+      if (wanted("decode")) {
+        int64 num_saved = 0;
+        runner.Run("decode", "frames", num_frames, [&]() {
+          num_failed = 0;
+          num_saved = 0;
+          for (size_t i = 0; i < utts.size(); i++) {
+            PrecomputedDecodable decodable(*model.trans_model, pdf_to_col[i],
+                                           loglikes[i]);
+            FasterDecoder decoder(utts[i].graph, decode_opts);
+            decoder.Decode(&decodable);
+            num_failed += !decoder.ReachedFinal();
+            num_saved += decoder.NumAllocationsSaved();
+          }
+        });
+        KALDI_LOG << "decode: token pool saved " << num_saved
+                  << " allocations per repeat.";
+      }
+      if (wanted("decode-flat")) {
+        // Includes flattening the graph, which is done for each utterance.
+        runner.Run("decode-flat", "frames", num_frames, [&]() {
+          num_failed = 0;
+          for (size_t i = 0; i < utts.size(); i++) {
+            PrecomputedDecodable decodable(*model.trans_model, pdf_to_col[i],
+                                           loglikes[i]);
+            fst::CsrFst flat_graph(utts[i].graph);
+            FasterDecoderTpl<fst::CsrFst> decoder(flat_graph, decode_opts);
+            decoder.Decode(&decodable);
+            num_failed += !decoder.ReachedFinal();
+          }
+        });
+      }
+      if (wanted("decode-banded")) {
+        // Includes preparing the graph, which is done for each utterance.
+        runner.Run("decode-banded", "frames", num_frames, [&]() {
+          num_failed = 0;
+          for (size_t i = 0; i < utts.size(); i++) {
+            PrecomputedDecodable decodable(*model.trans_model, pdf_to_col[i],
+                                           loglikes[i]);
+            BandedViterbiDecoder decoder(utts[i].graph, decode_opts);
+            KALDI_ASSERT(decoder.GraphIsSupported());
+            decoder.Decode(&decodable);
+            num_failed += !decoder.ReachedFinal();
+          }
+        });
+      }
+      if (num_failed > 0)
+        KALDI_WARN << num_failed << " utterances did not reach a final state "
+                   << "with beam " << decode_opts.beam;
+    }
+    if (wanted("end-to-end")) {
+      int32 num_success = 0;
+      runner.Run("end-to-end", "audio-seconds", audio_seconds, [&]() {
+        AlignStats stats;
+        for (size_t i = 0; i < utts.size(); i++) {
+          const BenchUtterance &u = utts[i];
+          std::vector<int32> word_ids, alignment;
+          Matrix<BaseFloat> features;
+          aligner.TextToWordIds(u.transcript, &word_ids);
+          if (aligner.ComputeFeatures(u.utt, u.wave, 1.0, &features))
+            aligner.Align(u.utt, word_ids, features, &alignment, &stats);
+        }
+        num_success = stats.num_success;
+      });
+      KALDI_LOG << "Aligned " << num_success << " of " << utts.size()
+                << " utterances in each pass.";
+    }
+    KALDI_VLOG(1) << "Checksum " << sink;
+
+    runner.Print(std::cout);
+    if (!json_wxfilename.empty()) {
+      Output ko(json_wxfilename, false);
+      runner.WriteJson(ko.Stream());
+    }
+    return 0;
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
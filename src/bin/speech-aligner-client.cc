@@ -0,0 +1,187 @@
+// bin/speech-aligner-client.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "base/kaldi-common.h"
+#include "util/common-utils.h"
+#include "util/kaldi-pipebuf.h"
+
+namespace kaldi {
+
+// Connects to the Unix domain socket "path" and returns the file descriptor.
+int ConnectToServer(const std::string &path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    KALDI_ERR << "Could not create socket: " << strerror(errno);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    KALDI_ERR << "Socket path is too long: " << path;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)) != 0)
+    KALDI_ERR << "Could not connect to " << path << ": " << strerror(errno);
+  return fd;
+}
+
+// Reads "<key> <rest of line>" lines, as in wav.scp and text.
+void ReadKeyedLines(const std::string &rxfilename,
+                    std::vector<std::pair<std::string, std::string> > *lines) {
+  Input ki(rxfilename);
+  std::string line;
+  while (std::getline(ki.Stream(), line)) {
+    std::string key, rest;
+    SplitStringOnFirstSpace(line, &key, &rest);
+    if (key.empty())
+      continue;
+    lines->push_back(std::make_pair(key, rest));
+  }
+}
+
+// Sends the requests for "wavs"; run in its own thread so that the responses
+// are read while requests are still being sent.
+void SendRequests(
+    const std::vector<std::pair<std::string, std::string> > &wavs,
+    const std::unordered_map<std::string, std::string> &text,
+    bool send_bytes, std::ostream *os) {
+  for (size_t i = 0; i < wavs.size(); i++) {
+    const std::string &utt = wavs[i].first, &wav = wavs[i].second;
+    const std::string &transcript = text.find(utt)->second;
+    // The server only reads plain files in an ALIGN request, and the request
+    // is split at whitespace; send the wav itself for anything else (e.g. a
+    // command or an offset into an archive).
+    if (send_bytes || ClassifyRxfilename(wav) != kFileInput ||
+        wav.find_first_of(" \t") != std::string::npos) {
+      std::ostringstream bytes;
+      {
+        Input ki(wav);
+        bytes << ki.Stream().rdbuf();
+      }
+      *os << "ALIGN_BYTES " << utt << " " << bytes.str().size() << " "
+          << transcript << "\n" << bytes.str();
+    } else {
+      *os << "ALIGN " << utt << " " << wav << " " << transcript << "\n";
+    }
+  }
+  os->flush();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  try {
+    using namespace kaldi;
+
+    const char *usage =
+        "Send alignment requests to \"speech-aligner --server=true --socket=<path>\"\n"
+        "and write the alignments, in the output format the server was started with.\n"
+        "\n"
+        "Usage:  speech-aligner-client [options...] <socket> <wav-scp> <text> <alignments-wxfilename>\n"
+        "e.g.: \n"
+        " speech-aligner-client /tmp/aligner.sock wav.scp text out.ali\n";
+
+    ParseOptions po(usage);
+    bool send_bytes = false, mlf_output = false;
+    po.Register("send-bytes", &send_bytes, "If true, send the contents of the "
+                "wav files instead of their names (e.g. if the server cannot "
+                "see the files).");
+    po.Register("mlf-output", &mlf_output, "Set this if the server writes MLF "
+                "output, so that the MLF header is written.");
+
+    po.Read(argc, argv);
+
+    if (po.NumArgs() != 4) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string socket_path = po.GetArg(1),
+        wav_rxfilename = po.GetArg(2),
+        text_rxfilename = po.GetArg(3),
+        alignment_wxfilename = po.GetArg(4);
+
+    std::vector<std::pair<std::string, std::string> > wavs, text_lines, sent;
+    ReadKeyedLines(wav_rxfilename, &wavs);
+    ReadKeyedLines(text_rxfilename, &text_lines);
+    std::unordered_map<std::string, std::string> text(text_lines.begin(),
+                                                      text_lines.end());
+    for (size_t i = 0; i < wavs.size(); i++) {
+      if (text.count(wavs[i].first) == 0 || text[wavs[i].first].empty())
+        KALDI_WARN << "No transcript for utterance " << wavs[i].first;
+      else
+        sent.push_back(wavs[i]);
+    }
+
+    int fd = ConnectToServer(socket_path);
+    FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+    if (in == NULL || out == NULL)
+      KALDI_ERR << "Could not open connection: " << strerror(errno);
+    basic_pipebuf<char> in_buf(in, std::ios_base::in | std::ios_base::binary),
+        out_buf(out, std::ios_base::out | std::ios_base::binary);
+    std::istream is(&in_buf);
+    std::ostream os(&out_buf);
+
+    std::thread sender(SendRequests, std::cref(sent), std::cref(text),
+                       send_bytes, &os);
+
+    Output ko(alignment_wxfilename, false);
+    if (mlf_output)
+      ko.Stream() << "#!MLF!#" << std::endl;
+    int32 num_done = 0, num_err = 0;
+    std::string line;
+    while (num_done + num_err < static_cast<int32>(sent.size()) &&
+           std::getline(is, line)) {
+      std::vector<std::string> items;
+      SplitStringToVector(line, " ", true, &items);
+      int32 num_bytes;
+      if (items.size() == 3 && items[0] == "OK" &&
+          ConvertStringToInteger(items[2], &num_bytes)) {
+        std::string payload(num_bytes, '\0');
+        if (num_bytes > 0 && !is.read(&(payload[0]), num_bytes))
+          break;
+        ko.Stream() << payload;
+        num_done++;
+      } else {
+        KALDI_WARN << "Server: " << line;
+        num_err++;
+      }
+    }
+    sender.join();
+    shutdown(fd, SHUT_RDWR);
+    fclose(in);
+    fclose(out);
+    ko.Close();
+
+    KALDI_LOG << "Done " << num_done << " out of " << wavs.size()
+              << " utterances; errors on " << num_err << ".";
+    return (num_done == static_cast<int32>(wavs.size()) ? 0 : 1);
+  } catch(const std::exception &e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
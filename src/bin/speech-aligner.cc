@@ -17,665 +17,1368 @@
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
 
-#include <regex>
 #include <algorithm>
+#include <cmath>
 #include <sstream>
-#include <iomanip>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <map>
-#include <fst/util.h>
-#include <boost/locale/encoding_utf.hpp>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include "base/kaldi-common.h"
 #include "util/common-utils.h"
-#include "feat/feature-mfcc.h"
-#include "feat/pitch-functions.h"
-#include "feat/wave-reader.h"
-#include "transform/cmvn.h"
-#include "feat/feature-functions.h"
-
-#include "tree/context-dep.h"
-#include "hmm/transition-model.h"
-#include "fstext/fstext-lib.h"
-#include "decoder/training-graph-compiler.h"
-
-#include "gmm/am-diag-gmm.h"
-#include "hmm/hmm-utils.h"
-#include "decoder/decoder-wrappers.h"
-#include "gmm/decodable-am-diag-gmm.h"
+#include "util/kaldi-thread.h"
+#include "util/bounded-queue.h"
+#include "util/trace-recorder.h"
+#include "util/kaldi-pipebuf.h"
+#include "aligner/aligner.h"
 
 namespace kaldi {
 
-using std::vector;
-using std::string;
-using std::wstring;
-using boost::locale::conv::utf_to_utf;
-
-// returns true if successfully appended.
-bool AppendFeats(const std::vector<Matrix<BaseFloat> > &in,
-                 const std::string &utt,
-                 int32 tolerance,
-                 Matrix<BaseFloat> *out) {
-  // Check the lengths
-  int32 min_len = in[0].NumRows(),
-      max_len = in[0].NumRows(),
-      tot_dim = in[0].NumCols();
-  for (int32 i = 1; i < in.size(); i++) {
-    int32 len = in[i].NumRows(), dim = in[i].NumCols();
-    tot_dim += dim;
-    if(len < min_len) min_len = len;
-    if(len > max_len) max_len = len;
-  }
-  if (max_len - min_len > tolerance || min_len == 0) {
-    KALDI_WARN << "Length mismatch " << max_len << " vs. " << min_len
-               << (utt.empty() ? "" : " for utt ") << utt
-               << " exceeds tolerance " << tolerance;
-    out->Resize(0, 0);
-    return false;
+/// AlignmentWriter writes alignments in whichever output format was
+/// selected.  It is not thread-safe; the caller serializes the calls.
+class AlignmentWriter {
+ public:
+  /// If "resume", the utterances already in the output (e.g. from a run that
+  /// was interrupted) are kept and listed in Completed(), and the new ones
+  /// are added after them.
+  AlignmentWriter(const AlignmentFormatter &formatter,
+                  const std::string &alignment_wspecifier,
+                  bool resume = false);
+
+  void Write(const std::string &utt, const std::vector<int32> &alignment);
+
+  const std::set<std::string> &Completed() const { return completed_; }
+
+  void Close() { output_.close(); }
+ private:
+  // For --resume with a text format: finds the complete alignments in the
+  // output, truncates anything after the last of them (left by a crash in
+  // the middle of an utterance) and opens the output for appending.
+  void ResumeText(const std::string &filename);
+  // For --resume with an archive: finds the complete entries, truncates
+  // anything after the last of them and opens the archive for appending (the
+  // entries are then written to output_ by AppendEntry()).
+  template<class Holder>
+  void ResumeTable(const std::string &wspecifier);
+  template<class Holder>
+  void AppendEntry(const std::string &utt, const typename Holder::T &value);
+
+  const AlignmentFormatter &formatter_;
+  Int32VectorWriter phones_writer_;
+  Int32PairVectorWriter pair_writer_;
+  std::ofstream output_;  // for the custom and MLF formats and resumed ctm
+                          // or archives.
+  WspecifierOptions table_opts_;  // of a resumed archive.
+  Output ctm_writer_;
+  bool mlf_header_written_;
+  std::set<std::string> completed_;
+};
+
+AlignmentWriter::AlignmentWriter(const AlignmentFormatter &formatter,
+                                 const std::string &alignment_wspecifier,
+                                 bool resume):
+    formatter_(formatter), mlf_header_written_(false) {
+  const SpeechAlignerOptions &opts = formatter.Options();
+  if (resume) {
+    if (formatter.TableOutput() && !opts.write_lengths)
+      ResumeTable<BasicVectorHolder<int32> >(alignment_wspecifier);
+    else if (formatter.TableOutput())
+      ResumeTable<BasicPairVectorHolder<int32> >(alignment_wspecifier);
+    else
+      ResumeText(alignment_wspecifier);
+    KALDI_LOG << "Resuming: " << completed_.size() << " utterances are "
+              << "already in " << alignment_wspecifier;
+    return;
   }
-  if (max_len - min_len > 0) {
-    KALDI_VLOG(2) << "Length mismatch " << max_len << " vs. " << min_len
-                  << (utt.empty() ? "" : " for utt ") << utt
-                  << " within tolerance " << tolerance;
+  if (formatter.TableOutput() && !opts.write_lengths)
+    phones_writer_.Open(alignment_wspecifier);
+  if (formatter.TableOutput() && opts.write_lengths)
+    pair_writer_.Open(alignment_wspecifier);
+  if (opts.custom_output || opts.mlf_output)
+    output_.open(alignment_wspecifier);
+  else if (opts.ctm_output)
+    ctm_writer_.Open(alignment_wspecifier, false, false);
+}
+
+void AlignmentWriter::ResumeText(const std::string &filename) {
+  const SpeechAlignerOptions &opts = formatter_.Options();
+  if (ClassifyWxfilename(filename) != kFileOutput)
+    KALDI_ERR << "--resume needs the output to be a file, not " << filename;
+  std::ifstream is(filename.c_str(), std::ios::in | std::ios::binary);
+  // "end" is the offset just after the last complete alignment.  The output
+  // is flushed at every line, so only the last utterance can be partial; a
+  // ctm has no end marker for an utterance, so its last one is redone.
+  std::streamoff end = 0, line_start = 0, last_key_start = 0;
+  std::string line, key, last_key;
+  bool in_record = false;
+  while (std::getline(is, line)) {
+    if (is.eof())
+      break;  // no newline, so the line was not finished.
+    std::streamoff next = is.tellg();
+    if (opts.ctm_output) {
+      std::string utt = line.substr(0, line.find(' '));
+      if (utt != last_key) {
+        if (!last_key.empty())
+          completed_.insert(last_key);
+        last_key = utt;
+        last_key_start = line_start;
+      }
+      end = last_key_start;
+    } else if (!in_record) {
+      if (opts.mlf_output && line == "#!MLF!#") {
+        mlf_header_written_ = true;
+        end = next;
+      } else if (!line.empty()) {
+        key = line;
+        if (opts.mlf_output)  // "*/<utt>.lab"
+          key = line.substr(3, line.size() > 8 ? line.size() - 8 : 0);
+        in_record = true;
+      }
+    } else if (line == ".") {
+      completed_.insert(key);
+      in_record = false;
+      end = next;
+    }
+    line_start = next;
   }
-  out->Resize(min_len, tot_dim);
-  int32 dim_offset = 0;
-  for (const auto i : in) {
-    int32 this_dim = i.NumCols();
-    out->Range(0, min_len, dim_offset, this_dim).CopyFromMat(
-        i.Range(0, min_len, 0, this_dim));
-    dim_offset += this_dim;
+  is.close();
+  if (truncate(filename.c_str(), end) != 0 && errno != ENOENT)
+    KALDI_ERR << "Could not truncate " << filename << ": " << strerror(errno);
+  output_.open(filename.c_str(), std::ios::out | std::ios::app);
+  if (!output_)
+    KALDI_ERR << "Could not open " << filename << " for appending.";
+}
+
+template<class Holder>
+void AlignmentWriter::ResumeTable(const std::string &wspecifier) {
+  std::string filename;
+  if (ClassifyWspecifier(wspecifier, &filename, NULL, &table_opts_) !=
+      kArchiveWspecifier || ClassifyWxfilename(filename) != kFileOutput)
+    KALDI_ERR << "--resume needs the output to be an archive in a file, not "
+              << wspecifier;
+  // An entry is "<key> <value>"; the value of a partial last entry either
+  // fails to read or, in text mode, ends without a newline, at end of file.
+  std::ifstream is(filename.c_str(), std::ios::in | std::ios::binary);
+  std::streamoff end = 0;
+  std::string key;
+  Holder holder;
+  while (is >> key) {
+    if (is.get() != ' ' || !holder.Read(is) || is.eof())
+      break;
+    end = is.tellg();
+    completed_.insert(key);
   }
-  return true;
+  is.close();
+  if (truncate(filename.c_str(), end) != 0 && errno != ENOENT)
+    KALDI_ERR << "Could not truncate " << filename << ": " << strerror(errno);
+  output_.open(filename.c_str(),
+               std::ios::out | std::ios::app | std::ios::binary);
+  if (!output_)
+    KALDI_ERR << "Could not open " << filename << " for appending.";
+}
+
+template<class Holder>
+void AlignmentWriter::AppendEntry(const std::string &utt,
+                                  const typename Holder::T &value) {
+  // As TableWriter writes archive entries.
+  output_ << utt << ' ';
+  if (!Holder::Write(output_, table_opts_.binary, value))
+    KALDI_ERR << "Error writing alignment for " << utt;
+  if (table_opts_.flush)
+    output_.flush();
 }
 
-bool ReadWordSymbol(const string &filename, std::map<string, int32> &word2id) {
-  std::ifstream in(filename);
-  string line;
-  while (std::getline(in, line)) {
-    vector<string> items;
-    std::istringstream iss(line);
-    for(std::string s; iss >> s; )
-      items.push_back(s);
-    KALDI_ASSERT(items.size() == 2);
-    std::string word = items[0];
-    int32 id = std::stoi(items[1]);
-    word2id[word] = id;
+void AlignmentWriter::Write(const std::string &utt,
+                            const std::vector<int32> &alignment) {
+  const SpeechAlignerOptions &opts = formatter_.Options();
+  if (opts.custom_output) {
+    formatter_.Format(utt, alignment, output_);
+  } else if (opts.mlf_output) {
+    if (!mlf_header_written_) {
+      output_ << "#!MLF!#" << std::endl;
+      mlf_header_written_ = true;
+    }
+    formatter_.Format(utt, alignment, output_);
+  } else if (opts.ctm_output) {
+    formatter_.Format(utt, alignment, (ctm_writer_.IsOpen() ?
+                                       ctm_writer_.Stream() : output_));
+  } else if (!opts.write_lengths) {
+    std::vector<int32> phones;
+    formatter_.PhoneSequence(alignment, &phones);
+    if (output_.is_open())  // resumed.
+      AppendEntry<BasicVectorHolder<int32> >(utt, phones);
+    else
+      phones_writer_.Write(utt, phones);
+  } else {
+    std::vector<std::pair<int32, int32> > pairs;
+    formatter_.PhoneLengths(alignment, &pairs);
+    if (output_.is_open())
+      AppendEntry<BasicPairVectorHolder<int32> >(utt, pairs);
+    else
+      pair_writer_.Write(utt, pairs);
   }
-  return true;
 }
 
-bool ReadPhoneSymbol(const string &filename, std::map<int32, string> &id2phn) {
-  std::ifstream in(filename);
-  string line;
-  while (std::getline(in, line)) {
-    vector<string> items;
-    std::istringstream iss(line);
-    for(std::string s; iss >> s; )
-      items.push_back(s);
-    KALDI_ASSERT(items.size() == 2);
-    std::string phone = items[0];
-    int32 id = std::stoi(items[1]);
-    id2phn[id] = phone;
+/// OrderedAlignmentWriter puts alignments that finish out of order (because
+/// the utterances were scheduled out of order) back in input order before
+/// passing them to AlignmentWriter.  Every index from 0 up must be given
+/// exactly once, with an empty alignment for a failed utterance.  It is not
+/// thread-safe.
+class OrderedAlignmentWriter {
+ public:
+  explicit OrderedAlignmentWriter(AlignmentWriter *writer):
+      writer_(writer), next_index_(0) { }
+
+  /// "index" is the position of the utterance in the input.  Takes the
+  /// contents of "alignment".
+  void Write(int64 index, const std::string &utt,
+             std::vector<int32> *alignment) {
+    KALDI_ASSERT(index >= next_index_ && pending_.count(index) == 0);
+    std::pair<std::string, std::vector<int32> > &entry = pending_[index];
+    entry.first = utt;
+    entry.second.swap(*alignment);
+    std::map<int64, std::pair<std::string, std::vector<int32> > >::iterator
+        iter;
+    while ((iter = pending_.find(next_index_)) != pending_.end()) {
+      if (!iter->second.second.empty())
+        writer_->Write(iter->second.first, iter->second.second);
+      pending_.erase(iter);
+      next_index_++;
+    }
   }
-  return true;
+
+  /// Number of alignments held back waiting for an earlier utterance.
+  size_t NumPending() const { return pending_.size(); }
+ private:
+  AlignmentWriter *writer_;
+  int64 next_index_;
+  std::map<int64, std::pair<std::string, std::vector<int32> > > pending_;
+};
+
+/// AlignUtteranceTask is run by TaskSequencer: operator () does all the
+/// per-utterance work (text segmentation, features, graph compilation and
+/// alignment) and may run in parallel with other tasks; the destructor writes
+/// the output and runs sequentially, in the order the tasks were started.
+class AlignUtteranceTask {
+ public:
+  // Takes the contents of "wave_data" (it is swapped out).  If "profile" is
+  // not NULL the task takes it, fills it in and gives it to "profiler" when
+  // done.
+  AlignUtteranceTask(Aligner *aligner, OrderedAlignmentWriter *writer,
+                     int64 index, const std::string &utt,
+                     const std::vector<std::string> &transcript,
+                     WaveData *wave_data, BaseFloat vtln_warp,
+                     AlignStats *stats, UtteranceProfile *profile = NULL,
+                     AlignProfiler *profiler = NULL):
+      aligner_(aligner), writer_(writer), index_(index), utt_(utt),
+      transcript_(transcript), vtln_warp_(vtln_warp), stats_(stats),
+      profile_(profile), profiler_(profiler) {
+    wave_data_.Swap(wave_data);
+  }
+
+  void operator () () {
+    TraceRecorder::SetThreadName("align");
+    try {
+      std::vector<int32> word_ids;
+      aligner_->TextToWordIds(transcript_, &word_ids, profile_.get());
+      transcript_.clear();
+
+      Matrix<BaseFloat> features;
+      bool ans = aligner_->ComputeFeatures(utt_, wave_data_, vtln_warp_,
+                                           &features, profile_.get());
+      wave_data_.Clear();
+      if (!ans) {
+        local_stats_.num_err++;
+        return;
+      }
+      aligner_->Align(utt_, word_ids, features, &alignment_, &local_stats_,
+                      profile_.get());
+    } catch (const std::exception &e) {
+      // An error in one utterance must not escape the worker thread; the
+      // destructor still writes (i.e. skips) it in order.
+      // (Kaldi errors have already been logged, and their what() is empty.)
+      KALDI_WARN << "Failed to align utterance " << utt_ << " "
+                 << e.what();
+      alignment_.clear();
+      local_stats_.num_err++;
+    }
+  }
+
+  ~AlignUtteranceTask() {
+    {
+      StageTimer timer(profile_.get(), kStageWrite);
+      writer_->Write(index_, utt_, &alignment_);
+    }
+    stats_->Add(local_stats_);
+    if (profile_)
+      profiler_->Add(*profile_);
+  }
+ private:
+  Aligner *aligner_;
+  OrderedAlignmentWriter *writer_;
+  int64 index_;
+  std::string utt_;
+  std::vector<std::string> transcript_;
+  WaveData wave_data_;
+  BaseFloat vtln_warp_;
+  AlignStats *stats_;
+  AlignStats local_stats_;
+  std::vector<int32> alignment_;
+  std::unique_ptr<UtteranceProfile> profile_;
+  AlignProfiler *profiler_;
+};
+
+struct AlignPipelineOptions {
+  bool pipeline;
+  int32 frontend_threads;
+  int32 compile_threads;
+  int32 decode_threads;
+  int32 queue_size;
+  int32 max_utts;
+
+  AlignPipelineOptions(): pipeline(false), frontend_threads(1),
+                          compile_threads(1), decode_threads(1),
+                          queue_size(8), max_utts(0) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("pipeline", &pipeline, "If true, run wav reading, feature "
+                   "extraction, graph compilation, decoding and writing as "
+                   "separate stages connected by bounded queues (the "
+                   "--*-threads options size the stages; --num-threads is "
+                   "then not used).");
+    opts->Register("frontend-threads", &frontend_threads, "Number of threads "
+                   "computing features, with --pipeline=true");
+    opts->Register("compile-threads", &compile_threads, "Number of threads "
+                   "compiling decoding graphs, with --pipeline=true");
+    opts->Register("decode-threads", &decode_threads, "Number of threads "
+                   "aligning, with --pipeline=true");
+    opts->Register("queue-size", &queue_size, "Capacity of each queue between "
+                   "pipeline stages, with --pipeline=true");
+    opts->Register("pipeline-max-utts", &max_utts, "Maximum number of "
+                   "utterances inside the pipeline stages at once; bounds "
+                   "memory use.  If <= 0, defaults to 3 * --queue-size plus "
+                   "the number of stage threads.");
+  }
+};
+
+/// AlignPipeline runs the stages of the alignment as a producer/consumer
+/// pipeline, so that I/O overlaps computation and each stage can be given its
+/// own number of threads:
+///   reader (caller's thread) -> frontend -> graph compiler -> decoder -> writer
+/// Utterances that fail in a stage skip straight to the writer.  The writer
+/// restores the input order before writing.
+class AlignPipeline {
+ public:
+  /// If "profiler" is not NULL, the profiles given to Accept() are passed to
+  /// it once the utterances are written.
+  AlignPipeline(const AlignPipelineOptions &opts, Aligner *aligner,
+                OrderedAlignmentWriter *writer,
+                AlignProfiler *profiler = NULL);
+
+  /// Called from the reader; "index" is the position of the utterance in the
+  /// input (see OrderedAlignmentWriter).  Takes the contents of "wave_data",
+  /// and "profile" if not NULL.  Blocks while the pipeline is full.
+  void Accept(int64 index, const std::string &utt,
+              const std::vector<std::string> &transcript,
+              WaveData *wave_data, BaseFloat vtln_warp,
+              UtteranceProfile *profile = NULL);
+
+  /// Waits for all the utterances to be written, and logs the queue
+  /// statistics.
+  void Finish();
+
+  const AlignStats &Stats() const { return stats_; }
+
+  ~AlignPipeline();
+ private:
+  struct Item {
+    int64 index;  // position in the input.
+    std::string utt;
+    std::vector<std::string> transcript;
+    WaveData wave_data;
+    BaseFloat vtln_warp;
+    std::vector<int32> word_ids;
+    Matrix<BaseFloat> features;
+    fst::VectorFst<fst::StdArc> decode_fst;
+    std::vector<int32> alignment;
+    AlignStats stats;
+    std::unique_ptr<UtteranceProfile> profile;
+  };
+  typedef BoundedQueue<Item*> Queue;
+
+  // The stage functions run in their own threads.  The last thread of a stage
+  // to finish closes the stage's output queue.
+  void FrontendStage();
+  void CompileStage();
+  void DecodeStage();
+  void WriteStage();
+  void StageDone(int32 *num_running, Queue *output);
+  // Called from a stage that caught "e" while working on "item": counts the
+  // error and sends the item straight to the writer, so that the output
+  // order and the slots are kept.
+  void Fail(Item *item, const std::exception &e);
+
+  const AlignPipelineOptions &opts_;
+  Aligner *aligner_;
+  OrderedAlignmentWriter *writer_;
+  AlignProfiler *profiler_;
+
+  Queue frontend_queue_;
+  Queue compile_queue_;
+  Queue decode_queue_;
+  Queue write_queue_;
+  Semaphore slots_;  // limits the number of utterances in the pipeline.
+
+  std::mutex stage_mutex_;
+  int32 frontend_running_;
+  int32 compile_running_;
+  int32 decode_running_;
+
+  std::vector<std::thread> threads_;
+  AlignStats stats_;  // only touched by the writer thread until Finish().
+  bool finished_;
+};
+
+static int32 PipelineMaxUtts(const AlignPipelineOptions &opts) {
+  if (opts.max_utts > 0)
+    return opts.max_utts;
+  return 3 * opts.queue_size + opts.frontend_threads + opts.compile_threads +
+      opts.decode_threads;
+}
+
+AlignPipeline::AlignPipeline(const AlignPipelineOptions &opts,
+                             Aligner *aligner,
+                             OrderedAlignmentWriter *writer,
+                             AlignProfiler *profiler):
+    opts_(opts), aligner_(aligner), writer_(writer), profiler_(profiler),
+    frontend_queue_(opts.queue_size), compile_queue_(opts.queue_size),
+    decode_queue_(opts.queue_size),
+    // the write queue is fed by every stage, and never needs to block them.
+    write_queue_(PipelineMaxUtts(opts)),
+    slots_(PipelineMaxUtts(opts)),
+    frontend_running_(opts.frontend_threads),
+    compile_running_(opts.compile_threads),
+    decode_running_(opts.decode_threads),
+    finished_(false) {
+  if (opts.frontend_threads <= 0 || opts.compile_threads <= 0 ||
+      opts.decode_threads <= 0 || opts.queue_size <= 0)
+    KALDI_ERR << "Pipeline thread counts and --queue-size must be positive.";
+  for (int32 i = 0; i < opts.frontend_threads; i++)
+    threads_.push_back(std::thread(&AlignPipeline::FrontendStage, this));
+  for (int32 i = 0; i < opts.compile_threads; i++)
+    threads_.push_back(std::thread(&AlignPipeline::CompileStage, this));
+  for (int32 i = 0; i < opts.decode_threads; i++)
+    threads_.push_back(std::thread(&AlignPipeline::DecodeStage, this));
+  threads_.push_back(std::thread(&AlignPipeline::WriteStage, this));
+}
+
+AlignPipeline::~AlignPipeline() {
+  Finish();
+}
+
+void AlignPipeline::Accept(int64 index, const std::string &utt,
+                           const std::vector<std::string> &transcript,
+                           WaveData *wave_data, BaseFloat vtln_warp,
+                           UtteranceProfile *profile) {
+  slots_.Wait();
+  Item *item = new Item();
+  item->index = index;
+  item->utt = utt;
+  item->transcript = transcript;
+  item->wave_data.Swap(wave_data);
+  item->vtln_warp = vtln_warp;
+  item->profile.reset(profile);
+  frontend_queue_.Push(item);
+}
+
+void AlignPipeline::Finish() {
+  if (finished_)
+    return;
+  finished_ = true;
+  frontend_queue_.Close();
+  for (size_t i = 0; i < threads_.size(); i++)
+    threads_[i].join();
+  frontend_queue_.PrintStats("frontend");
+  compile_queue_.PrintStats("compile");
+  decode_queue_.PrintStats("decode");
+  write_queue_.PrintStats("write");
 }
 
-std::wstring s2ws(const std::string &str) {
-  return utf_to_utf<wchar_t>(str.c_str(), str.c_str() + str.size());
+void AlignPipeline::StageDone(int32 *num_running, Queue *output) {
+  std::lock_guard<std::mutex> lock(stage_mutex_);
+  if (--(*num_running) == 0)
+    output->Close();
 }
 
-std::string ws2s(const std::wstring &str) {
-  return utf_to_utf<char>(str.c_str(), str.c_str() + str.size());
+void AlignPipeline::Fail(Item *item, const std::exception &e) {
+  KALDI_WARN << "Failed to align utterance " << item->utt << " " << e.what();
+  item->transcript.clear();
+  item->wave_data.Clear();
+  item->features.Resize(0, 0);
+  item->decode_fst.DeleteStates();
+  item->alignment.clear();
+  item->stats.num_err++;
+  write_queue_.Push(item);
 }
 
-bool SegWordFMM(std::map<string, int32> &word2id, std::vector<std::string> &strs,
-    vector<string> &words, vector<int32> &word_ids,
-    bool text_case_sensitive=false,
-    bool spell_en_oov=true) {
-  for (auto str: strs) {
-    if (!text_case_sensitive) {
-      transform(str.begin(), str.end(), str.begin(), ::toupper);
+void AlignPipeline::FrontendStage() {
+  TraceRecorder::SetThreadName("frontend");
+  Item *item;
+  while (frontend_queue_.Pop(&item)) {
+    try {
+      aligner_->TextToWordIds(item->transcript, &item->word_ids,
+                              item->profile.get());
+      item->transcript.clear();
+      bool ans = aligner_->ComputeFeatures(item->utt, item->wave_data,
+                                           item->vtln_warp, &item->features,
+                                           item->profile.get());
+      item->wave_data.Clear();
+      if (ans) {
+        compile_queue_.Push(item);
+      } else {
+        item->stats.num_err++;
+        write_queue_.Push(item);
+      }
+    } catch (const std::exception &e) {
+      Fail(item, e);
     }
-    if (word2id.find(str) != word2id.end()) {
-      // in dict, just add into results
-      words.push_back(str);
-      word_ids.push_back(word2id[str]);
-    } else {
-      // use fmm to seg this str
-      std::wstring sent = s2ws(str);
-      int maxLength = 20, index = 0, length = sent.size();
-      while (index < length) {
-        int wordLen = length - index + 1 >= maxLength ? maxLength : length - index + 1;
-        while (wordLen >= 1) {
-          std::wstring cur = sent.substr(index, wordLen);
-          string curWord = ws2s(cur);
-
-          if (std::regex_match(curWord, std::regex("^\\w+$")) && wordLen > 1) { // en
-            if (word2id.find(curWord) != word2id.end()) { // iv
-              words.push_back(curWord);
-              word_ids.push_back(word2id[curWord]);
-              index += wordLen;
-              break;
-            } else { // oov
-              if (spell_en_oov) {
-                for (char const &c: curWord) {
-                  words.push_back(string(1, c));
-                  word_ids.push_back(word2id[string(1, c)]);
-                }
-              } else {
-                words.push_back("<UNK>");
-                word_ids.push_back(word2id["<UNK>"]);
-              }
-              index += wordLen;
-              break;
-            }
-          } else if (word2id.find(curWord) != word2id.end()) { // cn-iv
-            words.push_back(curWord);
-            word_ids.push_back(word2id[curWord]);
-            index += wordLen;
-            break;
-          } else if (1 == wordLen) { // any 1-char oov
-            words.push_back("<UNK>");
-            word_ids.push_back(word2id["<UNK>"]);
-            index += wordLen;
-            break;
-          } else {
-            wordLen--;
-          }
-        }
+  }
+  StageDone(&frontend_running_, &compile_queue_);
+}
+
+void AlignPipeline::CompileStage() {
+  TraceRecorder::SetThreadName("compile");
+  Item *item;
+  while (compile_queue_.Pop(&item)) {
+    try {
+      if (aligner_->CompileGraph(item->utt, item->word_ids,
+                                 &item->decode_fst, item->profile.get())) {
+        decode_queue_.Push(item);
+      } else {
+        item->stats.num_err++;
+        write_queue_.Push(item);
       }
+    } catch (const std::exception &e) {
+      Fail(item, e);
+    }
+  }
+  StageDone(&compile_running_, &decode_queue_);
+}
+
+void AlignPipeline::DecodeStage() {
+  TraceRecorder::SetThreadName("decode");
+  Item *item;
+  while (decode_queue_.Pop(&item)) {
+    try {
+      aligner_->AlignGraph(item->utt, item->features, &item->decode_fst,
+                           &item->alignment, &item->stats,
+                           item->profile.get());
+      item->features.Resize(0, 0);
+      item->decode_fst.DeleteStates();
+      write_queue_.Push(item);
+    } catch (const std::exception &e) {
+      Fail(item, e);
+    }
+  }
+  StageDone(&decode_running_, &write_queue_);
+}
+
+void AlignPipeline::WriteStage() {
+  TraceRecorder::SetThreadName("write");
+  Item *item;
+  while (write_queue_.Pop(&item)) {
+    slots_.Signal();
+    {
+      StageTimer timer(item->profile.get(), kStageWrite);
+      writer_->Write(item->index, item->utt, &item->alignment);
+    }
+    stats_.Add(item->stats);
+    if (item->profile)
+      profiler_->Add(*item->profile);
+    delete item;
+  }
+}
+
+struct AlignScheduleOptions {
+  std::string schedule;
+  BaseFloat bucket_width;
+  int32 window;
+
+  AlignScheduleOptions(): schedule("input"), bucket_width(5.0), window(0) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("schedule", &schedule, "Order in which utterances are "
+                   "given to the threads: \"input\", \"longest-first\" or "
+                   "\"buckets\" (by duration, --bucket-width seconds per "
+                   "bucket, longest bucket first and input order within a "
+                   "bucket).  Except for \"input\", the wav headers are "
+                   "scanned first.  The output is in input order regardless.");
+    opts->Register("bucket-width", &bucket_width, "Width in seconds of the "
+                   "duration buckets, with --schedule=buckets");
+    opts->Register("schedule-window", &window, "If > 0, the utterances are "
+                   "reordered within consecutive windows of this many "
+                   "utterances rather than all at once; this bounds the "
+                   "number of alignments held back for in-order output.");
+  }
+};
+
+/// An utterance as seen by the scheduler.
+struct ScheduledUtterance {
+  int64 index;  // position among the utterances to be aligned.
+  std::string utt;
+  std::vector<std::string> transcript;
+  BaseFloat vtln_warp;
+  BaseFloat duration;  // from the wav header; -1 if unknown (streamed).
+};
+
+struct LongerUtterance {
+  bool operator () (const ScheduledUtterance &a,
+                    const ScheduledUtterance &b) const {
+    return a.duration > b.duration;
+  }
+};
+
+struct LongerBucket {
+  explicit LongerBucket(BaseFloat bucket_width): bucket_width(bucket_width) { }
+  int64 Bucket(const ScheduledUtterance &u) const {
+    return static_cast<int64>(std::floor(u.duration / bucket_width));
+  }
+  bool operator () (const ScheduledUtterance &a,
+                    const ScheduledUtterance &b) const {
+    return Bucket(a) > Bucket(b);
+  }
+  BaseFloat bucket_width;
+};
+
+/// Reorders "utts" into the order they should be dispatched in, according to
+/// opts.schedule.  The sorts are stable, so ties keep their input order.
+void ScheduleUtterances(const AlignScheduleOptions &opts,
+                        std::vector<ScheduledUtterance> *utts) {
+  if (opts.schedule == "buckets" && opts.bucket_width <= 0.0)
+    KALDI_ERR << "--bucket-width must be positive.";
+  size_t window = (opts.window > 0 ? opts.window : utts->size());
+  for (size_t start = 0; start < utts->size(); start += window) {
+    std::vector<ScheduledUtterance>::iterator
+        begin = utts->begin() + start,
+        end = utts->begin() + std::min(start + window, utts->size());
+    if (opts.schedule == "longest-first") {
+      std::stable_sort(begin, end, LongerUtterance());
+    } else if (opts.schedule == "buckets") {
+      std::stable_sort(begin, end, LongerBucket(opts.bucket_width));
+    } else {
+      KALDI_ERR << "Unknown --schedule option " << opts.schedule;
     }
   }
+}
+
+struct AlignShardOptions {
+  std::string shard;
+
+  void Register(OptionsItf *opts) {
+    opts->Register("shard", &shard, "If set to \"i/N\", align only the i'th "
+                   "(1 <= i <= N) of N shards of the input, e.g. one per "
+                   "machine.  The shards are chosen from the keys and the "
+                   "durations in the wav headers only, so every machine "
+                   "computes the same split, and they are balanced by total "
+                   "duration.  Combine the outputs with merge-alignments.");
+  }
 
+  /// Parses --shard into the 0-based shard index and the number of shards;
+  /// returns false if --shard is not set.
+  bool Parse(int32 *index, int32 *num_shards) const {
+    if (shard.empty())
+      return false;
+    std::vector<std::string> parts;
+    SplitStringToVector(shard, "/", false, &parts);
+    if (parts.size() != 2 || !ConvertStringToInteger(parts[0], index) ||
+        !ConvertStringToInteger(parts[1], num_shards) ||
+        *num_shards < 1 || *index < 1 || *index > *num_shards)
+      KALDI_ERR << "Bad --shard option " << shard << ", expected i/N with "
+                << "1 <= i <= N";
+    (*index)--;
+    return true;
+  }
+};
+
+struct LongerUtteranceOrKey {
+  bool operator () (const ScheduledUtterance *a,
+                    const ScheduledUtterance *b) const {
+    if (a->duration != b->duration)
+      return a->duration > b->duration;
+    return a->utt < b->utt;
+  }
+};
+
+/// Keeps, in input order, the utterances of "utts" that belong to shard
+/// "index" of "num_shards".  The assignment depends only on the set of keys
+/// and durations, not on their order: longest first (ties by key), each
+/// utterance goes to the shard with the least total duration so far (ties to
+/// the lowest shard).  Utterances of unknown duration (streamed wavs) are
+/// dealt out in key order.
+void ShardUtterances(int32 index, int32 num_shards,
+                     std::vector<ScheduledUtterance> *utts) {
+  std::vector<const ScheduledUtterance*> sorted(utts->size());
+  for (size_t i = 0; i < utts->size(); i++)
+    sorted[i] = &((*utts)[i]);
+  std::sort(sorted.begin(), sorted.end(), LongerUtteranceOrKey());
+  std::vector<double> totals(num_shards, 0.0);
+  std::set<const ScheduledUtterance*> selected;
+  for (size_t i = 0, num_unknown = 0; i < sorted.size(); i++) {
+    int32 shard;
+    if (sorted[i]->duration < 0.0) {
+      shard = num_unknown++ % num_shards;
+    } else {
+      shard = std::min_element(totals.begin(), totals.end()) - totals.begin();
+      totals[shard] += sorted[i]->duration;
+    }
+    if (shard == index)
+      selected.insert(sorted[i]);
+  }
+  std::vector<ScheduledUtterance> kept;
+  for (size_t i = 0; i < utts->size(); i++)
+    if (selected.count(&((*utts)[i])) != 0)
+      kept.push_back((*utts)[i]);
+  KALDI_LOG << "Shard " << (index + 1) << " of " << num_shards << " has "
+            << kept.size() << " of " << utts->size() << " utterances, "
+            << totals[index] << " seconds (the shards have "
+            << *std::min_element(totals.begin(), totals.end()) << " to "
+            << *std::max_element(totals.begin(), totals.end())
+            << " seconds)";
+  utts->swap(kept);
+}
+
+/// Looks up the transcript of "utt"; returns false, with a warning, if there
+/// is none (or it is empty), in which case the utterance is skipped.
+bool GetTranscript(RandomAccessTokenVectorReader *transcript_reader,
+                   const std::string &utt,
+                   std::vector<std::string> *transcript) {
+  if (!transcript_reader->HasKey(utt)) {
+    KALDI_WARN << "No transcript for utterance " << utt;
+    return false;
+  }
+  *transcript = transcript_reader->Value(utt);
+  if (transcript->empty()) {
+    KALDI_WARN << "Empty transcript for utterance " << utt;
+    return false;
+  }
   return true;
 }
 
+/// Works out the VTLN warp factor; returns false, with a warning, if
+/// --vtln-map has no entry for the utterance.
+bool GetVtlnWarp(const SpeechAlignerOptions &opts,
+                 RandomAccessBaseFloatReaderMapped *vtln_map_reader,
+                 const std::string &utt, BaseFloat *vtln_warp) {
+  if (!opts.vtln_map_rspecifier.empty()) {
+    if (!vtln_map_reader->HasKey(utt)) {
+      KALDI_WARN << "No vtln-map entry for utterance-id (or speaker-id) "
+                 << utt;
+      return false;
+    }
+    *vtln_warp = vtln_map_reader->Value(utt);
+  } else {
+    *vtln_warp = opts.vtln_warp;
+  }
+  return true;
+}
+
+struct AlignServerOptions {
+  bool server;
+  std::string socket;
+  int32 max_connections;
+  int32 max_request_bytes;
+
+  AlignServerOptions(): server(false), max_connections(64),
+                        max_request_bytes(64 << 20) { }
+
+  void Register(OptionsItf *opts) {
+    opts->Register("server", &server, "If true, load the models once and then "
+                   "serve alignment requests (see the usage message for the "
+                   "protocol) from --socket, or from the standard input.  "
+                   "Takes no positional arguments.");
+    opts->Register("socket", &socket, "With --server=true, path of the Unix "
+                   "domain socket to listen on.  If empty, requests are read "
+                   "from the standard input and the responses written to the "
+                   "standard output.  Whoever can connect can have any file "
+                   "the server can read aligned, so the socket is created "
+                   "with mode 0600 (only the server's user may connect); "
+                   "chmod it, or put it in a directory with the right "
+                   "permissions, to let others in.");
+    opts->Register("max-connections", &max_connections, "With --socket, "
+                   "maximum number of connections served at once; further "
+                   "clients wait until one closes.");
+    opts->Register("max-request-bytes", &max_request_bytes, "Maximum size of "
+                   "the wav file in an ALIGN_BYTES request; larger requests "
+                   "get an ERROR response and the connection is closed.");
+  }
+};
+
+class AlignServer;
+
+/// AlignRequestTask aligns the utterance of one server request.  Like
+/// AlignUtteranceTask it is run by TaskSequencer, and its destructor writes
+/// the response, so the responses on a connection come back in the order of
+/// the requests.
+class AlignRequestTask {
+ public:
+  // Takes the contents of "wav_bytes"; if it is empty, the wave is read from
+  // "wav_rxfilename".
+  AlignRequestTask(AlignServer *server, std::ostream *os,
+                   const std::string &utt, const std::string &wav_rxfilename,
+                   std::string *wav_bytes,
+                   const std::vector<std::string> &transcript):
+      server_(server), os_(os), utt_(utt), wav_rxfilename_(wav_rxfilename),
+      transcript_(transcript) {
+    wav_bytes_.swap(*wav_bytes);
+  }
+
+  // This version just responds with an error (for a malformed request).
+  AlignRequestTask(std::ostream *os, const std::string &error,
+                   const std::string &utt = "-"):
+      server_(NULL), os_(os), utt_(utt) {
+    SetError(error);
+  }
+
+  void operator () ();
+
+  ~AlignRequestTask() {
+    *os_ << response_;
+    os_->flush();
+  }
+ private:
+  void SetError(const std::string &message) {
+    // KALDI_ERR throws an empty message (it has already been logged), and
+    // other messages can have a stack trace after the first line.
+    std::string first_line = message.substr(0, message.find('\n'));
+    response_ = "ERROR " + utt_ + " " +
+        (first_line.empty() ? "error reading or aligning the utterance, see "
+         "the server log" : first_line) + "\n";
+  }
+
+  AlignServer *server_;
+  std::ostream *os_;
+  std::string utt_;
+  std::string wav_rxfilename_;
+  std::string wav_bytes_;
+  std::vector<std::string> transcript_;
+  std::string response_;
+};
+
+/// AlignServer answers alignment requests using models that were loaded
+/// once.  Each request is a line
+///   ALIGN <utt-id> <wav-rxfilename> <transcript ...>
+/// or
+///   ALIGN_BYTES <utt-id> <num-bytes> <transcript ...>
+/// followed by <num-bytes> bytes of a wav file.  Each response is either
+///   OK <utt-id> <num-bytes>
+/// followed by <num-bytes> bytes of alignment in the selected output format,
+/// or
+///   ERROR <utt-id> <message>
+/// The wav-rxfilename of an ALIGN request must be a plain file on the
+/// server: commands ("cmd |"), the standard input and offsets are refused,
+/// since the client could otherwise run commands as the server's user.
+/// The requests of a connection are aligned in parallel (--num-threads) and
+/// answered in order; up to --max-connections connections are served at
+/// once, but no more than --num-threads alignments run at any time.
+class AlignServer {
+ public:
+  AlignServer(Aligner *aligner, const AlignmentFormatter &formatter,
+              const TaskSequencerConfig &sequencer_config,
+              const AlignServerOptions &server_opts);
+
+  /// Serves the requests read from "is" until end of input.
+  void ServeStream(std::istream &is, std::ostream &os);
+
+  /// Listens on the Unix domain socket "path" and serves each connection in
+  /// its own thread.  Refuses to replace a file at "path" unless it is a
+  /// socket that nobody listens on (left by a server that was killed).
+  /// Does not return.
+  void ServeSocket(const std::string &path);
+
+ private:
+  friend class AlignRequestTask;
+  void ServeConnection(int fd);
+  // Removes a stale socket at "path"; dies if "path" is something else or a
+  // server is listening on it.
+  static void RemoveStaleSocket(const std::string &path);
+
+  Aligner *aligner_;
+  const AlignmentFormatter &formatter_;
+  TaskSequencerConfig sequencer_config_;
+  int32 max_request_bytes_;
+  Semaphore compute_slots_;  // limits the alignments running at once.
+  Semaphore connection_slots_;  // limits the connections served at once.
+};
+
+void AlignRequestTask::operator () () {
+  if (server_ == NULL)
+    return;  // error response already set.
+  server_->compute_slots_.Wait();
+  try {
+    const SpeechAlignerOptions &opts = server_->formatter_.Options();
+    WaveData wave_data;
+    if (wav_bytes_.empty()) {
+      Input ki(wav_rxfilename_);
+      wave_data.Read(ki.Stream());
+    } else {
+      std::istringstream is(wav_bytes_);
+      wave_data.Read(is);
+      std::string().swap(wav_bytes_);
+    }
+    std::vector<int32> word_ids;
+    server_->aligner_->TextToWordIds(transcript_, &word_ids);
+    Matrix<BaseFloat> features;
+    std::vector<int32> alignment;
+    AlignStats stats;
+    if (!server_->aligner_->ComputeFeatures(utt_, wave_data, opts.vtln_warp,
+                                            &features)) {
+      SetError("feature extraction failed");
+    } else {
+      server_->aligner_->Align(utt_, word_ids, features, &alignment, &stats);
+      if (alignment.empty()) {
+        SetError("alignment failed");
+      } else {
+        std::ostringstream os;
+        server_->formatter_.Format(utt_, alignment, os);
+        std::ostringstream header;
+        header << "OK " << utt_ << " " << os.str().size() << "\n";
+        response_ = header.str() + os.str();
+      }
+    }
+  } catch (const std::exception &e) {
+    SetError(e.what());
+  }
+  server_->compute_slots_.Signal();
+  KALDI_VLOG(1) << response_.substr(0, response_.find('\n'));
+}
+
+AlignServer::AlignServer(Aligner *aligner,
+                         const AlignmentFormatter &formatter,
+                         const TaskSequencerConfig &sequencer_config,
+                         const AlignServerOptions &server_opts):
+    aligner_(aligner), formatter_(formatter),
+    sequencer_config_(sequencer_config),
+    max_request_bytes_(server_opts.max_request_bytes),
+    compute_slots_(std::max<int32>(1, sequencer_config.num_threads)),
+    connection_slots_(std::max<int32>(1, server_opts.max_connections)) { }
+
+void AlignServer::ServeStream(std::istream &is, std::ostream &os) {
+  TaskSequencer<AlignRequestTask> sequencer(sequencer_config_);
+  std::string line;
+  while (std::getline(is, line)) {
+    std::vector<std::string> items;
+    SplitStringToVector(line, " \t\r", true, &items);
+    if (items.empty())
+      continue;
+    if (items[0] == "ALIGN" && items.size() >= 4) {
+      if (ClassifyRxfilename(items[2]) != kFileInput) {
+        sequencer.Run(new AlignRequestTask(&os, "only plain files may be "
+                                           "given in ALIGN requests",
+                                           items[1]));
+        continue;
+      }
+      std::string no_bytes;
+      std::vector<std::string> transcript(items.begin() + 3, items.end());
+      sequencer.Run(new AlignRequestTask(this, &os, items[1], items[2],
+                                         &no_bytes, transcript));
+    } else if (items[0] == "ALIGN_BYTES") {
+      // The request line is followed by <n> bytes of wav data, so once it is
+      // rejected we must either skip them or drop the connection, or they
+      // would be read as requests.
+      if (items.size() < 3) {
+        sequencer.Run(new AlignRequestTask(&os, "malformed request"));
+        break;  // we cannot find the start of the next request.
+      }
+      int32 num_bytes;
+      if (!ConvertStringToInteger(items[2], &num_bytes) || num_bytes <= 0) {
+        sequencer.Run(new AlignRequestTask(&os, "bad byte count " + items[2]));
+        break;  // we cannot find the start of the next request.
+      }
+      if (num_bytes > max_request_bytes_) {
+        sequencer.Run(new AlignRequestTask(&os, "request of " + items[2] +
+                                           " bytes is over the limit "
+                                           "(--max-request-bytes)", items[1]));
+        break;
+      }
+      std::string wav_bytes(num_bytes, '\0');
+      if (!is.read(&(wav_bytes[0]), num_bytes))
+        break;  // connection closed.
+      if (items.size() < 4) {
+        sequencer.Run(new AlignRequestTask(&os, "malformed request: no "
+                                           "transcript", items[1]));
+        continue;
+      }
+      std::vector<std::string> transcript(items.begin() + 3, items.end());
+      sequencer.Run(new AlignRequestTask(this, &os, items[1], "",
+                                         &wav_bytes, transcript));
+    } else {
+      sequencer.Run(new AlignRequestTask(&os, "malformed request"));
+    }
+  }
+  sequencer.Wait();
+}
+
+void AlignServer::ServeConnection(int fd) {
+  FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+  if (in == NULL || out == NULL) {
+    KALDI_WARN << "Could not open connection: " << strerror(errno);
+    if (in != NULL) fclose(in); else close(fd);
+    if (out != NULL) fclose(out);
+    return;
+  }
+  {
+    basic_pipebuf<char> in_buf(in, std::ios_base::in | std::ios_base::binary),
+        out_buf(out, std::ios_base::out | std::ios_base::binary);
+    std::istream is(&in_buf);
+    std::ostream os(&out_buf);
+    try {
+      ServeStream(is, os);
+    } catch (const std::exception &e) {
+      KALDI_WARN << "Error serving connection: " << e.what();
+    }
+    os.flush();
+  }
+  fclose(in);
+  fclose(out);
+  connection_slots_.Signal();
+}
+
+void AlignServer::RemoveStaleSocket(const std::string &path) {
+  struct stat st;
+  if (lstat(path.c_str(), &st) != 0)
+    return;  // nothing there.
+  if (!S_ISSOCK(st.st_mode))
+    KALDI_ERR << path << " exists and is not a socket; not replacing it.";
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    KALDI_ERR << "Could not create socket: " << strerror(errno);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  bool in_use = (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                         sizeof(addr)) == 0 || errno != ECONNREFUSED);
+  close(fd);
+  if (in_use)
+    KALDI_ERR << "Another server seems to be listening on " << path;
+  KALDI_LOG << "Removing stale socket " << path;
+  if (unlink(path.c_str()) != 0)
+    KALDI_ERR << "Could not remove " << path << ": " << strerror(errno);
+}
+
+void AlignServer::ServeSocket(const std::string &path) {
+  // A client that goes away should not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    KALDI_ERR << "Could not create socket: " << strerror(errno);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path))
+    KALDI_ERR << "Socket path is too long: " << path;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  RemoveStaleSocket(path);
+  // Only the server's user may connect until the socket is chmod'ed (no
+  // other threads are running yet, so changing the umask is safe).
+  mode_t old_umask = umask(0077);
+  int ans = bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+                 sizeof(addr));
+  umask(old_umask);
+  if (ans != 0 || listen(listen_fd, SOMAXCONN) != 0)
+    KALDI_ERR << "Could not listen on " << path << ": " << strerror(errno);
+  KALDI_LOG << "Listening on " << path;
+  while (true) {
+    connection_slots_.Wait();  // further clients wait in the listen queue.
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+      int err = errno;
+      connection_slots_.Signal();
+      if (err == EINTR || err == ECONNABORTED)
+        continue;
+      if (err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM) {
+        KALDI_WARN << "Error accepting connection (will retry): "
+                   << strerror(err);
+        sleep(1);
+        continue;
+      }
+      KALDI_ERR << "Error accepting connection: " << strerror(err);
+    }
+    try {
+      std::thread(&AlignServer::ServeConnection, this, fd).detach();
+    } catch (const std::exception &e) {
+      KALDI_WARN << "Could not start a thread for a connection: " << e.what();
+      close(fd);
+      connection_slots_.Signal();
+    }
+  }
+}
+
 }
 
 int main(int argc, char *argv[]) {
   try {
     using namespace kaldi;
     typedef kaldi::int32 int32;
-    using fst::SymbolTable;
-    using fst::VectorFst;
-    using fst::StdArc;
 
     const char *usage =
         "Get alignments of speech.\n"
         "\n"
         "Usage:  speech-aligner [options...] <wav-rspecifier> <transcriptions-rspecifier> <alignments-wspecifier>\n"
         "e.g.: \n"
-        " speech-aligner wav.scp 'ark:sym2int.pl -f 2- words.txt text|' ark:out.ali";
+        " speech-aligner wav.scp text ark:out.ali\n"
+        "The transcripts are looked up by utterance-id, so wav.scp may be any\n"
+        "subset of the text, in any order; utterances with no transcript are\n"
+        "skipped with a warning.  A plain filename is read as \"ark:<text>\"\n"
+        "(kept in memory); if the text and wav.scp are both sorted, give\n"
+        "\"ark,s,cs:<text>\" to read it as it is needed.\n"
+        "Whole utterances are aligned in parallel with --num-threads, or with\n"
+        "--pipeline=true the stages run concurrently, each with its own threads;\n"
+        "--schedule=longest-first dispatches long utterances first.  In every\n"
+        "case the output is written in the same order as the input.  With\n"
+        "--shard=i/N only the i'th of N duration-balanced shards is aligned,\n"
+        "and --resume=true carries on from the output of an interrupted run.\n"
+        "\n"
+        "Usage:  speech-aligner --server=true [--socket=<path>] [options...]\n"
+        "Loads the models once and serves requests, one per line:\n"
+        "  ALIGN <utt-id> <wav-filename> <transcript ...>   (a file on the server)\n"
+        "  ALIGN_BYTES <utt-id> <num-bytes> <transcript ...>   (then the wav file)\n"
+        "answered in order with \"OK <utt-id> <num-bytes>\" followed by the\n"
+        "alignment in the selected output format, or \"ERROR <utt-id> <message>\".\n"
+        "See also speech-aligner-client.";
 
     ParseOptions po(usage);
-    // feats
-    MfccOptions mfcc_opts;
-    bool subtract_mean = false;
-    BaseFloat vtln_warp = 1.0;
-    std::string vtln_map_rspecifier;
-    std::string utt2spk_rspecifier;
-    int32 channel = -1;
-    BaseFloat min_duration = 0.0;
-    mfcc_opts.Register(&po);
-    PitchExtractionOptions pitch_opts;
-    ProcessPitchOptions process_opts;
-    process_opts.Register(&po);
-    int32 length_tolerance = 0;
-    bool norm_vars = false;
-    bool norm_means = true;
-    DeltaFeaturesOptions delta_opts;
-
-    // graph
-    std::string tree_rxfilename;
-    std::string model_rxfilename;
-    std::string lex_rxfilename;
-    std::string lex_no_opt_sil_rxfilename;
-    std::string disambig_rxfilename;
-    std::string word_syms_filename;
-    TrainingGraphCompilerOptions gopts;
-    gopts.Register(&po);
-
-    // align
-    AlignConfig align_config;
-    BaseFloat acoustic_scale = 0.1;
-    BaseFloat transition_scale = 1.0;
-    BaseFloat self_loop_scale = 0.1;
-    BaseFloat boost_sil = 1.0;
-    align_config.Register(&po);
-    bool text_case_sensitive = false;
-    bool spell_en_oov = true;
-    bool opt_sil = true;
-    bool per_frame = false;
-    bool write_lengths = false;
-    bool ctm_output = false;
-    bool custom_output = true;
-    bool mlf_output = false;
-    BaseFloat frame_shift = 0.005;
-    std::string phone_syms_filename;
-
-
-    // Register the options
-    // feats
-    po.Register("subtract-mean", &subtract_mean, "Subtract mean of each "
-                                                 "feature file [CMS]; not recommended to do it this way. ");
-    po.Register("vtln-warp", &vtln_warp, "Vtln warp factor (only applicable "
-                                         "if vtln-map not specified)");
-    po.Register("vtln-map", &vtln_map_rspecifier, "Map from utterance or "
-                                                  "speaker-id to vtln warp factor (rspecifier)");
-    po.Register("utt2spk", &utt2spk_rspecifier, "Utterance to speaker-id map "
-                                                "rspecifier (if doing VTLN and you have warps per speaker)");
-    po.Register("channel", &channel, "Channel to extract (-1 -> expect mono, "
-                                     "0 -> left, 1 -> right)");
-    po.Register("min-duration", &min_duration, "Minimum duration of segments "
-                                               "to process (in seconds).");
-    po.Register("length-tolerance", &length_tolerance,
-                "If length is different, trim as shortest up to a frame "
-                " difference of length-tolerance, otherwise exclude segment.");
-    po.Register("norm-vars", &norm_vars, "If true, normalize variances.");
-    po.Register("norm-means", &norm_means, "You can set this to false to turn off mean "
-                                           "normalization.  Note, the same can be achieved by using 'fake' CMVN stats; "
-                                           "see the --fake option to compute_cmvn_stats.sh");
-
-    // graph
-    po.Register("tree-rxfilename", &tree_rxfilename, "tree");
-    po.Register("model-rxfilename", &model_rxfilename, "model");
-    po.Register("lex-rxfilename", &lex_rxfilename, "lexicon");
-    po.Register("lex-no-opt-sil-rxfilename", &lex_no_opt_sil_rxfilename, "lexicon without optional sil");
-    po.Register("read-disambig-syms", &disambig_rxfilename, "File containing "
-                                                            "list of disambiguation symbols in phone symbol table");
-    po.Register("word-symbol-table", &word_syms_filename,
-                "Symbol table for words");
-
-    // align
-    po.Register("acoustic-scale", &acoustic_scale,
-                "Scaling factor for acoustic likelihoods");
-    po.Register("boost-sil", &boost_sil, "Factor by which to boost silence probs");
-    po.Register("ctm-output", &ctm_output,
-                "If true, output the alignments in ctm format "
-                "(the confidences will be set to 1)");
-    po.Register("per-frame", &per_frame,
-                "If true, write out the frame-level phone alignment "
-                "(else phone sequence)");
-    po.Register("write-lengths", &write_lengths,
-                "If true, write the #frames for each phone (different format)");
-    po.Register("phone-symbol-table", &phone_syms_filename,
-                "Symbol table for phones");
-    po.Register("text-case-sensitive", &text_case_sensitive,
-                "If true, distinguish lower and upper words in text");
-    po.Register("spell-en-oov", &spell_en_oov,
-                "If true, for english oov words, make its pronouciation with each letters");
-    po.Register("opt-sil", &opt_sil,
-                "If true, use lexicon fst that with optional sil");
-    po.Register("custom-output", &custom_output,
-                "If true, output in the custom format");
-    po.Register("mlf-output", &mlf_output,
-                "If true, output in the custom format");
-
+    SpeechAlignerOptions opts;
+    TaskSequencerConfig sequencer_config;  // --num-threads, --num-threads-total
+    AlignPipelineOptions pipeline_opts;
+    AlignScheduleOptions schedule_opts;
+    AlignServerOptions server_opts;
+    AlignShardOptions shard_opts;
+    AlignProfilerOptions profiler_opts;
+    bool resume = false;
+    std::string trace_wxfilename;
+    opts.Register(&po);
+    sequencer_config.Register(&po);
+    pipeline_opts.Register(&po);
+    schedule_opts.Register(&po);
+    server_opts.Register(&po);
+    shard_opts.Register(&po);
+    profiler_opts.Register(&po);
+    po.Register("resume", &resume, "If true, keep the alignments already in "
+                "the output (which must be a file), e.g. from an interrupted "
+                "run, and align only the remaining utterances, appending "
+                "them; their audio is not read.  Utterances that failed are "
+                "tried again.");
+    po.Register("trace", &trace_wxfilename, "If set, record when each stage "
+                "of each utterance (down to the steps of the graph "
+                "compilation) ran on each thread, and write the timeline here "
+                "at the end as a Chrome trace-event JSON file, for "
+                "chrome://tracing or ui.perfetto.dev.");
 
     po.Read(argc, argv);
 
-    if (po.NumArgs() != 3) {
+    if (po.NumArgs() != (server_opts.server ? 0 : 3)) {
       po.PrintUsage();
       exit(1);
     }
 
+    if (server_opts.server) {
+      Aligner aligner(opts);
+      AlignmentFormatter formatter(opts, aligner.TransModel(),
+                                   aligner.PhoneSymbols());
+      AlignServer server(&aligner, formatter, sequencer_config, server_opts);
+      if (server_opts.socket.empty())
+        server.ServeStream(std::cin, std::cout);
+      else
+        server.ServeSocket(server_opts.socket);
+      return 0;
+    }
+
     // feats
     std::string wav_rspecifier = po.GetArg(1);
-    if (wav_rspecifier.substr(0, 3) != "scp:") {
+    if (ClassifyRspecifier(wav_rspecifier, NULL, NULL) == kNoRspecifier) {
+      // a plain wav.scp; "scp,bg:wav.scp" reads in a background thread.
       wav_rspecifier = "scp:" + wav_rspecifier;
     }
-    Mfcc mfcc(mfcc_opts);
-    pitch_opts.frame_shift_ms = mfcc_opts.frame_opts.frame_shift_ms;
-    SequentialTableReader<WaveHolder> wav_reader(wav_rspecifier);
-    BaseFloatMatrixWriter kaldi_writer;  // typedef to TableWriter<something>.
-    TableWriter<HtkMatrixHolder> htk_writer;
-    if (!utt2spk_rspecifier.empty())
-      KALDI_ASSERT(!vtln_map_rspecifier.empty() && "the utt2spk option is only "
-                                                "needed if the vtln-map option is used.");
-    RandomAccessBaseFloatReaderMapped vtln_map_reader(vtln_map_rspecifier,
-                                                      utt2spk_rspecifier);
-    if (norm_vars && !norm_means)
+    if (!opts.utt2spk_rspecifier.empty())
+      KALDI_ASSERT(!opts.vtln_map_rspecifier.empty() && "the utt2spk option is only "
+                                                     "needed if the vtln-map option is used.");
+    RandomAccessBaseFloatReaderMapped vtln_map_reader(opts.vtln_map_rspecifier,
+                                                      opts.utt2spk_rspecifier);
+    if (opts.norm_vars && !opts.norm_means)
       KALDI_ERR << "You cannot normalize the variance but not the mean.";
 
     // graph
-    std::string trans_file = po.GetArg(2);
-
-    ContextDependency ctx_dep;  // the tree.
-    ReadKaldiObject(tree_rxfilename, &ctx_dep);
-
-    TransitionModel trans_model;
-    ReadKaldiObject(model_rxfilename, &trans_model);
-
-    // need VectorFst because we will change it by adding subseq symbol.
-    VectorFst<StdArc> *lex_fst;
-    if (opt_sil) {
-      lex_fst = fst::ReadFstKaldi(lex_rxfilename);
-    } else {
-      lex_fst = fst::ReadFstKaldi(lex_no_opt_sil_rxfilename);
-    }
+    std::string transcript_rspecifier = po.GetArg(2);
+    if (ClassifyRspecifier(transcript_rspecifier, NULL, NULL) == kNoRspecifier)
+      transcript_rspecifier = "ark:" + transcript_rspecifier;
+    RandomAccessTokenVectorReader transcript_reader(transcript_rspecifier);
 
-    std::vector<int32> disambig_syms;
-    if (!disambig_rxfilename.empty())
-      if (!ReadIntegerVectorSimple(disambig_rxfilename, &disambig_syms))
-        KALDI_ERR << "fstcomposecontext: Could not read disambiguation symbols from "
-                  << disambig_rxfilename;
-
-    gopts.transition_scale = 0.0;  // Change the default to 0.0 since we will generally add the
-    // transition probs in the alignment phase (since they change eacm time)
-    gopts.self_loop_scale = 0.0;  // Ditto for self-loop probs.
-    TrainingGraphCompiler gc(trans_model, ctx_dep, lex_fst, disambig_syms, gopts);
-
-    lex_fst = nullptr;  // we gave ownership to gc.
-
-    std::ifstream trans_text(trans_file);
+    Aligner aligner(opts);
 
     // align
     std::string alignment_wspecifier = po.GetArg(3);
-    AmDiagGmm am_gmm;
-    {
-      bool binary;
-      Input ki(model_rxfilename, &binary);
-      trans_model.Read(ki.Stream(), binary);
-      am_gmm.Read(ki.Stream(), binary);
-    }
+    AlignmentFormatter formatter(opts, aligner.TransModel(),
+                                 aligner.PhoneSymbols());
+    AlignmentWriter writer(formatter, alignment_wspecifier, resume);
 
-    std::vector<int32> silence_phones = {1};
-    if (boost_sil != 1.0) { // Do the modification to the am_gmm object.
-      std::vector<int32> pdfs;
-      bool ans = GetPdfsForPhones(trans_model, silence_phones, &pdfs);
-      if (!ans) {
-        KALDI_WARN << "The pdfs for the silence phones may be shared by other phones "
-                   << "(note: this probably does not matter.)";
-      }
-      for (size_t i = 0; i < pdfs.size(); i++) {
-        int32 pdf = pdfs[i];
-        DiagGmm &gmm = am_gmm.GetPdf(pdf);
-        Vector<BaseFloat> weights(gmm.weights());
-        weights.Scale(boost_sil);
-        gmm.SetWeights(weights);
-        gmm.ComputeGconsts();
-      }
-      KALDI_LOG << "Boosted weights for " << pdfs.size()
-                << " pdfs, by factor of " << boost_sil;
+    OrderedAlignmentWriter ordered_writer(&writer);
+    std::unique_ptr<AlignProfiler> profiler;
+    if (profiler_opts.Enabled())
+      profiler.reset(new AlignProfiler());
+    if (!trace_wxfilename.empty()) {
+      TraceRecorder::Start();
+      TraceRecorder::SetThreadName("main");
     }
 
-    std::map<std::string, int32> word2id;
-    ReadWordSymbol(word_syms_filename, word2id);
+    int32 num_utts = 0;
+    int64 num_dispatched = 0;
+    AlignStats stats;
 
-    std::map<int32, std::string> id2phone;
-    ReadPhoneSymbol(phone_syms_filename, id2phone);
+    {
+      TaskSequencer<AlignUtteranceTask> sequencer(sequencer_config);
+      std::unique_ptr<AlignPipeline> pipeline;
+      if (pipeline_opts.pipeline)
+        pipeline.reset(new AlignPipeline(pipeline_opts, &aligner,
+                                         &ordered_writer, profiler.get()));
+      // "index" is the position of the utterance among those dispatched, in
+      // input order; the output is written in order of "index".
+      auto new_profile = [&](const std::string &utt) {
+        UtteranceProfile *profile = NULL;
+        if (profiler) {
+          profile = new UtteranceProfile();
+          profile->utt = utt;
+        }
+        return profile;
+      };
+      // "profile" is taken.
+      auto dispatch = [&](int64 index, const std::string &utt,
+                          const std::vector<std::string> &transcript,
+                          BaseFloat vtln_warp, WaveData *wave_data,
+                          UtteranceProfile *profile) {
+        if (pipeline)
+          pipeline->Accept(index, utt, transcript, wave_data, vtln_warp,
+                           profile);
+        else
+          sequencer.Run(new AlignUtteranceTask(&aligner, &ordered_writer,
+                                               index, utt, transcript,
+                                               wave_data, vtln_warp, &stats,
+                                               profile, profiler.get()));
+        num_dispatched++;
+        if (num_dispatched % 10 == 0)
+          KALDI_LOG << "Processed " << num_dispatched << " utterances";
+        KALDI_VLOG(2) << "Processed features for key " << utt;
+      };
 
-    std::string empty;
-    Int32VectorWriter phones_writer(custom_output || mlf_output || ctm_output ? empty :
-                                    (write_lengths ? empty : alignment_wspecifier));
-    Int32PairVectorWriter pair_writer(custom_output || mlf_output || ctm_output ? empty :
-                                      (write_lengths ? alignment_wspecifier : empty));
-    std::ofstream output(alignment_wspecifier);
+      int32 shard_index, num_shards;
+      bool sharded = shard_opts.Parse(&shard_index, &num_shards);
+      if (schedule_opts.schedule == "input" && !sharded && !resume) {
+        SequentialTableReader<WaveHolder> wav_reader(wav_rspecifier);
+        for (; !wav_reader.Done(); wav_reader.Next()) {
+          num_utts++;
+          std::string utt = wav_reader.Key();
+          KALDI_LOG << utt;
 
-    std::string ctm_wxfilename(ctm_output ? po.GetArg(3) : empty);
-    Output ctm_writer(ctm_wxfilename, false);
-    if (ctm_output) {
-      ctm_writer.Stream() << std::fixed;
-      ctm_writer.Stream().precision(frame_shift >= 0.01 ? 2 : 3);
-    }
-
-    int32 num_utts = 0, num_success = 0, num_err = 0, num_retry = 0;
-    double tot_like = 0.0;
-    kaldi::int64 frame_count = 0;
-    std::string line;
-
-    for (; !wav_reader.Done(); wav_reader.Next()) {
-      num_utts++;
-      std::string utt = wav_reader.Key();
-      KALDI_LOG << utt;
-
-      std::getline(trans_text, line);
-      KALDI_ASSERT(!line.empty() && "key of text files is not equal that of wav files");
-      std::vector<std::string> items;
-      std::istringstream iss(line);
-      for(std::string s; iss >> s; )
-        items.push_back(s);
-      KALDI_ASSERT(items.size() >= 2 && "transcript is empty");
-      KALDI_ASSERT(utt == items[0] && "wav and text key is not equal");
-      items.erase(items.begin());
-      std::vector<std::string> words;
-      std::vector<int32> word_ids;
-      SegWordFMM(word2id, items, words, word_ids, text_case_sensitive, spell_en_oov);
-
-      // feats
-      const WaveData &wave_data = wav_reader.Value();
-      if (wave_data.Duration() < min_duration) {
-        KALDI_WARN << "File: " << utt << " is too short ("
-                   << wave_data.Duration() << " sec): producing no output.";
-        num_err++;
-        continue;
-      }
-      int32 num_chan = wave_data.Data().NumRows(), this_chan = channel;
-      {  // This block works out the channel (0=left, 1=right...)
-        KALDI_ASSERT(num_chan > 0);  // should have been caught in
-        // reading code if no channels.
-        if (channel == -1) {
-          this_chan = 0;
-          if (num_chan != 1)
-            KALDI_WARN << "Channel not specified but you have data with "
-                       << num_chan << " channels; defaulting to zero";
-        } else {
-          if (this_chan >= num_chan) {
-            KALDI_WARN << "File with id " << utt << " has "
-                       << num_chan << " channels but you specified channel "
-                       << channel << ", producing no output.";
-            num_err++;
+          std::vector<std::string> transcript;
+          BaseFloat vtln_warp_local;
+          if (!GetTranscript(&transcript_reader, utt, &transcript) ||
+              !GetVtlnWarp(opts, &vtln_map_reader, utt, &vtln_warp_local)) {
+            stats.num_err++;
             continue;
           }
+          UtteranceProfile *profile = new_profile(utt);
+          WaveData *wave_data;
+          {
+            StageTimer timer(profile, kStageWavRead);
+            wave_data = &wav_reader.Value();
+          }
+          dispatch(num_dispatched, utt, transcript, vtln_warp_local, wave_data,
+                   profile);
         }
-      }
-      BaseFloat vtln_warp_local;  // Work out VTLN warp factor.
-      if (!vtln_map_rspecifier.empty()) {
-        if (!vtln_map_reader.HasKey(utt)) {
-          KALDI_WARN << "No vtln-map entry for utterance-id (or speaker-id) "
-                     << utt;
-          num_err++;
-          continue;
-        }
-        vtln_warp_local = vtln_map_reader.Value(utt);
       } else {
-        vtln_warp_local = vtln_warp;
-      }
-      SubVector<BaseFloat> waveform(wave_data.Data(), this_chan);
-      Matrix<BaseFloat> mfcc_feat;
-      /// mfcc
-      try {
-        mfcc.ComputeFeatures(waveform, wave_data.SampFreq(), vtln_warp_local, &mfcc_feat);
-      } catch (...) {
-        KALDI_WARN << "Failed to compute features for utterance "
-                   << utt;
-        num_err++;
-        continue;
-      }
-      if (subtract_mean) {
-        Vector<BaseFloat> mean(mfcc_feat.NumCols());
-        mean.AddRowSumMat(1.0, mfcc_feat);
-        mean.Scale(1.0f / mfcc_feat.NumRows());
-        for (int32 i = 0; i < mfcc_feat.NumRows(); i++)
-          mfcc_feat.Row(i).AddVec(-1.0f, mean);
-      }
-      /// pitch
-      if (pitch_opts.samp_freq != wave_data.SampFreq())
-        KALDI_ERR << "Sample frequency mismatch: you specified "
-                  << pitch_opts.samp_freq << " but data has "
-                  << wave_data.SampFreq() << " (use --sample-frequency "
-                  << "option).  Utterance is " << utt;
-      Matrix<BaseFloat> base_feats;
-      try {
-        Matrix<BaseFloat> pitch;
-        ComputeKaldiPitch(pitch_opts, waveform, &pitch);
-        Matrix<BaseFloat> processed_pitch(pitch);
-        ProcessPitch(process_opts, pitch, &processed_pitch);
-
-        std::vector<Matrix<BaseFloat> > feats(2);
-        feats[0] = mfcc_feat;
-        feats[1] = processed_pitch;
-        Matrix<BaseFloat> output;
-        if (!AppendFeats(feats, utt, length_tolerance, &base_feats)) {
-          KALDI_WARN << "Failed to combine mfcc and pitch for utterance "
-                     << utt;
-          num_err++;
-          continue; // it will have printed a warning.
+        // Scan the wav headers (no samples are read) to get the durations,
+        // keep this shard's utterances (if --shard) that are not yet aligned
+        // (if --resume), then dispatch in the order chosen by --schedule.
+        std::vector<ScheduledUtterance> utts;
+        SequentialTableReader<WaveInfoHolder> info_reader(wav_rspecifier);
+        for (; !info_reader.Done(); info_reader.Next()) {
+          ScheduledUtterance u;
+          u.utt = info_reader.Key();
+          const WaveInfo &info = info_reader.Value();
+          u.duration = (info.IsStreamed() ? -1.0 : info.Duration());
+          utts.push_back(u);
         }
-      } catch (...) {
-        KALDI_WARN << "Failed to compute pitch for utterance "
-                   << utt;
-        num_err++;
-        continue;
-      }
-      Matrix<double> cmvn_stats;
-      Matrix<BaseFloat> features;
-      InitCmvnStats(base_feats.NumCols(), &cmvn_stats);
-      AccCmvnStats(base_feats, nullptr, &cmvn_stats);
-      ApplyCmvn(cmvn_stats, norm_vars, &base_feats);
-      ComputeDeltas(delta_opts, base_feats, &features);
-
-      //graph, decode_fst
-      VectorFst<StdArc> decode_fst;
-      if (!gc.CompileGraphFromText(word_ids, &decode_fst)) {
-        decode_fst.DeleteStates();  // Just make it empty.
-      }
-      if (decode_fst.Start() == fst::kNoStateId) {
-        KALDI_WARN << "Empty decoding graph for utterance "
-                   << utt;
-        num_err++;
-        continue;
-      }
-      KALDI_VLOG(2) << "compile-train-graphs: succeeded for " << num_success
-                    << " graphs, failed for " << num_err;
-
-      // align,
-      if (features.NumRows() == 0) {
-        KALDI_WARN << "Zero-length utterance: " << utt;
-        num_err++;
-        continue;
-      }
-      {  // Add transition-probs to the FST.
-        std::vector<int32> disambig_syms_empty;  // empty.
-        AddTransitionProbs(trans_model, disambig_syms_empty,
-                           transition_scale, self_loop_scale,
-                           &decode_fst);
-      }
-      DecodableAmDiagGmmScaled gmm_decodable(am_gmm, trans_model, features,
-                                             acoustic_scale);
-      std::vector<int32> alignment;
-      Vector<BaseFloat> per_frame_acwt;
-      BaseFloat score;
-      AlignOneUtteranceWrapper(align_config, utt,
-                               acoustic_scale, &decode_fst, &gmm_decodable,
-                               alignment, &score,
-                               &num_success, &num_err, &num_retry,
-                               &tot_like, &frame_count, &per_frame_acwt);
-
-      if (!alignment.empty()) {
-        std::vector<std::vector<int32> > split;
-        SplitToPhones(trans_model, alignment, &split);
-
-        if (custom_output) {
-          float st = 0.0, et = 0.0;
-          output << utt << std::endl;
-          for (size_t i = 0; i < split.size(); i++) {
-            KALDI_ASSERT(!split[i].empty());
-            int32 phone_id = trans_model.TransitionIdToPhone(split[i][0]);
-            std::string phone = id2phone[phone_id];
-            int32 num_repeats = split[i].size();
-            //KALDI_ASSERT(num_repeats!=0);
-            st = et;
-            et += num_repeats * frame_shift;
-            output << std::fixed << std::setprecision(3) << st << " " << et << " " << phone << std::endl;
-          }
-          output << "." << std::endl;
-        } else if (mlf_output) {
-          int st = 0, et = 0;
-          if (num_utts == 1) {
-            output << "#!MLF!#" << std::endl;
-          }
-          output << "\"*/" << utt << ".lab\"" << std::endl;
-          for (size_t i = 0; i < split.size(); i++) {
-            KALDI_ASSERT(!split[i].empty());
-            int32 phone_id = trans_model.TransitionIdToPhone(split[i][0]);
-            std::string phone = id2phone[phone_id];
-            int32 num_pdf_class_frames = 0;
-            int32 last_pdf_class = -1;
-            for (size_t j = 0; j < split[i].size(); ++j) {
-              int32 trans_id = split[i][j];
-              int32 cur_pdf_class = trans_model.TransitionIdToPdfClass(trans_id);
-              if (last_pdf_class != cur_pdf_class) {
-                if (num_pdf_class_frames > 0) {
-                  et += num_pdf_class_frames * round(frame_shift * 1e3) * 1e4;
-                  output << st << " " << et << " s" << last_pdf_class + 2;
-                  if (last_pdf_class == 0) {
-                    output << " " << phone << std::endl;
-                  } else {
-                    output << std::endl;
-                  }
-                  st = et;
-                  num_pdf_class_frames = 0;
-                }
-                last_pdf_class = cur_pdf_class;
-              }
-              ++num_pdf_class_frames;
-            }
-            et += num_pdf_class_frames * round(frame_shift * 1e3) * 1e4;
-            output << st << " " << et << " s" << last_pdf_class + 2 << std::endl;
-            st = et;
-          }
-          output << "." << std::endl;
-        } else if (ctm_output) {
-          BaseFloat phone_start = 0.0;
-          for (size_t i = 0; i < split.size(); i++) {
-            KALDI_ASSERT(!split[i].empty());
-            int32 phone = trans_model.TransitionIdToPhone(split[i][0]);
-            int32 num_repeats = split[i].size();
-            ctm_writer.Stream() << utt << " 1 " << phone_start << " "
-                                << (frame_shift * num_repeats) << " " << phone << std::endl;
-            phone_start += frame_shift * num_repeats;
-          }
-        } else if (!write_lengths) {
-          std::vector<int32> phones;
-          for (size_t i = 0; i < split.size(); i++) {
-            KALDI_ASSERT(!split[i].empty());
-            int32 phone = trans_model.TransitionIdToPhone(split[i][0]);
-            int32 num_repeats = split[i].size();
-            //KALDI_ASSERT(num_repeats!=0);
-            if (per_frame)
-              for(int32 j = 0; j < num_repeats; j++)
-                phones.push_back(phone);
-            else
-              phones.push_back(phone);
+        if (sharded)
+          ShardUtterances(shard_index, num_shards, &utts);
+        if (resume) {
+          size_t num_left = 0;
+          for (size_t i = 0; i < utts.size(); i++)
+            if (writer.Completed().count(utts[i].utt) == 0)
+              utts[num_left++] = utts[i];
+          KALDI_LOG << "Skipping " << (utts.size() - num_left)
+                    << " utterances that are already aligned.";
+          utts.resize(num_left);
+        }
+        num_utts = utts.size();
+        size_t num_kept = 0;
+        for (size_t i = 0; i < utts.size(); i++) {
+          ScheduledUtterance &u = utts[i];
+          if (!GetTranscript(&transcript_reader, u.utt, &u.transcript) ||
+              !GetVtlnWarp(opts, &vtln_map_reader, u.utt, &u.vtln_warp)) {
+            stats.num_err++;
+            continue;
           }
-          phones_writer.Write(utt, phones);
-        } else {
-          std::vector<std::pair<int32, int32> > pairs;
-          for (size_t i = 0; i < split.size(); i++) {
-            KALDI_ASSERT(!split[i].empty());
-            int32 phone = trans_model.TransitionIdToPhone(split[i][0]);
-            int32 num_repeats = split[i].size();
-            //KALDI_ASSERT(num_repeats!=0);
-            pairs.push_back(std::make_pair(phone, num_repeats));
+          u.index = num_kept;
+          utts[num_kept++] = u;
+        }
+        utts.resize(num_kept);
+        if (schedule_opts.schedule != "input")
+          ScheduleUtterances(schedule_opts, &utts);
+        KALDI_LOG << "Scheduled " << utts.size() << " utterances ("
+                  << schedule_opts.schedule << ")";
+
+        RandomAccessTableReader<WaveHolder> wav_reader(wav_rspecifier);
+        for (size_t i = 0; i < utts.size(); i++) {
+          ScheduledUtterance &u = utts[i];
+          KALDI_LOG << u.utt;
+          UtteranceProfile *profile = new_profile(u.utt);
+          WaveData wave_data;
+          {
+            StageTimer timer(profile, kStageWavRead);
+            const WaveData &value = wav_reader.Value(u.utt);
+            WaveData copy(value.SampFreq(), value.Data());
+            wave_data.Swap(&copy);
           }
-          pair_writer.Write(utt, pairs);
+          dispatch(u.index, u.utt, u.transcript, u.vtln_warp, &wave_data,
+                   profile);
+          std::vector<std::string>().swap(u.transcript);
         }
       }
-
-      if (num_utts % 10 == 0)
-        KALDI_LOG << "Processed " << num_utts << " utterances";
-      KALDI_VLOG(2) << "Processed features for key " << utt;
+      sequencer.Wait();
+      if (pipeline) {
+        pipeline->Finish();
+        stats.Add(pipeline->Stats());
+      }
     }
 
-    trans_text.close();
-    output.close();
-    KALDI_LOG << " Done " << num_success << " out of " << num_utts
+    writer.Close();
+    if (profiler)
+      profiler->WriteReports(profiler_opts);
+    if (!trace_wxfilename.empty())
+      TraceRecorder::WriteJson(trace_wxfilename);
+    KALDI_LOG << " Done " << stats.num_success << " out of " << num_utts
               << " utterances.";
-    return (num_success != 0 ? 0 : 1);
+    return (stats.num_success != 0 || (resume && num_utts == 0) ? 0 : 1);
   } catch(const std::exception &e) {
     std::cerr << e.what();
     return -1;
   }
 }
-
@@ -0,0 +1,358 @@
+// decoder/banded-viterbi-decoder.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <limits>
+
+#include "decoder/banded-viterbi-decoder.h"
+#include "fstext/remove-eps-local.h"
+
+namespace kaldi {
+
+BandedViterbiDecoder::BandedViterbiDecoder(const fst::Fst<fst::StdArc> &fst,
+                                           const FasterDecoderOptions &config):
+    config_(config), supported_(false), reached_final_(false),
+    has_best_path_(false), peak_num_toks_(0), best_final_(0.0) {
+  PrepareGraph(fst);
+}
+
+void BandedViterbiDecoder::PrepareGraph(const fst::Fst<fst::StdArc> &fst) {
+  StateId start = fst.Start();
+  if (start == fst::kNoStateId)
+    return;
+  StateId num_states = 0;
+  for (fst::StateIterator<fst::Fst<Arc> > siter(fst); !siter.Done();
+       siter.Next())
+    num_states = std::max(num_states, siter.Value() + 1);
+
+  // Find the states reachable from the start, and count their incoming arcs
+  // other than self-loops.
+  std::vector<int32> in_degree(num_states, -1);  // -1 for not reachable.
+  std::vector<StateId> queue(1, start);
+  in_degree[start] = 0;
+  for (size_t i = 0; i < queue.size(); i++) {
+    StateId s = queue[i];
+    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.nextstate == s) {
+        if (arc.ilabel == 0)
+          return;  // an epsilon self-loop.
+        continue;
+      }
+      if (in_degree[arc.nextstate] == -1) {
+        in_degree[arc.nextstate] = 0;
+        queue.push_back(arc.nextstate);
+      }
+      in_degree[arc.nextstate]++;
+    }
+  }
+  // Kahn's algorithm, breadth-first, so that parallel branches interleave
+  // and the band stays narrow.
+  std::vector<int32> new_id(num_states, -1);
+  std::vector<StateId> order;
+  order.reserve(queue.size());
+  order.push_back(start);
+  for (size_t i = 0; i < order.size(); i++) {
+    StateId s = order[i];
+    new_id[s] = i;
+    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst, s); !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.nextstate != s && --in_degree[arc.nextstate] == 0)
+        order.push_back(arc.nextstate);
+    }
+  }
+  if (order.size() != queue.size())
+    return;  // there is a cycle.
+
+  int32 n = order.size();
+  std::vector<int32> num_emitting(n, 0), num_eps(n, 0);
+  Label max_label = 0;
+  final_.resize(n);
+  for (int32 i = 0; i < n; i++) {
+    final_[i] = fst.Final(order[i]).Value();
+    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst, order[i]); !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      if (arc.ilabel == 0)
+        num_eps[new_id[arc.nextstate]]++;
+      else
+        num_emitting[new_id[arc.nextstate]]++;
+      max_label = std::max(max_label, arc.ilabel);
+    }
+  }
+  in_begin_.resize(n + 1);
+  eps_begin_.resize(n);
+  in_begin_[0] = 0;
+  for (int32 i = 0; i < n; i++) {
+    eps_begin_[i] = in_begin_[i] + num_emitting[i];
+    in_begin_[i + 1] = eps_begin_[i] + num_eps[i];
+  }
+  int32 num_arcs = in_begin_[n];
+  in_src_.resize(num_arcs);
+  in_ilabel_.resize(num_arcs);
+  in_olabel_.resize(num_arcs);
+  in_weight_.resize(num_arcs);
+  std::vector<int32> next_emitting(in_begin_.begin(), in_begin_.end() - 1),
+      next_eps(eps_begin_);
+  for (int32 i = 0; i < n; i++) {
+    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst, order[i]); !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      int32 d = new_id[arc.nextstate],
+          a = (arc.ilabel == 0 ? next_eps[d]++ : next_emitting[d]++);
+      in_src_[a] = i;
+      in_ilabel_[a] = arc.ilabel;
+      in_olabel_[a] = arc.olabel;
+      in_weight_[a] = arc.weight.Value();
+    }
+  }
+
+  // Each state's successors come later, so going backwards sees them first.
+  const int32 kUnreachable = std::numeric_limits<int32>::max() / 2;
+  const BaseFloat kNotFinal = std::numeric_limits<BaseFloat>::infinity();
+  frames_to_final_.resize(n);
+  eps_reach_.resize(n);
+  reach_.resize(n);
+  for (int32 i = 0; i < n; i++) {
+    frames_to_final_[i] = (final_[i] != kNotFinal ? 0 : kUnreachable);
+    eps_reach_[i] = reach_[i] = i;
+  }
+  for (int32 d = n - 1; d >= 0; d--) {
+    for (int32 a = in_begin_[d]; a < in_begin_[d + 1]; a++) {
+      int32 s = in_src_[a];
+      if (s == d)
+        continue;
+      bool emitting = (a < eps_begin_[d]);
+      frames_to_final_[s] = std::min(frames_to_final_[s],
+                                     frames_to_final_[d] + (emitting ? 1 : 0));
+      if (!emitting)
+        eps_reach_[s] = std::max(eps_reach_[s], eps_reach_[d]);
+    }
+  }
+  for (int32 d = 0; d < n; d++)
+    for (int32 a = in_begin_[d]; a < eps_begin_[d]; a++)
+      reach_[in_src_[a]] = std::max(reach_[in_src_[a]], eps_reach_[d]);
+
+  ac_cost_.resize(max_label + 1);
+  ac_frame_.resize(max_label + 1);
+  supported_ = true;
+}
+
+int32 BandedViterbiDecoder::Prune(int32 num_frames_left, double *cost,
+                                  int32 *lo, int32 *hi) {
+  const double infinity = std::numeric_limits<double>::infinity();
+  double best_cost = infinity;
+  int32 count = 0;
+  for (int32 s = *lo; s <= *hi; s++) {
+    if (frames_to_final_[s] > num_frames_left)
+      cost[s] = infinity;  // too few frames left to finish from here.
+    if (cost[s] != infinity)
+      count++;
+    best_cost = std::min(best_cost, cost[s]);
+  }
+  if (count == 0)
+    return 0;
+  double cutoff = best_cost + config_.beam;
+  if (count > config_.min_active) {
+    int32 num_in_beam = 0;
+    for (int32 s = *lo; s <= *hi; s++)
+      num_in_beam += (cost[s] < cutoff);
+    if (num_in_beam < config_.min_active) {  // widen the beam.
+      tmp_costs_.clear();
+      for (int32 s = *lo; s <= *hi; s++)
+        if (cost[s] != infinity)
+          tmp_costs_.push_back(cost[s]);
+      std::nth_element(tmp_costs_.begin(),
+                       tmp_costs_.begin() + config_.min_active,
+                       tmp_costs_.end());
+      cutoff = tmp_costs_[config_.min_active];
+    }
+  } else {
+    cutoff = infinity;  // keep them all, as FasterDecoder does.
+  }
+  int32 new_lo = *hi + 1, new_hi = *lo - 1;
+  count = 0;
+  for (int32 s = *lo; s <= *hi; s++) {
+    if (cost[s] < cutoff) {
+      new_lo = std::min(new_lo, s);
+      new_hi = s;
+      count++;
+    } else {
+      cost[s] = infinity;
+    }
+  }
+  *lo = new_lo;
+  *hi = new_hi;
+  return count;
+}
+
+void BandedViterbiDecoder::Decode(DecodableInterface *decodable) {
+  KALDI_ASSERT(supported_);
+  const double infinity = std::numeric_limits<double>::infinity();
+  int32 num_frames = decodable->NumFramesReady(), n = final_.size();
+  reached_final_ = false;
+  has_best_path_ = false;
+  peak_num_toks_ = 0;
+  best_path_.clear();
+  std::fill(ac_frame_.begin(), ac_frame_.end(), -1);
+  band_lo_.resize(num_frames + 1);
+  band_size_.resize(num_frames + 1);
+  back_begin_.resize(num_frames + 1);
+  back_.clear();
+
+  // Costs of the frame being computed and of the previous one; outside
+  // their bands they are infinity.
+  std::vector<double> cur_cost(n, infinity), prev_cost(n, infinity);
+  int32 lo = 0, hi = eps_reach_[0],  // the band of the current frame,
+      prev_lo = 0, prev_hi = -1;     // and the survivors of the previous.
+  int32 t;
+  for (t = 0; t <= num_frames; t++) {
+    band_lo_[t] = lo;
+    band_size_[t] = hi - lo + 1;
+    back_begin_[t] = back_.size();
+    back_.resize(back_.size() + band_size_[t], -1);
+    int32 *back = &(back_[back_begin_[t]]);
+    double *cost = &(cur_cost[0]), *prev = &(prev_cost[0]);
+    if (t == 0)
+      cost[0] = 0.0;
+    for (int32 s = lo; s <= hi; s++) {
+      double best = cost[s];
+      int32 best_arc = -1;
+      if (t > 0) {
+        for (int32 a = in_begin_[s]; a < eps_begin_[s]; a++) {
+          double c = prev[in_src_[a]];
+          if (c == infinity)
+            continue;
+          Label label = in_ilabel_[a];
+          if (ac_frame_[label] != t - 1) {
+            ac_cost_[label] = -decodable->LogLikelihood(t - 1, label);
+            ac_frame_[label] = t - 1;
+          }
+          c += in_weight_[a] + ac_cost_[label];
+          if (c < best) {
+            best = c;
+            best_arc = a;
+          }
+        }
+      }
+      // Epsilon arcs come from earlier states, which are done for frame t.
+      for (int32 a = eps_begin_[s]; a < in_begin_[s + 1]; a++) {
+        double c = cost[in_src_[a]] + in_weight_[a];
+        if (c < best) {
+          best = c;
+          best_arc = a;
+        }
+      }
+      cost[s] = best;
+      back[s - lo] = best_arc;
+    }
+
+    int32 count = Prune(num_frames - t, cost, &lo, &hi);
+    peak_num_toks_ = std::max<size_t>(peak_num_toks_, count);
+    if (count == 0 || t == num_frames)
+      break;
+    // Next frame: clear the previous one, whose array it reuses, and find
+    // the new band.
+    for (int32 s = prev_lo; s <= prev_hi; s++)
+      prev[s] = infinity;
+    prev_lo = lo;
+    prev_hi = hi;
+    int32 new_hi = hi;
+    for (int32 s = lo; s <= hi; s++)
+      if (cost[s] != infinity)
+        new_hi = std::max(new_hi, reach_[s]);
+    hi = new_hi;
+    cur_cost.swap(prev_cost);
+  }
+  if (t < num_frames || lo > hi)
+    return;  // nothing survived.
+
+  const double *cost = &(cur_cost[0]);
+  int32 best_state = -1;
+  double best_cost = infinity;
+  for (int32 s = lo; s <= hi; s++) {
+    if (cost[s] != infinity && final_[s] != infinity &&
+        cost[s] + final_[s] < best_cost) {
+      best_cost = cost[s] + final_[s];
+      best_state = s;
+    }
+  }
+  reached_final_ = (best_state != -1);
+  if (!reached_final_) {
+    for (int32 s = lo; s <= hi; s++) {
+      if (cost[s] < best_cost) {
+        best_cost = cost[s];
+        best_state = s;
+      }
+    }
+  }
+  if (best_state != -1)
+    TraceBack(decodable, best_state);
+}
+
+void BandedViterbiDecoder::TraceBack(DecodableInterface *decodable,
+                                     int32 state) {
+  best_final_ = (reached_final_ ? final_[state] : 0.0);
+  int32 t = band_lo_.size() - 1;
+  while (true) {
+    KALDI_ASSERT(state >= band_lo_[t] &&
+                 state < band_lo_[t] + band_size_[t]);
+    int32 a = back_[back_begin_[t] + state - band_lo_[t]];
+    if (a == -1) {
+      KALDI_ASSERT(t == 0 && state == 0);
+      break;
+    }
+    BaseFloat ac_cost = 0.0;
+    if (in_ilabel_[a] != 0) {
+      t--;
+      ac_cost = -decodable->LogLikelihood(t, in_ilabel_[a]);
+    }
+    best_path_.push_back(LatticeArc(in_ilabel_[a], in_olabel_[a],
+                                    LatticeWeight(in_weight_[a], ac_cost),
+                                    fst::kNoStateId));
+    state = in_src_[a];
+  }
+  std::reverse(best_path_.begin(), best_path_.end());
+  has_best_path_ = true;
+}
+
+bool BandedViterbiDecoder::GetBestPath(
+    fst::MutableFst<LatticeArc> *fst_out) const {
+  fst_out->DeleteStates();
+  if (!has_best_path_)
+    return false;
+  StateId cur_state = fst_out->AddState();
+  fst_out->SetStart(cur_state);
+  for (size_t i = 0; i < best_path_.size(); i++) {
+    LatticeArc arc = best_path_[i];
+    arc.nextstate = fst_out->AddState();
+    fst_out->AddArc(cur_state, arc);
+    cur_state = arc.nextstate;
+  }
+  if (reached_final_)
+    fst_out->SetFinal(cur_state, LatticeWeight(best_final_, 0.0));
+  else
+    fst_out->SetFinal(cur_state, LatticeWeight::One());
+  RemoveEpsLocal(fst_out);
+  return true;
+}
+
+}  // namespace kaldi
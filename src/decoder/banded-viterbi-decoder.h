@@ -0,0 +1,141 @@
+// decoder/banded-viterbi-decoder.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_BANDED_VITERBI_DECODER_H_
+#define KALDI_DECODER_BANDED_VITERBI_DECODER_H_ 1
+
+#include <vector>
+
+#include "decoder/faster-decoder.h"
+#include "fst/fstlib.h"
+#include "itf/decodable-itf.h"
+#include "lat/kaldi-lattice.h"
+
+namespace kaldi {
+
+/// BandedViterbiDecoder is a replacement for FasterDecoder on forced-alignment
+/// graphs, which apart from self-loops are acyclic and nearly linear: a chain
+/// of HMM states with a few branches for optional silence and alternative
+/// pronunciations.  The states are numbered in topological order and their
+/// incoming arcs stored in flat arrays; each frame then updates a contiguous
+/// band of states, from the first one still within the beam to the last one
+/// reachable from the band, reading the previous frame's costs from a dense
+/// array.  There is no hash, no token allocation and no reference counting;
+/// the traceback is one arc index per (frame, state) of the band.
+///
+/// The pruning is FasterDecoder's: after each frame, states whose cost is
+/// more than "beam" (widened to keep "min_active" states) worse than the best
+/// are dropped, so whether a decode reaches a final state, and thus the
+/// --retry-beam logic, are as with FasterDecoder.  States that can no longer
+/// reach a final state in the frames that are left are dropped too.
+/// max_active, beam_delta and hash_ratio do not apply.
+///
+/// Graphs with other cycles, or with epsilon self-loops, are not handled;
+/// check GraphIsSupported().  (The graphs of "careful" alignment are fine:
+/// ModifyGraphForCarefulAlignment() concatenates two copies.)
+class BandedViterbiDecoder {
+ public:
+  typedef fst::StdArc Arc;
+  typedef Arc::Label Label;
+  typedef Arc::StateId StateId;
+
+  /// Prepares the arc arrays for "fst", which is not needed afterwards.
+  BandedViterbiDecoder(const fst::Fst<fst::StdArc> &fst,
+                       const FasterDecoderOptions &config);
+
+  /// False if "fst" has cycles other than self-loops, or no start state;
+  /// Decode() must not be called then.
+  bool GraphIsSupported() const { return supported_; }
+
+  void SetOptions(const FasterDecoderOptions &config) { config_ = config; }
+
+  /// Decodes all the frames of "decodable", and gets the traceback while
+  /// "decodable" is still at hand.
+  void Decode(DecodableInterface *decodable);
+
+  /// Returns true if a final state was active on the last frame.
+  bool ReachedFinal() const { return reached_final_; }
+
+  /// Outputs the best path as a linear lattice with graph and acoustic
+  /// costs, like FasterDecoder::GetBestPath(): through a final state if one
+  /// was reached, otherwise the best state ignoring final-probs.  Returns
+  /// false if no state survived.
+  bool GetBestPath(fst::MutableFst<LatticeArc> *fst_out) const;
+
+  /// Returns the largest number of states that were active on a frame in the
+  /// last Decode().
+  size_t PeakNumTokens() const { return peak_num_toks_; }
+
+ private:
+  // Numbers the states topologically, fills the arc arrays and the
+  // distances to a final state; sets supported_.
+  void PrepareGraph(const fst::Fst<fst::StdArc> &fst);
+
+  // Prunes states lo..hi of "cost" as FasterDecoder::GetCutoff() would, and
+  // narrows [*lo, *hi] to the survivors; returns their number.
+  int32 Prune(int32 num_frames_left, double *cost, int32 *lo, int32 *hi);
+
+  // Follows the backpointers from "state" at the last frame.
+  void TraceBack(DecodableInterface *decodable, int32 state);
+
+  FasterDecoderOptions config_;
+  bool supported_;
+
+  // Per state, in topological order (the start state is 0): its incoming
+  // arcs are in_begin_[s] .. in_begin_[s+1]-1 of the in_* arrays, emitting
+  // ones (including self-loops) first, then epsilon ones from eps_begin_[s].
+  std::vector<int32> in_begin_;
+  std::vector<int32> eps_begin_;
+  std::vector<int32> in_src_;
+  std::vector<Label> in_ilabel_;
+  std::vector<Label> in_olabel_;
+  std::vector<BaseFloat> in_weight_;
+  std::vector<BaseFloat> final_;
+  // Fewest frames from each state to a final state.
+  std::vector<int32> frames_to_final_;
+  // Highest state that one frame can take each state to (an emitting arc,
+  // then any epsilon arcs).
+  std::vector<int32> reach_;
+  // Highest state the epsilon arcs can take each state to, itself included.
+  std::vector<int32> eps_reach_;
+
+  // Traceback: on frame t (0 being before any frame is consumed), states
+  // band_lo_[t] .. band_lo_[t] + band_size_[t] - 1 have their best incoming
+  // arc at back_[back_begin_[t] + s - band_lo_[t]], or -1 for the start.
+  std::vector<int32> band_lo_;
+  std::vector<int32> band_size_;
+  std::vector<size_t> back_begin_;
+  std::vector<int32> back_;
+
+  std::vector<double> tmp_costs_;  // for min_active, in Prune().
+  std::vector<BaseFloat> ac_cost_;  // per label, for the current frame,
+  std::vector<int32> ac_frame_;     // and the frame it was computed for.
+
+  bool reached_final_;
+  bool has_best_path_;
+  size_t peak_num_toks_;
+  std::vector<LatticeArc> best_path_;  // in order, nextstate unset.
+  BaseFloat best_final_;               // final cost of the best path.
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(BandedViterbiDecoder);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_DECODER_BANDED_VITERBI_DECODER_H_
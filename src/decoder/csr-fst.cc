@@ -0,0 +1,63 @@
+// decoder/csr-fst.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/csr-fst.h"
+
+namespace fst {
+
+void CsrFst::Init(const Fst<StdArc> &fst) {
+  start_ = fst.Start();
+  StateId num_states = CountStates(fst);
+  arc_begin_.resize(num_states + 1);
+  final_.resize(num_states);
+  num_input_eps_.resize(num_states);
+  self_loop_.resize(num_states);
+  size_t num_arcs = 0;
+  for (StateId s = 0; s < num_states; s++)
+    num_arcs += fst.NumArcs(s);
+  KALDI_ASSERT(num_arcs <= static_cast<size_t>(
+      std::numeric_limits<int32>::max()));
+  ilabel_.resize(num_arcs);
+  olabel_.resize(num_arcs);
+  weight_.resize(num_arcs);
+  nextstate_.resize(num_arcs);
+
+  int32 i = 0;
+  for (StateId s = 0; s < num_states; s++) {
+    arc_begin_[s] = i;
+    final_[s] = fst.Final(s).Value();
+    num_input_eps_[s] = 0;
+    self_loop_[s] = -1;
+    for (ArcIterator<Fst<StdArc> > aiter(fst, s); !aiter.Done();
+         aiter.Next(), i++) {
+      const StdArc &arc = aiter.Value();
+      ilabel_[i] = arc.ilabel;
+      olabel_[i] = arc.olabel;
+      weight_[i] = arc.weight.Value();
+      nextstate_[i] = arc.nextstate;
+      if (arc.ilabel == 0)
+        num_input_eps_[s]++;
+      if (arc.nextstate == s && self_loop_[s] == -1)
+        self_loop_[s] = i - arc_begin_[s];
+    }
+  }
+  arc_begin_[num_states] = i;
+}
+
+}  // namespace fst
@@ -0,0 +1,138 @@
+// decoder/csr-fst.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_DECODER_CSR_FST_H_
+#define KALDI_DECODER_CSR_FST_H_ 1
+
+#include <vector>
+
+#include "base/kaldi-common.h"
+#include "fst/fstlib.h"
+
+namespace fst {
+
+class CsrFst;
+template<> class ArcIterator<CsrFst>;
+
+/**
+   CsrFst is a decoding graph flattened into compressed-sparse-row form: the
+   arcs of all the states are in one run of arrays (input labels, output
+   labels, weights and next states, each contiguous), with the arcs of state s
+   at positions ArcBegin(s) .. ArcBegin(s+1)-1, in the order of the FST it was
+   made from.  Self-loops are marked, and the input-epsilon arcs of each state
+   counted, so decoders can skip states without them.
+
+   Like GrammarFst, it does not inherit from fst::Fst; it has just the parts of
+   its interface that decoders templated on the FST type use (Start(),
+   Final(), NumInputEpsilons() and ArcIterator), and those are inline and not
+   virtual.  Converting a graph is one pass over its arcs, which is cheap next
+   to decoding with it.
+ */
+class CsrFst {
+ public:
+  typedef StdArc Arc;
+  typedef Arc::Label Label;
+  typedef Arc::StateId StateId;
+  typedef Arc::Weight Weight;
+
+  CsrFst(): start_(kNoStateId) { }
+
+  /// Converts "fst", which is not needed afterwards.
+  explicit CsrFst(const Fst<StdArc> &fst) { Init(fst); }
+
+  void Init(const Fst<StdArc> &fst);
+
+  StateId Start() const { return start_; }
+  StateId NumStates() const { return final_.size(); }
+  size_t NumArcs() const { return ilabel_.size(); }
+
+  Weight Final(StateId s) const { return Weight(final_[s]); }
+
+  size_t NumArcs(StateId s) const { return arc_begin_[s + 1] - arc_begin_[s]; }
+  size_t NumInputEpsilons(StateId s) const { return num_input_eps_[s]; }
+
+  /// The position of the self-loop of "s" among its arcs, or -1 if it has
+  /// none (if it has several, the first).
+  int32 SelfLoop(StateId s) const { return self_loop_[s]; }
+
+ private:
+  friend class ArcIterator<CsrFst>;
+
+  StateId start_;
+  std::vector<int32> arc_begin_;  // NumStates() + 1 entries.
+  std::vector<Label> ilabel_;
+  std::vector<Label> olabel_;
+  std::vector<float> weight_;
+  std::vector<StateId> nextstate_;
+  std::vector<float> final_;
+  std::vector<int32> num_input_eps_;
+  std::vector<int32> self_loop_;
+};
+
+
+/**
+   ArcIterator for CsrFst.  As with ArcIterator<GrammarFst>, Done() puts the
+   arc together for Value(), as callers always call it before Value().
+ */
+template <>
+class ArcIterator<CsrFst> {
+ public:
+  typedef CsrFst::Arc Arc;
+  typedef CsrFst::StateId StateId;
+
+  inline ArcIterator(const CsrFst &fst, StateId s):
+      ilabel_(fst.ilabel_.data()), olabel_(fst.olabel_.data()),
+      weight_(fst.weight_.data()), nextstate_(fst.nextstate_.data()),
+      begin_(fst.arc_begin_[s]), end_(fst.arc_begin_[s + 1]), i_(begin_) { }
+
+  inline bool Done() {
+    if (i_ < end_) {
+      arc_.ilabel = ilabel_[i_];
+      arc_.olabel = olabel_[i_];
+      arc_.weight = Arc::Weight(weight_[i_]);
+      arc_.nextstate = nextstate_[i_];
+      return false;
+    }
+    return true;
+  }
+
+  inline void Next() { i_++; }
+
+  inline void Reset() { i_ = begin_; }
+
+  inline void Seek(size_t a) { i_ = begin_ + a; }
+
+  inline size_t Position() const { return i_ - begin_; }
+
+  inline const Arc &Value() const { return arc_; }
+
+ private:
+  const CsrFst::Label *ilabel_;
+  const CsrFst::Label *olabel_;
+  const float *weight_;
+  const StateId *nextstate_;
+  int32 begin_;
+  int32 end_;
+  int32 i_;
+  Arc arc_;
+};
+
+}  // namespace fst
+
+#endif  // KALDI_DECODER_CSR_FST_H_
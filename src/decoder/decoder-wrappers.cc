@@ -18,6 +18,8 @@
 // limitations under the License.
 
 #include "decoder/decoder-wrappers.h"
+#include "decoder/banded-viterbi-decoder.h"
+#include "decoder/csr-fst.h"
 #include "decoder/faster-decoder.h"
 #include "decoder/lattice-faster-decoder.h"
 #include "decoder/grammar-fst.h"
@@ -547,6 +549,38 @@ void AlignUtteranceWrapper(
 }
 
 
+// Decodes at config.beam and, if no final state is reached, again at
+// config.retry_beam; outputs the best path if a final state was reached.
+// "Decoder" is a FasterDecoderTpl or BandedViterbiDecoder.
+template <typename Decoder>
+static bool DecodeWithRetry(const AlignConfig &config, const std::string &utt,
+                            DecodableInterface *decodable, Decoder *decoder,
+                            fst::VectorFst<LatticeArc> *decoded,
+                            int32 *num_retried, int32 *peak_num_tokens) {
+  decoder->Decode(decodable);
+  if (peak_num_tokens != NULL)
+    *peak_num_tokens = decoder->PeakNumTokens();
+
+  bool ans = decoder->ReachedFinal();  // consider only final states.
+
+  if (!ans && config.retry_beam != 0.0) {
+    if (num_retried != NULL) (*num_retried)++;
+    KALDI_WARN << "Retrying utterance " << utt << " with beam "
+               << config.retry_beam;
+    FasterDecoderOptions decode_opts;
+    decode_opts.beam = config.retry_beam;
+    decoder->SetOptions(decode_opts);
+    decoder->Decode(decodable);
+    if (peak_num_tokens != NULL)
+      *peak_num_tokens = std::max<int32>(*peak_num_tokens,
+                                         decoder->PeakNumTokens());
+    ans = decoder->ReachedFinal();
+  }
+  if (ans)
+    decoder->GetBestPath(decoded);
+  return ans;
+}
+
 void AlignOneUtteranceWrapper(
     const AlignConfig &config,
     const std::string &utt,
@@ -562,7 +596,8 @@ void AlignOneUtteranceWrapper(
     int32 *num_retried,
     double *tot_like,
     int64 *frame_count,
-    Vector<BaseFloat> *per_frame_acwt) {
+    Vector<BaseFloat> *per_frame_acwt,
+    int32 *peak_num_tokens) {
 
   if ((config.retry_beam != 0 && config.retry_beam <= config.beam) ||
       config.beam <= 0.0) {
@@ -582,19 +617,28 @@ void AlignOneUtteranceWrapper(
   FasterDecoderOptions decode_opts;
   decode_opts.beam = config.beam;
 
-  FasterDecoder decoder(*fst, decode_opts);
-  decoder.Decode(decodable);
-
-  bool ans = decoder.ReachedFinal();  // consider only final states.
-
-  if (!ans && config.retry_beam != 0.0) {
-    if (num_retried != NULL) (*num_retried)++;
-    KALDI_WARN << "Retrying utterance " << utt << " with beam "
-               << config.retry_beam;
-    decode_opts.beam = config.retry_beam;
-    decoder.SetOptions(decode_opts);
-    decoder.Decode(decodable);
-    ans = decoder.ReachedFinal();
+  fst::VectorFst<LatticeArc> decoded;  // linear FST.
+  bool ans = false, done = false;
+  if (config.banded) {
+    BandedViterbiDecoder decoder(*fst, decode_opts);
+    if (decoder.GraphIsSupported()) {
+      ans = DecodeWithRetry(config, utt, decodable, &decoder, &decoded,
+                            num_retried, peak_num_tokens);
+      done = true;
+    } else {
+      KALDI_VLOG(2) << "Graph of " << utt << " has cycles; using "
+                    << "FasterDecoder.";
+    }
+  }
+  if (!done && config.flat_graph) {
+    fst::CsrFst flat_fst(*fst);
+    FasterDecoderTpl<fst::CsrFst> decoder(flat_fst, decode_opts);
+    ans = DecodeWithRetry(config, utt, decodable, &decoder, &decoded,
+                          num_retried, peak_num_tokens);
+  } else if (!done) {
+    FasterDecoder decoder(*fst, decode_opts);
+    ans = DecodeWithRetry(config, utt, decodable, &decoder, &decoded,
+                          num_retried, peak_num_tokens);
   }
 
   if (!ans) {  // Still did not reach final state.
@@ -604,8 +648,6 @@ void AlignOneUtteranceWrapper(
     return;
   }
 
-  fst::VectorFst<LatticeArc> decoded;  // linear FST.
-  decoder.GetBestPath(&decoded);
   if (decoded.NumStates() == 0) {
     KALDI_WARN << "Error getting best path from decoder (likely a bug)";
     if (num_error != NULL) (*num_error)++;
@@ -35,8 +35,11 @@ struct AlignConfig {
   BaseFloat beam;
   BaseFloat retry_beam;
   bool careful;
+  bool banded;
+  bool flat_graph;
 
-  AlignConfig(): beam(200.0), retry_beam(0.0), careful(false) { }
+  AlignConfig(): beam(200.0), retry_beam(0.0), careful(false), banded(true),
+                 flat_graph(true) { }
 
   void Register(OptionsItf *opts) {
     opts->Register("beam", &beam, "Decoding beam used in alignment");
@@ -45,6 +48,16 @@ struct AlignConfig {
     opts->Register("careful", &careful,
                    "If true, do 'careful' alignment, which is better at detecting "
                    "alignment failure (involves loop to start of decoding graph).");
+    opts->Register("banded-viterbi", &banded,
+                   "If true, align with BandedViterbiDecoder, which is faster "
+                   "on graphs that are acyclic apart from self-loops (as "
+                   "alignment graphs are); others still use FasterDecoder.  "
+                   "Only affects AlignOneUtteranceWrapper().");
+    opts->Register("flat-graph", &flat_graph,
+                   "If true, FasterDecoder decodes a flat copy of the graph "
+                   "(fst::CsrFst), with its arcs in contiguous arrays, rather "
+                   "than the graph itself.  Only affects "
+                   "AlignOneUtteranceWrapper().");
   }
 };
 
@@ -72,7 +85,13 @@ void AlignUtteranceWrapper(
     int64 *frame_count,
     BaseFloatVectorWriter *per_frame_acwt_writer = NULL);
 
-
+/// AlignOneUtteranceWrapper is AlignUtteranceWrapper for one utterance, which
+/// outputs the alignment and score instead of writing them.  If the decode at
+/// config.beam does not reach a final state, the whole utterance is decoded
+/// again from frame 0 at config.retry_beam, with the same "decodable"; so a
+/// decodable that only caches its latest frame computes every likelihood
+/// twice, and one that keeps all frames' scores (such as
+/// DecodableFlatAmDiagGmmPrecomputed) is better here.
 void AlignOneUtteranceWrapper(
     const AlignConfig &config,
     const std::string &utt,
@@ -88,7 +107,8 @@ void AlignOneUtteranceWrapper(
     int32 *num_retried,
     double *tot_like,
     int64 *frame_count,
-    Vector<BaseFloat> *per_frame_acwt = NULL);
+    Vector<BaseFloat> *per_frame_acwt = NULL,
+    int32 *peak_num_tokens = NULL);  // max over the (re)tries, if not NULL.
 
 
 
@@ -23,9 +23,10 @@
 namespace kaldi {
 
 
-FasterDecoder::FasterDecoder(const fst::Fst<fst::StdArc> &fst,
-                             const FasterDecoderOptions &opts):
-    fst_(fst), config_(opts), num_frames_decoded_(-1) {
+template <typename FST>
+FasterDecoderTpl<FST>::FasterDecoderTpl(const FST &fst,
+                                        const FasterDecoderOptions &opts):
+    fst_(fst), config_(opts), num_frames_decoded_(-1), peak_num_toks_(0) {
   KALDI_ASSERT(config_.hash_ratio >= 1.0);  // less doesn't make much sense.
   KALDI_ASSERT(config_.max_active > 1);
   KALDI_ASSERT(config_.min_active >= 0 && config_.min_active < config_.max_active);
@@ -33,19 +34,23 @@ FasterDecoder::FasterDecoder(const fst::Fst<fst::StdArc> &fst,
 }
 
 
-void FasterDecoder::InitDecoding() {
+template <typename FST>
+void FasterDecoderTpl<FST>::InitDecoding() {
   // clean up from last time:
   ClearToks(toks_.Clear());
   StateId start_state = fst_.Start();
   KALDI_ASSERT(start_state != fst::kNoStateId);
   Arc dummy_arc(0, 0, Weight::One(), start_state);
-  toks_.Insert(start_state, new Token(dummy_arc, NULL));
+  Token *no_prev = NULL;
+  toks_.Insert(start_state, token_pool_.New(dummy_arc, no_prev));
   ProcessNonemitting(std::numeric_limits<float>::max());
   num_frames_decoded_ = 0;
+  peak_num_toks_ = 0;
 }
 
 
-void FasterDecoder::Decode(DecodableInterface *decodable) {
+template <typename FST>
+void FasterDecoderTpl<FST>::Decode(DecodableInterface *decodable) {
   InitDecoding();
   while (!decodable->IsLastFrame(num_frames_decoded_ - 1)) {
     double weight_cutoff = ProcessEmitting(decodable);
@@ -53,8 +58,9 @@ void FasterDecoder::Decode(DecodableInterface *decodable) {
   }
 }
 
-void FasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
-                                      int32 max_num_frames) {
+template <typename FST>
+void FasterDecoderTpl<FST>::AdvanceDecoding(DecodableInterface *decodable,
+                                            int32 max_num_frames) {
   KALDI_ASSERT(num_frames_decoded_ >= 0 &&
                "You must call InitDecoding() before AdvanceDecoding()");
   int32 num_frames_ready = decodable->NumFramesReady();
@@ -75,7 +81,8 @@ void FasterDecoder::AdvanceDecoding(DecodableInterface *decodable,
 }
 
 
-bool FasterDecoder::ReachedFinal() {
+template <typename FST>
+bool FasterDecoderTpl<FST>::ReachedFinal() {
   for (const Elem *e = toks_.GetList(); e != NULL; e = e->tail) {
     if (e->val->cost_ != std::numeric_limits<double>::infinity() &&
         fst_.Final(e->key) != Weight::Zero())
@@ -84,8 +91,9 @@ bool FasterDecoder::ReachedFinal() {
   return false;
 }
 
-bool FasterDecoder::GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
-                                bool use_final_probs) {
+template <typename FST>
+bool FasterDecoderTpl<FST>::GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
+                                        bool use_final_probs) {
   // GetBestPath gets the decoding output.  If "use_final_probs" is true
   // AND we reached a final state, it limits itself to final states;
   // otherwise it gets the most likely token not taking into
@@ -148,8 +156,10 @@ bool FasterDecoder::GetBestPath(fst::MutableFst<LatticeArc> *fst_out,
 
 
 // Gets the weight cutoff.  Also counts the active tokens.
-double FasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
-                                BaseFloat *adaptive_beam, Elem **best_elem) {
+template <typename FST>
+double FasterDecoderTpl<FST>::GetCutoff(Elem *list_head, size_t *tok_count,
+                                        BaseFloat *adaptive_beam,
+                                        Elem **best_elem) {
   double best_cost = std::numeric_limits<double>::infinity();
   size_t count = 0;
   if (config_.max_active == std::numeric_limits<int32>::max() &&
@@ -212,7 +222,8 @@ double FasterDecoder::GetCutoff(Elem *list_head, size_t *tok_count,
   }
 }
 
-void FasterDecoder::PossiblyResizeHash(size_t num_toks) {
+template <typename FST>
+void FasterDecoderTpl<FST>::PossiblyResizeHash(size_t num_toks) {
   size_t new_sz = static_cast<size_t>(static_cast<BaseFloat>(num_toks)
                                       * config_.hash_ratio);
   if (new_sz > toks_.Size()) {
@@ -221,7 +232,8 @@ void FasterDecoder::PossiblyResizeHash(size_t num_toks) {
 }
 
 // ProcessEmitting returns the likelihood cutoff used.
-double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
+template <typename FST>
+double FasterDecoderTpl<FST>::ProcessEmitting(DecodableInterface *decodable) {
   int32 frame = num_frames_decoded_;
   Elem *last_toks = toks_.Clear();
   size_t tok_cnt;
@@ -230,6 +242,7 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   double weight_cutoff = GetCutoff(last_toks, &tok_cnt,
                                    &adaptive_beam, &best_elem);
   KALDI_VLOG(3) << tok_cnt << " tokens active.";
+  peak_num_toks_ = std::max(peak_num_toks_, tok_cnt);
   PossiblyResizeHash(tok_cnt);  // This makes sure the hash is always big enough.
     
   // This is the cutoff we use after adding in the log-likes (i.e.
@@ -242,7 +255,7 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
   if (best_elem) {
     StateId state = best_elem->key;
     Token *tok = best_elem->val;
-    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
+    for (fst::ArcIterator<FST> aiter(fst_, state);
          !aiter.Done();
          aiter.Next()) {
       const Arc &arc = aiter.Value();
@@ -268,7 +281,7 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
     if (tok->cost_ < weight_cutoff) {  // not pruned.
       // np++;
       KALDI_ASSERT(state == tok->arc_.nextstate);
-      for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
+      for (fst::ArcIterator<FST> aiter(fst_, state);
            !aiter.Done();
            aiter.Next()) {
         Arc arc = aiter.Value();
@@ -276,7 +289,7 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
           BaseFloat ac_cost =  - decodable->LogLikelihood(frame, arc.ilabel);
           double new_weight = arc.weight.Value() + tok->cost_ + ac_cost;
           if (new_weight < next_weight_cutoff) {  // not pruned..
-            Token *new_tok = new Token(arc, ac_cost, tok);
+            Token *new_tok = token_pool_.New(arc, ac_cost, tok);
             Elem *e_found = toks_.Find(arc.nextstate);
             if (new_weight + adaptive_beam < next_weight_cutoff)
               next_weight_cutoff = new_weight + adaptive_beam;
@@ -284,10 +297,10 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
               toks_.Insert(arc.nextstate, new_tok);
             } else {
               if ( *(e_found->val) < *new_tok ) {
-                Token::TokenDelete(e_found->val);
+                TokenDelete(e_found->val);
                 e_found->val = new_tok;
               } else {
-                Token::TokenDelete(new_tok);
+                TokenDelete(new_tok);
               }
             }
           }
@@ -295,7 +308,7 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
       }
     }
     e_tail = e->tail;
-    Token::TokenDelete(e->val);
+    TokenDelete(e->val);
     toks_.Delete(e);
   }
   num_frames_decoded_++;
@@ -303,7 +316,8 @@ double FasterDecoder::ProcessEmitting(DecodableInterface *decodable) {
 }
 
 // TODO: first time we go through this, could avoid using the queue.
-void FasterDecoder::ProcessNonemitting(double cutoff) {
+template <typename FST>
+void FasterDecoderTpl<FST>::ProcessNonemitting(double cutoff) {
   // Processes nonemitting arcs for one frame. 
   KALDI_ASSERT(queue_.empty());
   for (const Elem *e = toks_.GetList(); e != NULL;  e = e->tail)
@@ -316,15 +330,17 @@ void FasterDecoder::ProcessNonemitting(double cutoff) {
     if (tok->cost_ > cutoff) { // Don't bother processing successors.
       continue;
     }
+    if (fst_.NumInputEpsilons(state) == 0)  // most states of HMM graphs.
+      continue;
     KALDI_ASSERT(tok != NULL && state == tok->arc_.nextstate);
-    for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
+    for (fst::ArcIterator<FST> aiter(fst_, state);
          !aiter.Done();
          aiter.Next()) {
       const Arc &arc = aiter.Value();
       if (arc.ilabel == 0) {  // propagate nonemitting only...
-        Token *new_tok = new Token(arc, tok);
+        Token *new_tok = token_pool_.New(arc, tok);
         if (new_tok->cost_ > cutoff) {  // prune
-          Token::TokenDelete(new_tok);
+          TokenDelete(new_tok);
         } else {
           Elem *e_found = toks_.Find(arc.nextstate);
           if (e_found == NULL) {
@@ -332,11 +348,11 @@ void FasterDecoder::ProcessNonemitting(double cutoff) {
             queue_.push_back(arc.nextstate);
           } else {
             if ( *(e_found->val) < *new_tok ) {
-              Token::TokenDelete(e_found->val);
+              TokenDelete(e_found->val);
               e_found->val = new_tok;
               queue_.push_back(arc.nextstate);
             } else {
-              Token::TokenDelete(new_tok);
+              TokenDelete(new_tok);
             }
           }
         }
@@ -345,12 +361,17 @@ void FasterDecoder::ProcessNonemitting(double cutoff) {
   }
 }
 
-void FasterDecoder::ClearToks(Elem *list) {
+template <typename FST>
+void FasterDecoderTpl<FST>::ClearToks(Elem *list) {
   for (Elem *e = list, *e_tail; e != NULL; e = e_tail) {
-    Token::TokenDelete(e->val);
+    TokenDelete(e->val);
     e_tail = e->tail;
     toks_.Delete(e);
   }
 }
 
+// Instantiate the template for the FST types that we'll need.
+template class FasterDecoderTpl<fst::Fst<fst::StdArc> >;
+template class FasterDecoderTpl<fst::CsrFst>;
+
 } // end namespace kaldi.
@@ -24,9 +24,11 @@
 #include "util/stl-utils.h"
 #include "itf/options-itf.h"
 #include "util/hash-list.h"
+#include "util/object-pool.h"
 #include "fst/fstlib.h"
 #include "itf/decodable-itf.h"
 #include "lat/kaldi-lattice.h" // for CompactLatticeArc
+#include "decoder/csr-fst.h"
 
 namespace kaldi {
 
@@ -59,19 +61,23 @@ struct FasterDecoderOptions {
   }
 };
 
-class FasterDecoder {
+/// FasterDecoderTpl is templated on the FST type, as LatticeFasterDecoderTpl
+/// is, so that arc iteration is inline for the types it is instantiated for:
+/// fst::Fst<fst::StdArc> (FasterDecoder, which works with any FST through
+/// virtual calls) and fst::CsrFst, a flat copy of the graph.
+template <typename FST>
+class FasterDecoderTpl {
  public:
   typedef fst::StdArc Arc;
   typedef Arc::Label Label;
   typedef Arc::StateId StateId;
   typedef Arc::Weight Weight;
 
-  FasterDecoder(const fst::Fst<fst::StdArc> &fst,
-                const FasterDecoderOptions &config);
+  FasterDecoderTpl(const FST &fst, const FasterDecoderOptions &config);
 
   void SetOptions(const FasterDecoderOptions &config) { config_ = config; }
 
-  ~FasterDecoder() { ClearToks(toks_.Clear()); }
+  ~FasterDecoderTpl() { ClearToks(toks_.Clear()); }
 
   void Decode(DecodableInterface *decodable);
 
@@ -101,6 +107,16 @@ class FasterDecoder {
   /// Returns the number of frames already decoded.
   int32 NumFramesDecoded() const { return num_frames_decoded_; }
 
+  /// Returns the largest number of tokens that were active on a frame since
+  /// InitDecoding().
+  size_t PeakNumTokens() const { return peak_num_toks_; }
+
+  /// Returns how many token allocations the token pool has saved over the
+  /// life of this decoder (tokens are reused across InitDecoding() calls).
+  int64 NumAllocationsSaved() const {
+    return token_pool_.NumAllocationsSaved();
+  }
+
  protected:
 
   class Token {
@@ -134,20 +150,22 @@ class FasterDecoder {
     inline bool operator < (const Token &other) {
       return cost_ > other.cost_;
     }
-
-    inline static void TokenDelete(Token *tok) {
-      while (--tok->ref_count_ == 0) {
-        Token *prev = tok->prev_;
-        delete tok;
-        if (prev == NULL) return;
-        else tok = prev;
-      }
+  };
+  typedef typename HashList<StateId, Token*>::Elem Elem;
+
+  /// Drops a reference to "tok", and gives it (and any of its predecessors
+  /// that are no longer referenced) back to the token pool.
+  inline void TokenDelete(Token *tok) {
+    while (--tok->ref_count_ == 0) {
+      Token *prev = tok->prev_;
+      token_pool_.Delete(tok);
+      if (prev == NULL) return;
+      else tok = prev;
+    }
 #ifdef KALDI_PARANOID
-      KALDI_ASSERT(tok->ref_count_ > 0);
+    KALDI_ASSERT(tok->ref_count_ > 0);
 #endif
-    }
-  };
-  typedef HashList<StateId, Token*>::Elem Elem;
+  }
 
 
   /// Gets the weight cutoff.  Also counts the active tokens.
@@ -168,7 +186,8 @@ class FasterDecoder {
   // more than one list (e.g. for current and previous frames), but only one of
   // them at a time can be indexed by StateId.
   HashList<StateId, Token*> toks_;
-  const fst::Fst<fst::StdArc> &fst_;
+  ObjectPool<Token> token_pool_;  // all the Tokens come from here.
+  const FST &fst_;
   FasterDecoderOptions config_;
   std::vector<StateId> queue_;  // temp variable used in ProcessNonemitting,
   std::vector<BaseFloat> tmp_array_;  // used in GetCutoff.
@@ -176,6 +195,7 @@ class FasterDecoder {
 
   // Keep track of the number of frames decoded in the current file.
   int32 num_frames_decoded_;
+  size_t peak_num_toks_;
 
   // It might seem unclear why we call ClearToks(toks_.Clear()).
   // There are two separate cleanup tasks we need to do at when we start a new file.
@@ -185,9 +205,11 @@ class FasterDecoder {
   // this way for convenience in propagating tokens from one frame to the next.
   void ClearToks(Elem *list);
 
-  KALDI_DISALLOW_COPY_AND_ASSIGN(FasterDecoder);
+  KALDI_DISALLOW_COPY_AND_ASSIGN(FasterDecoderTpl);
 };
 
+typedef FasterDecoderTpl<fst::StdFst> FasterDecoder;
+
 
 } // end namespace kaldi.
 
@@ -26,6 +26,7 @@
 
 #include "util/stl-utils.h"
 #include "util/hash-list.h"
+#include "util/object-pool.h"
 #include "fst/fstlib.h"
 #include "itf/decodable-itf.h"
 #include "fstext/fstext-lib.h"
@@ -337,6 +338,13 @@ class LatticeFasterDecoderTpl {
   /// reasonable likelihood.
   BaseFloat FinalRelativeCost() const;
 
+  /// Returns how many allocations the token and forward-link pools have saved
+  /// over the life of this decoder (they are reused across utterances).
+  int64 NumAllocationsSaved() const {
+    return token_pool_.NumAllocationsSaved() +
+        link_pool_.NumAllocationsSaved();
+  }
+
 
   // Returns the number of frames decoded so far.  The value returned changes
   // whenever we call ProcessEmitting().
@@ -348,7 +356,7 @@ class LatticeFasterDecoderTpl {
   // internals.
 
   // Deletes the elements of the singly linked list tok->links.
-  inline static void DeleteForwardLinks(Token *tok);
+  inline void DeleteForwardLinks(Token *tok);
 
   // head of per-frame list of Tokens (list is in topological order),
   // and something saying whether we ever pruned it using PruneForwardLinks.
@@ -479,6 +487,9 @@ class LatticeFasterDecoderTpl {
   // zero, to reduce roundoff errors.
   LatticeFasterDecoderConfig config_;
   int32 num_toks_; // current total #toks allocated...
+  // All the Tokens and ForwardLinks come from these.
+  ObjectPool<Token> token_pool_;
+  ObjectPool<ForwardLinkT> link_pool_;
   bool warned_;
 
   /// decoding_finalized_ is true if someone called FinalizeDecoding().  [note,
@@ -36,7 +36,7 @@ void LatticeSimpleDecoder::InitDecoding() {
   StateId start_state = fst_.Start();
   KALDI_ASSERT(start_state != fst::kNoStateId);
   active_toks_.resize(1);
-  Token *start_tok = new Token(0.0, 0.0, NULL, NULL);
+  Token *start_tok = token_pool_.New(0.0, 0.0, nullptr, nullptr);
   active_toks_[0].toks = start_tok;
   cur_toks_[start_state] = start_tok;
   num_toks_++;
@@ -204,7 +204,7 @@ inline LatticeSimpleDecoder::Token *LatticeSimpleDecoder::FindOrAddToken(
     // tokens on the currently final frame have zero extra_cost
     // as any of them could end up
     // on the winning path.
-    Token *new_tok = new Token (tot_cost, extra_cost, NULL, toks);
+    Token *new_tok = token_pool_.New(tot_cost, extra_cost, nullptr, toks);
     toks = new_tok;
     num_toks_++;
     cur_toks_[state] = new_tok;
@@ -261,7 +261,7 @@ void LatticeSimpleDecoder::PruneForwardLinks(
           ForwardLink *next_link = link->next;
           if (prev_link != NULL) prev_link->next = next_link;
           else tok->links = next_link;
-          delete link;
+          link_pool_.Delete(link);
           link = next_link; // advance link but leave prev_link the same.
           *links_pruned = true;
         } else { // keep the link and update the tok_extra_cost if needed.
@@ -389,7 +389,7 @@ void LatticeSimpleDecoder::PruneForwardLinksFinal() {
           ForwardLink *next_link = link->next;
           if (prev_link != NULL) prev_link->next = next_link;
           else tok->links = next_link;
-          delete link;
+          link_pool_.Delete(link);
           link = next_link; // advance link but leave prev_link the same.
         } else { // keep the link and update the tok_extra_cost if needed.
           if (link_extra_cost < 0.0) { // this is just a precaution.
@@ -446,7 +446,7 @@ void LatticeSimpleDecoder::PruneTokensForFrame(int32 frame) {
       // and delete tok.
       if (prev_tok != NULL) prev_tok->next = tok->next;
       else toks = tok->next;
-      delete tok;
+      token_pool_.Delete(tok);
       num_toks_--;
     } else {
       prev_tok = tok;
@@ -540,8 +540,8 @@ void LatticeSimpleDecoder::ProcessEmitting(DecodableInterface *decodable) {
                                          true, NULL);
           
         // Add ForwardLink from tok to next_tok (put on head of list tok->links)
-        tok->links = new ForwardLink(next_tok, arc.ilabel, arc.olabel, 
-                                     graph_cost, ac_cost, tok->links);
+        tok->links = link_pool_.New(next_tok, arc.ilabel, arc.olabel,
+                                    graph_cost, ac_cost, tok->links);
       }
     }
   }
@@ -586,7 +586,7 @@ void LatticeSimpleDecoder::ProcessNonemitting() {
     // because we're about to regenerate them.  This is a kind
     // of non-optimality (remember, this is the simple decoder),
     // but since most states are emitting it's not a huge issue.
-    tok->DeleteForwardLinks();
+    DeleteForwardLinks(tok);
     tok->links = NULL;
     for (fst::ArcIterator<fst::Fst<Arc> > aiter(fst_, state);
          !aiter.Done();
@@ -601,8 +601,8 @@ void LatticeSimpleDecoder::ProcessNonemitting() {
           Token *new_tok = FindOrAddToken(arc.nextstate, frame + 1, tot_cost,
                                           false, &changed);
           
-          tok->links = new ForwardLink(new_tok, 0, arc.olabel,
-                                       graph_cost, 0, tok->links);
+          tok->links = link_pool_.New(new_tok, 0, arc.olabel,
+                                      graph_cost, 0, tok->links);
             
           // "changed" tells us whether the new token has a different
           // cost from before, or is new [if so, add into queue].
@@ -619,9 +619,9 @@ void LatticeSimpleDecoder::ClearActiveTokens() { // a cleanup routine, at utt en
     // Delete all tokens alive on this frame, and any forward
     // links they may have.
     for (Token *tok = active_toks_[i].toks; tok != NULL; ) {
-      tok->DeleteForwardLinks();
+      DeleteForwardLinks(tok);
       Token *next_tok = tok->next;
-      delete tok;
+      token_pool_.Delete(tok);
       num_toks_--;
       tok = next_tok;
     }
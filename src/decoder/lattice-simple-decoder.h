@@ -24,6 +24,7 @@
 
 
 #include "util/stl-utils.h"
+#include "util/object-pool.h"
 #include "fst/fstlib.h"
 #include "itf/decodable-itf.h"
 #include "fstext/fstext-lib.h"
@@ -130,6 +131,13 @@ class LatticeSimpleDecoder {
   /// take it as a good indication that we reached the final-state with
   /// reasonable likelihood.
   BaseFloat FinalRelativeCost() const;
+
+  /// Returns how many allocations the token and forward-link pools have saved
+  /// over the life of this decoder (they are reused across utterances).
+  int64 NumAllocationsSaved() const {
+    return token_pool_.NumAllocationsSaved() +
+        link_pool_.NumAllocationsSaved();
+  }
   
   // Outputs an FST corresponding to the single best path
   // through the lattice.  Returns true if result is nonempty
@@ -199,16 +207,18 @@ class LatticeSimpleDecoder {
           Token *next): tot_cost(tot_cost), extra_cost(extra_cost), links(links),
                         next(next) { }
     Token() {}
-    void DeleteForwardLinks() {
-      ForwardLink *l = links, *m; 
-      while (l != NULL) {
-        m = l->next;
-        delete l;
-        l = m;
-      }
-      links = NULL;
-    }
   };
+
+  // Deletes the elements of the singly linked list tok->links.
+  void DeleteForwardLinks(Token *tok) {
+    ForwardLink *l = tok->links, *m;
+    while (l != NULL) {
+      m = l->next;
+      link_pool_.Delete(l);
+      l = m;
+    }
+    tok->links = NULL;
+  }
   
   // head and tail of per-frame list of Tokens (list is in topological order),
   // and something saying whether we ever pruned it using PruneForwardLinks.
@@ -293,6 +303,9 @@ class LatticeSimpleDecoder {
   const fst::Fst<fst::StdArc> &fst_;
   LatticeSimpleDecoderConfig config_;
   int32 num_toks_; // current total #toks allocated...
+  // All the Tokens and ForwardLinks come from these.
+  ObjectPool<Token> token_pool_;
+  ObjectPool<ForwardLink> link_pool_;
   bool warned_;
 
 
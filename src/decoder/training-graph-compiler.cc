@@ -17,19 +17,83 @@
 // MERCHANTABLITY OR NON-INFRINGEMENT.
 // See the Apache 2 License for the specific language governing permissions and
 // limitations under the License.
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 #include "decoder/training-graph-compiler.h"
 #include "hmm/hmm-utils.h" // for GetHTransducer
+#include "util/stl-utils.h"
+#include "util/trace-recorder.h"
 
 namespace kaldi {
 
 
+int32 TrainingGraphCompiler::SubsequentialSymbol(
+    const TransitionModel &trans_model,
+    const std::vector<int32> &disambig_syms) {
+  const std::vector<int32> &phone_syms = trans_model.GetPhones();
+  KALDI_ASSERT(!phone_syms.empty());
+  int32 ans = 1 + phone_syms.back();
+  for (size_t i = 0; i < disambig_syms.size(); i++)
+    ans = std::max(ans, 1 + disambig_syms[i]);
+  return ans;
+}
+
+void TrainingGraphCompiler::PrepareLexicon(
+    const TransitionModel &trans_model,
+    const ContextDependency &ctx_dep,
+    const std::vector<int32> &disambig_syms,
+    fst::VectorFst<fst::StdArc> *lex_fst) {
+  int32 N = ctx_dep.ContextWidth(),
+      P = ctx_dep.CentralPosition();
+  if (P != N-1)
+    AddSubsequentialLoop(SubsequentialSymbol(trans_model, disambig_syms),
+                         lex_fst);  // This is needed for
+  // systems with right-context or we will not successfully compose
+  // with C.
+
+  {  // make sure lexicon is olabel sorted.
+    fst::OLabelCompare<fst::StdArc> olabel_comp;
+    fst::ArcSort(lex_fst, olabel_comp);
+  }
+  // The lexicon is only read through ReadOnlyFst from now on, which does not
+  // store the properties it computes.
+  lex_fst->Properties(fst::kFstProperties, true);
+}
+
 TrainingGraphCompiler::TrainingGraphCompiler(const TransitionModel &trans_model,
                                              const ContextDependency &ctx_dep,  // Does not maintain reference to this.
                                              fst::VectorFst<fst::StdArc> *lex_fst,
                                              const std::vector<int32> &disambig_syms,
                                              const TrainingGraphCompilerOptions &opts):
     trans_model_(trans_model), ctx_dep_(ctx_dep), lex_fst_(lex_fst),
-    disambig_syms_(disambig_syms), opts_(opts) {
+    own_lex_fst_(lex_fst), disambig_syms_(disambig_syms), opts_(opts),
+    hmm_cache_(NULL), inv_cfst_(NULL), h_num_ilabels_(0), cl_fst_(NULL),
+    cl_ilabel_info_(NULL) {
+  PrepareLexicon(trans_model_, ctx_dep_, disambig_syms_, lex_fst);
+  Init();
+}
+
+TrainingGraphCompiler::TrainingGraphCompiler(
+    const TransitionModel &trans_model,
+    const ContextDependency &ctx_dep,
+    const fst::Fst<fst::StdArc> &lex_fst,
+    const std::vector<int32> &disambig_syms,
+    const TrainingGraphCompilerOptions &opts):
+    trans_model_(trans_model), ctx_dep_(ctx_dep), lex_fst_(&lex_fst),
+    disambig_syms_(disambig_syms), opts_(opts), hmm_cache_(NULL),
+    inv_cfst_(NULL), h_num_ilabels_(0), cl_fst_(NULL),
+    cl_ilabel_info_(NULL) {
+  // Not "test", as the lexicon may be in use by other threads.
+  if (lex_fst.Properties(fst::kOLabelSorted, false) != fst::kOLabelSorted)
+    KALDI_ERR << "The lexicon must be prepared with PrepareLexicon().";
+  Init();
+}
+
+void TrainingGraphCompiler::Init() {
   using namespace fst;
   const std::vector<int32> &phone_syms = trans_model_.GetPhones();  // needed to create context fst.
 
@@ -42,29 +106,134 @@ TrainingGraphCompiler::TrainingGraphCompiler(const TransitionModel &trans_model,
       KALDI_ERR << "Disambiguation symbol " << disambig_syms_[i]
                 << " is also a phone.";
 
-  subsequential_symbol_ = 1 + phone_syms.back();
-  if (!disambig_syms_.empty() && subsequential_symbol_ <= disambig_syms_.back())
-    subsequential_symbol_ = 1 + disambig_syms_.back();
+  subsequential_symbol_ = SubsequentialSymbol(trans_model_, disambig_syms_);
 
-  {
-    int32 N = ctx_dep.ContextWidth(),
-        P = ctx_dep.CentralPosition();
-    if (P != N-1)
-      AddSubsequentialLoop(subsequential_symbol_, lex_fst_);  // This is needed for
-    // systems with right-context or we will not successfully compose
-    // with C.
+  HTransducerConfig h_cfg;
+  h_cfg.transition_scale = opts_.transition_scale;
+  own_hmm_cache_.reset(new HmmFsaCache(ctx_dep_, trans_model_, h_cfg,
+                                       opts_.hmm_cache_size));
+  hmm_cache_ = own_hmm_cache_.get();
+  compose_caches_.push_back(new ComposeCaches());
+}
+
+TrainingGraphCompiler::~TrainingGraphCompiler() {
+  delete inv_cfst_;
+  for (size_t i = 0; i < compose_caches_.size(); i++)
+    delete compose_caches_[i];
+}
+
+void TrainingGraphCompiler::SetHmmCache(HmmFsaCache *cache) {
+  KALDI_ASSERT(cache != NULL &&
+               cache->Config().transition_scale == opts_.transition_scale);
+  hmm_cache_ = cache;
+  own_hmm_cache_.reset();
+}
+
+void TrainingGraphCompiler::SetContextLexicon(
+    const fst::Fst<fst::StdArc> *cl_fst,
+    const std::vector<std::vector<int32> > *ilabel_info) {
+  KALDI_ASSERT(cl_fst != NULL && ilabel_info != NULL);
+  // Not "test" (which would compute and store the property), as cl_fst may
+  // be in use by other threads; it is known for FSTs that were sorted.
+  if (cl_fst->Properties(fst::kOLabelSorted, false) != fst::kOLabelSorted)
+    KALDI_ERR << "The context lexicon must be sorted on output labels.";
+  int32 N = ctx_dep_.ContextWidth();
+  for (size_t i = 0; i < ilabel_info->size(); i++) {
+    const std::vector<int32> &info = (*ilabel_info)[i];
+    if (!(static_cast<int32>(info.size()) == N ||
+          (info.size() == 1 && info[0] <= 0) ||
+          info.empty()))
+      KALDI_ERR << "The context lexicon is for a context width of "
+                << info.size() << " but the tree has " << N;
   }
+  cl_fst_ = cl_fst;
+  cl_ilabel_info_ = ilabel_info;
+}
 
-  {  // make sure lexicon is olabel sorted.
-    fst::OLabelCompare<fst::StdArc> olabel_comp;
-    fst::ArcSort(lex_fst_, olabel_comp);
+void TrainingGraphCompiler::ResetContextIfTooBig() {
+  if (inv_cfst_ != NULL && inv_cfst_->IlabelInfo().size() >
+      static_cast<size_t>(opts_.hmm_cache_size)) {
+    delete inv_cfst_;
+    inv_cfst_ = NULL;
+  }
+  if (inv_cfst_ == NULL) {
+    inv_cfst_ = new fst::InverseContextFst(subsequential_symbol_,
+                                           trans_model_.GetPhones(),
+                                           disambig_syms_,
+                                           ctx_dep_.ContextWidth(),
+                                           ctx_dep_.CentralPosition());
+    ClearHCaches();
+    h_fst_.DeleteStates();
+    h_num_ilabels_ = 1;  // ilabel 0 is epsilon.
+    disambig_syms_h_.clear();
+  }
+}
+
+void TrainingGraphCompiler::UpdateHTransducer() {
+  const std::vector<std::vector<int32> > &ilabel_info =
+      inv_cfst_->IlabelInfo();
+  if (static_cast<int32>(ilabel_info.size()) == h_num_ilabels_)
+    return;
+  TraceScope trace("make-h");
+  // The compose caches have copies of the old H.
+  ClearHCaches();
+  ExtendHTransducer(ilabel_info, h_num_ilabels_, trans_model_, hmm_cache_,
+                    &h_fst_, &disambig_syms_h_);
+  h_fst_.Properties(fst::kFstProperties, true);  // as for the lexicon.
+  h_num_ilabels_ = ilabel_info.size();
+}
+
+void TrainingGraphCompiler::ClearHCaches() {
+  for (size_t i = 0; i < compose_caches_.size(); i++) {
+    delete compose_caches_[i]->h_cache.matcher;
+    compose_caches_[i]->h_cache.matcher = NULL;
   }
 }
 
+void TrainingGraphCompiler::RunInThreads(
+    size_t num_tasks,
+    const std::function<void(size_t, ComposeCaches*)> &task) {
+  size_t num_threads = std::min<size_t>(std::max<int32>(opts_.num_threads, 1),
+                                        num_tasks);
+  if (num_threads <= 1) {
+    for (size_t i = 0; i < num_tasks; i++)
+      task(i, compose_caches_[0]);
+    return;
+  }
+  while (compose_caches_.size() < num_threads)
+    compose_caches_.push_back(new ComposeCaches());
+  std::atomic<size_t> next_task(0);
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto worker = [&](ComposeCaches *caches) {
+    size_t i;
+    while ((i = next_task++) < num_tasks) {
+      try {
+        task(i, caches);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error)
+          error = std::current_exception();
+        next_task = num_tasks;  // the other threads stop too.
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t t = 1; t < num_threads; t++)
+    threads.push_back(std::thread(worker, compose_caches_[t]));
+  worker(compose_caches_[0]);
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
 bool TrainingGraphCompiler::CompileGraphFromText(
     const std::vector<int32> &transcript,
     fst::VectorFst<fst::StdArc> *out_fst) {
   using namespace fst;
+  if (opts_.fast_linear && cl_fst_ == NULL)
+    return CompileLinearGraph(transcript, out_fst);
   VectorFst<StdArc> word_fst;
   MakeLinearAcceptor(transcript, &word_fst);
   return CompileGraph(word_fst, out_fst);
@@ -75,77 +244,423 @@ bool TrainingGraphCompiler::CompileGraph(const fst::VectorFst<fst::StdArc> &word
   using namespace fst;
   KALDI_ASSERT(lex_fst_ !=NULL);
   KALDI_ASSERT(out_fst != NULL);
+  if (cl_fst_ != NULL)
+    return CompileGraphWithContextLexicon(word_fst, compose_caches_[0],
+                                          out_fst);
 
   VectorFst<StdArc> phone2word_fst;
-  // TableCompose more efficient than compose.
-  TableCompose(*lex_fst_, word_fst, &phone2word_fst, &lex_cache_);
+  {
+    TraceScope trace("compose-lexicon");
+    // TableCompose more efficient than compose.
+    TableCompose(ReadOnlyFst<StdArc>(*lex_fst_), word_fst, &phone2word_fst,
+                 &(compose_caches_[0]->lex_cache));
+  }
 
   KALDI_ASSERT(phone2word_fst.Start() != kNoStateId);
 
-  const std::vector<int32> &phone_syms = trans_model_.GetPhones();  // needed to create context fst.
-
-  // inv_cfst will be expanded on the fly, as needed.
-  InverseContextFst inv_cfst(subsequential_symbol_,
-                             phone_syms,
-                             disambig_syms_,
-                             ctx_dep_.ContextWidth(),
-                             ctx_dep_.CentralPosition());
-
+  // inv_cfst_ is expanded on the fly, as needed, and kept for the next call.
+  ResetContextIfTooBig();
 
   VectorFst<StdArc> ctx2word_fst;
-  ComposeDeterministicOnDemandInverse(phone2word_fst, &inv_cfst, &ctx2word_fst);
+  {
+    TraceScope trace("compose-context");
+    ComposeDeterministicOnDemandInverse(phone2word_fst, inv_cfst_,
+                                        &ctx2word_fst);
+  }
   // now ctx2word_fst is C * LG, assuming phone2word_fst is written as LG.
   KALDI_ASSERT(ctx2word_fst.Start() != kNoStateId);
 
-  HTransducerConfig h_cfg;
-  h_cfg.transition_scale = opts_.transition_scale;
-
-  std::vector<int32> disambig_syms_h; // disambiguation symbols on
-  // input side of H.
-  VectorFst<StdArc> *H = GetHTransducer(inv_cfst.IlabelInfo(),
-                                        ctx_dep_,
-                                        trans_model_,
-                                        h_cfg,
-                                        &disambig_syms_h);
+  UpdateHTransducer();
+  const std::vector<int32> &disambig_syms_h = disambig_syms_h_;
 
   VectorFst<StdArc> &trans2word_fst = *out_fst;  // transition-id to word.
-  TableCompose(*H, ctx2word_fst, &trans2word_fst);
+  {
+    TraceScope trace("compose-hmm");
+    TableCompose(ReadOnlyFst<StdArc>(h_fst_), ctx2word_fst, &trans2word_fst,
+                 &(compose_caches_[0]->h_cache));
+  }
 
   KALDI_ASSERT(trans2word_fst.Start() != kNoStateId);
 
-  // Epsilon-removal and determinization combined. This will fail if not determinizable.
-  DeterminizeStarInLog(&trans2word_fst);
+  {
+    TraceScope trace("determinize");
+    // Epsilon-removal and determinization combined. This will fail if not determinizable.
+    DeterminizeStarInLog(&trans2word_fst);
+
+    if (!disambig_syms_h.empty()) {
+      RemoveSomeInputSymbols(disambig_syms_h, &trans2word_fst);
+      // we elect not to remove epsilons after this phase, as it is
+      // a little slow.
+      if (opts_.rm_eps)
+        RemoveEpsLocal(&trans2word_fst);
+    }
+  }
+
+
+  {
+    TraceScope trace("minimize");
+    // Encoded minimization.
+    MinimizeEncoded(&trans2word_fst);
+  }
+
+  std::vector<int32> disambig;
+  bool check_no_self_loops = true;
+  {
+    TraceScope trace("add-self-loops");
+    AddSelfLoops(trans_model_,
+                 disambig,
+                 opts_.self_loop_scale,
+                 opts_.reorder,
+                 check_no_self_loops,
+                 &trans2word_fst);
+  }
+  return true;
+}
+
+
+bool TrainingGraphCompiler::CompileGraphWithContextLexicon(
+    const fst::VectorFst<fst::StdArc> &word_fst, ComposeCaches *caches,
+    fst::VectorFst<fst::StdArc> *out_fst) {
+  using namespace fst;
+  VectorFst<StdArc> ctx2word_fst;
+  {
+    TraceScope trace("compose-context-lexicon");
+    TableCompose(ReadOnlyFst<StdArc>(*cl_fst_), word_fst, &ctx2word_fst,
+                 &(caches->cl_cache));
+    Connect(&ctx2word_fst);
+  }
+  if (ctx2word_fst.Start() == kNoStateId) {
+    KALDI_WARN << "The words have no path through the context lexicon; "
+               << "perhaps you have words missing in your lexicon?";
+    out_fst->DeleteStates();
+    return false;
+  }
+  {
+    TraceScope trace("determinize");
+    // As in CompileLinearGraph(), this adds up the duplicate paths of the
+    // lexicon, on the graph before HMM expansion.
+    DeterminizeStarInLog(&ctx2word_fst);
+  }
+
+  {
+    TraceScope trace("expand-hmm");
+    ExpandHmms(ctx2word_fst, out_fst);
+  }
 
-  if (!disambig_syms_h.empty()) {
-    RemoveSomeInputSymbols(disambig_syms_h, &trans2word_fst);
-    // we elect not to remove epsilons after this phase, as it is
-    // a little slow.
-    if (opts_.rm_eps)
-      RemoveEpsLocal(&trans2word_fst);
+  std::vector<int32> disambig;
+  bool check_no_self_loops = true;
+  {
+    TraceScope trace("add-self-loops");
+    AddSelfLoops(trans_model_,
+                 disambig,
+                 opts_.self_loop_scale,
+                 opts_.reorder,
+                 check_no_self_loops,
+                 out_fst);
   }
+  return true;
+}
 
+bool TrainingGraphCompiler::CompileLinearGraph(
+    const std::vector<int32> &transcript,
+    fst::VectorFst<fst::StdArc> *out_fst) {
+  using namespace fst;
+  KALDI_ASSERT(lex_fst_ != NULL);
+  KALDI_ASSERT(out_fst != NULL);
 
-  // Encoded minimization.
-  MinimizeEncoded(&trans2word_fst);
+  VectorFst<StdArc> phone2word_fst;
+  {
+    TraceScope trace("expand-lexicon");
+    ExpandLexicon(transcript, &phone2word_fst);
+  }
+  if (phone2word_fst.Start() == kNoStateId) {
+    KALDI_WARN << "The transcript has no path through the lexicon; perhaps "
+               << "you have words missing in your lexicon?";
+    out_fst->DeleteStates();
+    return false;
+  }
+  {
+    TraceScope trace("determinize");
+    // Lexicons may have several paths with the same phones for the same words
+    // (e.g. with and without a non-silence "silence state"); CompileGraph
+    // adds up their probabilities when it determinizes in the log semiring,
+    // and so do we, on the much smaller phone graph.  As the HMMs in context
+    // are a function of the phones, this gives the same weights.
+    DeterminizeStarInLog(&phone2word_fst);
+  }
+
+  {
+    TraceScope trace("expand-context-hmm");
+    ExpandContextAndHmms(phone2word_fst, out_fst);
+  }
 
   std::vector<int32> disambig;
   bool check_no_self_loops = true;
-  AddSelfLoops(trans_model_,
-               disambig,
-               opts_.self_loop_scale,
-               opts_.reorder,
-               check_no_self_loops,
-               &trans2word_fst);
-
-  delete H;
+  {
+    TraceScope trace("add-self-loops");
+    AddSelfLoops(trans_model_,
+                 disambig,
+                 opts_.self_loop_scale,
+                 opts_.reorder,
+                 check_no_self_loops,
+                 out_fst);
+  }
   return true;
 }
 
+void TrainingGraphCompiler::ExpandLexicon(
+    const std::vector<int32> &transcript,
+    fst::VectorFst<fst::StdArc> *phone2word_fst) {
+  using namespace fst;
+  typedef StdArc Arc;
+  typedef Arc::StateId StateId;
+  typedef unordered_map<std::pair<StateId, int32>, StateId,
+                        PairHasher<StateId, int32> > StateMap;
+
+  phone2word_fst->DeleteStates();
+  StateId lex_start = lex_fst_->Start();
+  if (lex_start == kNoStateId) return;
+
+  // The states of the output are pairs (lexicon state, number of words
+  // consumed).  The lexicon is sorted on olabel, so the arcs that consume no
+  // word come first and those for the next word can be found by bisection.
+  StateMap state_map;
+  std::vector<std::pair<StateId, int32> > queue;
+  std::pair<StateId, int32> start_pair(lex_start, 0);
+  state_map[start_pair] = phone2word_fst->AddState();
+  phone2word_fst->SetStart(state_map[start_pair]);
+  queue.push_back(start_pair);
+  int32 num_words = transcript.size();
+
+  while (!queue.empty()) {
+    std::pair<StateId, int32> pair = queue.back();
+    queue.pop_back();
+    StateId lex_state = pair.first, src = state_map[pair];
+    int32 pos = pair.second;
+    if (pos == num_words)
+      phone2word_fst->SetFinal(src, lex_fst_->Final(lex_state));
+
+    ArcIterator<Fst<Arc> > aiter(*lex_fst_, lex_state);
+    size_t num_arcs = lex_fst_->NumArcs(lex_state), first_word_arc = 0;
+    if (pos < num_words) {
+      size_t hi = num_arcs;
+      while (first_word_arc < hi) {
+        size_t mid = (first_word_arc + hi) / 2;
+        aiter.Seek(mid);
+        if (aiter.Value().olabel < transcript[pos]) first_word_arc = mid + 1;
+        else hi = mid;
+      }
+    }
+    // Arcs with no word, then arcs with the next word.
+    for (int32 pass = 0; pass < 2; pass++) {
+      if (pass == 1 && pos == num_words) break;
+      Arc::Label olabel = (pass == 0 ? 0 : transcript[pos]);
+      for (aiter.Seek(pass == 0 ? 0 : first_word_arc);
+           !aiter.Done() && aiter.Value().olabel == olabel; aiter.Next()) {
+        Arc arc = aiter.Value();
+        if (arc.ilabel == subsequential_symbol_) continue;
+        if (std::binary_search(disambig_syms_.begin(), disambig_syms_.end(),
+                               arc.ilabel))
+          arc.ilabel = 0;
+        std::pair<StateId, int32> next_pair(arc.nextstate, pos + pass);
+        std::pair<StateMap::iterator, bool> ins =
+            state_map.insert(std::make_pair(next_pair, kNoStateId));
+        if (ins.second) {
+          ins.first->second = phone2word_fst->AddState();
+          queue.push_back(next_pair);
+        }
+        arc.nextstate = ins.first->second;
+        phone2word_fst->AddArc(src, arc);
+      }
+    }
+  }
+  // Remove the paths that do not get through the words.
+  Connect(phone2word_fst);
+}
+
+void TrainingGraphCompiler::ExpandContextAndHmms(
+    const fst::VectorFst<fst::StdArc> &phone2word_fst,
+    fst::VectorFst<fst::StdArc> *ofst) {
+  using namespace fst;
+  typedef StdArc Arc;
+  typedef Arc::StateId StateId;
+  typedef Arc::Weight Weight;
+  typedef unordered_map<std::vector<int32>, StateId,
+                        VectorHasher<int32> > StateMap;
+
+  int32 N = ctx_dep_.ContextWidth(),
+      P = ctx_dep_.CentralPosition();
+  ofst->DeleteStates();
+
+  // A state of the output is a state of phone2word_fst with the N-1 phones
+  // before it (0 before the first phone), which is what InverseContextFst
+  // would pair it with; its key is the state followed by the phones.  Of the
+  // phones, those from position P on have not yet had their HMM added.
+  StateMap state_map;
+  std::vector<std::vector<int32> > queue;
+  std::vector<int32> start_key(N, 0);
+  start_key[0] = phone2word_fst.Start();
+  state_map[start_key] = ofst->AddState();
+  ofst->SetStart(state_map[start_key]);
+  queue.push_back(start_key);
+
+  std::vector<int32> key, next_key, window;
+  while (!queue.empty()) {
+    key.swap(queue.back());
+    queue.pop_back();
+    StateId src = state_map[key];
+    for (ArcIterator<VectorFst<Arc> > aiter(phone2word_fst, key[0]);
+         !aiter.Done(); aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      next_key = key;
+      next_key[0] = arc.nextstate;
+      window.clear();
+      if (arc.ilabel != 0) {
+        // The phone completes the window of the phone at position P, and
+        // shifts the context.
+        window.insert(window.end(), key.begin() + 1, key.end());
+        window.push_back(arc.ilabel);
+        std::copy(window.begin() + 1, window.end(), next_key.begin() + 1);
+      }
+      std::pair<StateMap::iterator, bool> ins =
+          state_map.insert(std::make_pair(next_key, kNoStateId));
+      if (ins.second) {
+        ins.first->second = ofst->AddState();
+        queue.push_back(next_key);
+      }
+      StateId dest = ins.first->second;
+      if (arc.ilabel == 0)
+        ofst->AddArc(src, Arc(0, arc.olabel, arc.weight, dest));
+      else
+        AddPhoneInContext(window, src, dest, arc.olabel, arc.weight, ofst);
+    }
+
+    Weight final = phone2word_fst.Final(key[0]);
+    if (final != Weight::Zero()) {
+      // Add the HMMs of the phones still pending, with 0 as right context,
+      // as the subsequential symbol does for InverseContextFst.
+      StateId cur = src;
+      window.assign(key.begin() + 1, key.end());
+      for (int32 i = P + 1; i < N; i++) {
+        window.push_back(0);
+        StateId next = ofst->AddState();
+        AddPhoneInContext(window, cur, next, 0, Weight::One(), ofst);
+        window.erase(window.begin());
+        cur = next;
+      }
+      ofst->SetFinal(cur, final);
+    }
+  }
+}
+
+void TrainingGraphCompiler::ExpandHmms(
+    const fst::VectorFst<fst::StdArc> &ctx2word_fst,
+    fst::VectorFst<fst::StdArc> *ofst) {
+  using namespace fst;
+  typedef StdArc Arc;
+  typedef Arc::StateId StateId;
+
+  int32 N = ctx_dep_.ContextWidth();
+  ofst->DeleteStates();
+  StateId num_states = ctx2word_fst.NumStates();
+  for (StateId s = 0; s < num_states; s++)
+    ofst->AddState();
+  ofst->SetStart(ctx2word_fst.Start());
+  for (StateId s = 0; s < num_states; s++) {
+    ofst->SetFinal(s, ctx2word_fst.Final(s));
+    for (ArcIterator<VectorFst<Arc> > aiter(ctx2word_fst, s); !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      KALDI_ASSERT(static_cast<size_t>(arc.ilabel) < cl_ilabel_info_->size());
+      const std::vector<int32> &window = (*cl_ilabel_info_)[arc.ilabel];
+      if (static_cast<int32>(window.size()) == N)
+        AddPhoneInContext(window, s, arc.nextstate, arc.olabel, arc.weight,
+                          ofst);
+      else  // epsilon or a disambiguation symbol.
+        ofst->AddArc(s, Arc(0, arc.olabel, arc.weight, arc.nextstate));
+    }
+  }
+}
+
+void TrainingGraphCompiler::AddPhoneInContext(
+    const std::vector<int32> &phone_window,
+    fst::StdArc::StateId src, fst::StdArc::StateId dest,
+    fst::StdArc::Label olabel, fst::StdArc::Weight weight,
+    fst::VectorFst<fst::StdArc> *ofst) {
+  using namespace fst;
+  typedef StdArc Arc;
+  typedef Arc::StateId StateId;
+  typedef Arc::Weight Weight;
+
+  if (phone_window[ctx_dep_.CentralPosition()] == 0) {
+    // At the start, before the first phone reaches the central position.
+    ofst->AddArc(src, Arc(0, olabel, weight, dest));
+    return;
+  }
+  HmmFsaCache::FsaPtr hmm = hmm_cache_->GetHmm(phone_window);
+
+  // With the usual topologies, the start state of the HMM has no arcs into
+  // it and there is one final state, with no arcs out of it; these become
+  // "src" and "dest", and the first arcs carry "olabel" and "weight".
+  // Otherwise we enter and leave the HMM through epsilon arcs.
+  StateId hmm_start = hmm->Start(), hmm_final = kNoStateId,
+      num_states = hmm->NumStates();
+  bool direct = (hmm->Final(hmm_start) == Weight::Zero());
+  for (StateId s = 0; s < num_states && direct; s++) {
+    if (hmm->Final(s) != Weight::Zero()) {
+      if (hmm_final != kNoStateId || hmm->Final(s) != Weight::One() ||
+          hmm->NumArcs(s) != 0)
+        direct = false;
+      hmm_final = s;
+    }
+    for (ArcIterator<VectorFst<Arc> > aiter(*hmm, s); !aiter.Done();
+         aiter.Next())
+      if (aiter.Value().nextstate == hmm_start)
+        direct = false;
+  }
+  if (hmm_final == kNoStateId)
+    direct = false;
+
+  std::vector<StateId> state_map(num_states);
+  for (StateId s = 0; s < num_states; s++) {
+    if (direct && s == hmm_start) state_map[s] = src;
+    else if (direct && s == hmm_final) state_map[s] = dest;
+    else state_map[s] = ofst->AddState();
+  }
+  if (!direct)
+    ofst->AddArc(src, Arc(0, olabel, weight, state_map[hmm_start]));
+  for (StateId s = 0; s < num_states; s++) {
+    for (ArcIterator<VectorFst<Arc> > aiter(*hmm, s); !aiter.Done();
+         aiter.Next()) {
+      const Arc &arc = aiter.Value();
+      Arc new_arc(arc.ilabel, 0, arc.weight, state_map[arc.nextstate]);
+      if (direct && s == hmm_start) {
+        new_arc.olabel = olabel;
+        new_arc.weight = Times(weight, arc.weight);
+      }
+      ofst->AddArc(state_map[s], new_arc);
+    }
+    if (!direct && hmm->Final(s) != Weight::Zero())
+      ofst->AddArc(state_map[s], Arc(0, 0, hmm->Final(s), dest));
+  }
+}
+
 
 bool TrainingGraphCompiler::CompileGraphsFromText(
     const std::vector<std::vector<int32> > &transcripts,
     std::vector<fst::VectorFst<fst::StdArc>*> *out_fsts) {
   using namespace fst;
+  if (opts_.fast_linear && cl_fst_ == NULL) {
+    KALDI_ASSERT(out_fsts != NULL && out_fsts->empty());
+    out_fsts->resize(transcripts.size(), NULL);
+    for (size_t i = 0; i < transcripts.size(); i++)
+      (*out_fsts)[i] = new VectorFst<StdArc>();
+    std::vector<char> ok(transcripts.size());
+    RunInThreads(transcripts.size(), [&](size_t i, ComposeCaches *caches) {
+      ok[i] = CompileLinearGraph(transcripts[i], (*out_fsts)[i]);
+    });
+    return std::find(ok.begin(), ok.end(), 0) == ok.end();
+  }
   std::vector<const VectorFst<StdArc>* > word_fsts(transcripts.size());
   for (size_t i = 0; i < transcripts.size(); i++) {
     VectorFst<StdArc> *word_fst = new VectorFst<StdArc>();
@@ -167,74 +682,95 @@ bool TrainingGraphCompiler::CompileGraphs(
   KALDI_ASSERT(out_fsts != NULL && out_fsts->empty());
   out_fsts->resize(word_fsts.size(), NULL);
   if (word_fsts.empty()) return true;
+  for (size_t i = 0; i < word_fsts.size(); i++)
+    (*out_fsts)[i] = new VectorFst<StdArc>();
+
+  if (cl_fst_ != NULL) {
+    // Nothing is shared but read-only data, so the graphs are compiled in
+    // parallel from start to end.
+    std::vector<char> ok(word_fsts.size());
+    RunInThreads(word_fsts.size(), [&](size_t i, ComposeCaches *caches) {
+      ok[i] = CompileGraphWithContextLexicon(*(word_fsts[i]), caches,
+                                             (*out_fsts)[i]);
+    });
+    return std::find(ok.begin(), ok.end(), 0) == ok.end();
+  }
 
-  const std::vector<int32> &phone_syms = trans_model_.GetPhones();  // needed to create context fst.
-
-  // inv_cfst will be expanded on the fly, as needed.
-  InverseContextFst inv_cfst(subsequential_symbol_,
-                             phone_syms,
-                             disambig_syms_,
-                             ctx_dep_.ContextWidth(),
-                             ctx_dep_.CentralPosition());
-
-  for (size_t i = 0; i < word_fsts.size(); i++) {
-    VectorFst<StdArc> phone2word_fst;
-    // TableCompose more efficient than compose.
-    TableCompose(*lex_fst_, *(word_fsts[i]), &phone2word_fst, &lex_cache_);
-
+  RunInThreads(word_fsts.size(), [&](size_t i, ComposeCaches *caches) {
+    VectorFst<StdArc> &phone2word_fst = *((*out_fsts)[i]);
+    {
+      TraceScope trace("compose-lexicon");
+      // TableCompose more efficient than compose.
+      TableCompose(ReadOnlyFst<StdArc>(*lex_fst_), *(word_fsts[i]),
+                   &phone2word_fst, &(caches->lex_cache));
+    }
     KALDI_ASSERT(phone2word_fst.Start() != kNoStateId &&
                  "Perhaps you have words missing in your lexicon?");
+  });
+
+  // inv_cfst_ is expanded on the fly, as needed, and kept for the next call;
+  // it is not thread-safe, so this is done in order, by this thread.
+  ResetContextIfTooBig();
 
+  for (size_t i = 0; i < out_fsts->size(); i++) {
     VectorFst<StdArc> ctx2word_fst;
-    ComposeDeterministicOnDemandInverse(phone2word_fst, &inv_cfst, &ctx2word_fst);
+    {
+      TraceScope trace("compose-context");
+      ComposeDeterministicOnDemandInverse(*((*out_fsts)[i]), inv_cfst_,
+                                          &ctx2word_fst);
+    }
     // now ctx2word_fst is C * LG, assuming phone2word_fst is written as LG.
     KALDI_ASSERT(ctx2word_fst.Start() != kNoStateId);
 
-    (*out_fsts)[i] = ctx2word_fst.Copy();  // For now this contains the FST with symbols
-    // representing phones-in-context.
+    *((*out_fsts)[i]) = ctx2word_fst;  // For now this contains the FST with
+    // symbols representing phones-in-context.
   }
 
-  HTransducerConfig h_cfg;
-  h_cfg.transition_scale = opts_.transition_scale;
-
-  std::vector<int32> disambig_syms_h;
-  VectorFst<StdArc> *H = GetHTransducer(inv_cfst.IlabelInfo(),
-                                        ctx_dep_,
-                                        trans_model_,
-                                        h_cfg,
-                                        &disambig_syms_h);
+  UpdateHTransducer();
+  const std::vector<int32> &disambig_syms_h = disambig_syms_h_;
 
-  for (size_t i = 0; i < out_fsts->size(); i++) {
+  RunInThreads(out_fsts->size(), [&](size_t i, ComposeCaches *caches) {
     VectorFst<StdArc> &ctx2word_fst = *((*out_fsts)[i]);
     VectorFst<StdArc> trans2word_fst;
-    TableCompose(*H, ctx2word_fst, &trans2word_fst);
+    {
+      TraceScope trace("compose-hmm");
+      TableCompose(ReadOnlyFst<StdArc>(h_fst_), ctx2word_fst, &trans2word_fst,
+                   &(caches->h_cache));
+    }
 
-    DeterminizeStarInLog(&trans2word_fst);
+    {
+      TraceScope trace("determinize");
+      DeterminizeStarInLog(&trans2word_fst);
 
-    if (!disambig_syms_h.empty()) {
-      RemoveSomeInputSymbols(disambig_syms_h, &trans2word_fst);
-      if (opts_.rm_eps)
-        RemoveEpsLocal(&trans2word_fst);
+      if (!disambig_syms_h.empty()) {
+        RemoveSomeInputSymbols(disambig_syms_h, &trans2word_fst);
+        if (opts_.rm_eps)
+          RemoveEpsLocal(&trans2word_fst);
+      }
     }
 
-    // Encoded minimization.
-    MinimizeEncoded(&trans2word_fst);
+    {
+      TraceScope trace("minimize");
+      // Encoded minimization.
+      MinimizeEncoded(&trans2word_fst);
+    }
 
     std::vector<int32> disambig;
     bool check_no_self_loops = true;
-    AddSelfLoops(trans_model_,
-                 disambig,
-                 opts_.self_loop_scale,
-                 opts_.reorder,
-                 check_no_self_loops,
-                 &trans2word_fst);
+    {
+      TraceScope trace("add-self-loops");
+      AddSelfLoops(trans_model_,
+                   disambig,
+                   opts_.self_loop_scale,
+                   opts_.reorder,
+                   check_no_self_loops,
+                   &trans2word_fst);
+    }
 
     KALDI_ASSERT(trans2word_fst.Start() != kNoStateId);
 
     *((*out_fsts)[i]) = trans2word_fst;
-  }
-
-  delete H;
+  });
   return true;
 }
 
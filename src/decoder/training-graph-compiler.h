@@ -20,10 +20,14 @@
 #ifndef KALDI_DECODER_TRAINING_GRAPH_COMPILER_H_
 #define KALDI_DECODER_TRAINING_GRAPH_COMPILER_H_
 
+#include <functional>
+#include <memory>
+
 #include "base/kaldi-common.h"
 #include "hmm/transition-model.h"
 #include "fst/fstlib.h"
 #include "fstext/fstext-lib.h"
+#include "hmm/hmm-utils.h"
 
 
 namespace kaldi {
@@ -34,6 +38,9 @@ struct TrainingGraphCompilerOptions {
   BaseFloat self_loop_scale;
   bool rm_eps;
   bool reorder;  // (Dan-style graphs)
+  bool fast_linear;  // use CompileLinearGraph() for linear transcripts.
+  int32 hmm_cache_size;
+  int32 num_threads;  // for CompileGraphs() and CompileGraphsFromText().
 
   explicit TrainingGraphCompilerOptions(BaseFloat transition_scale = 1.0,
                                         BaseFloat self_loop_scale = 1.0,
@@ -41,7 +48,10 @@ struct TrainingGraphCompilerOptions {
       transition_scale(transition_scale),
       self_loop_scale(self_loop_scale),
       rm_eps(false),
-      reorder(b) { }
+      reorder(b),
+      fast_linear(true),
+      hmm_cache_size(20000),
+      num_threads(1) { }
 
   void Register(OptionsItf *opts) {
     opts->Register("transition-scale", &transition_scale, "Scale of transition "
@@ -51,6 +61,19 @@ struct TrainingGraphCompilerOptions {
     opts->Register("reorder", &reorder, "Reorder transition ids for greater decoding efficiency.");
     opts->Register("rm-eps", &rm_eps,  "Remove [most] epsilons before minimization (only applicable "
                    "if disambig symbols present)");
+    opts->Register("fast-linear-graph", &fast_linear, "If true, graphs for "
+                   "transcripts (word sequences) are built directly, in one "
+                   "pass over the pronunciations and phone contexts, instead "
+                   "of by composition, determinization and minimization.  "
+                   "The graph is not minimal but has the same paths and path "
+                   "weights.");
+    opts->Register("hmm-cache-size", &hmm_cache_size, "Number of HMMs of "
+                   "phones in context kept from one graph to the next, "
+                   "and of phones in context in the H transducer that "
+                   "is kept likewise.");
+    opts->Register("graph-compile-threads", &num_threads, "Number of threads "
+                   "that compile the graphs of a batch of transcripts "
+                   "(CompileGraphs()) in parallel.");
   }
 };
 
@@ -65,6 +88,24 @@ class TrainingGraphCompiler {
                         const std::vector<int32> &disambig_syms, // disambig symbols in phone symbol table.
                         const TrainingGraphCompilerOptions &opts);
 
+  // This version does not copy the lexicon, which must have been prepared
+  // by PrepareLexicon() with the same models and disambiguation symbols and
+  // must outlive the compiler.  It is only read, so the compilers of several
+  // threads may share one lexicon, e.g. mapped from a model bundle.
+  TrainingGraphCompiler(const TransitionModel &trans_model,
+                        const ContextDependency &ctx_dep,
+                        const fst::Fst<fst::StdArc> &lex_fst,
+                        const std::vector<int32> &disambig_syms,
+                        const TrainingGraphCompilerOptions &opts);
+
+  // Does to "lex_fst" what the constructor that takes ownership of the
+  // lexicon does to it: adds the subsequential loop if the tree has right
+  // context, sorts it on output labels and works out its properties.
+  static void PrepareLexicon(const TransitionModel &trans_model,
+                             const ContextDependency &ctx_dep,
+                             const std::vector<int32> &disambig_syms,
+                             fst::VectorFst<fst::StdArc> *lex_fst);
+
 
   // CompileGraph compiles a single training graph its input is a
   // weighted acceptor (G) at the word level, its output is HCLG.
@@ -75,34 +116,165 @@ class TrainingGraphCompiler {
                     fst::VectorFst<fst::StdArc> *out_fst);
 
   // CompileGraphs allows you to compile a number of graphs at the same
-  // time.  This consumes more memory but is faster.
+  // time.  This consumes more memory but is faster.  The graphs are compiled
+  // by opts.num_threads threads, each with its own compose caches; only the
+  // expansion of the context FST, which is built on demand, is done by one
+  // thread for the whole batch.  The output does not depend on the number of
+  // threads.
   bool CompileGraphs(
       const std::vector<const fst::VectorFst<fst::StdArc> *> &word_fsts,
       std::vector<fst::VectorFst<fst::StdArc> *> *out_fsts);
 
-  // This version creates an FST from the text and calls CompileGraph.
+  // This version creates an FST from the text and calls CompileGraph, or
+  // CompileLinearGraph if opts.fast_linear and there is no context lexicon
+  // (see SetContextLexicon()).
   bool CompileGraphFromText(const std::vector<int32> &transcript,
                             fst::VectorFst<fst::StdArc> *out_fst);
 
-  // This function creates FSTs from the text and calls CompileGraphs.
+  // This function creates FSTs from the text and calls CompileGraphs, or
+  // CompileLinearGraph on each, in opts.num_threads threads, if
+  // opts.fast_linear and there is no context lexicon.
   bool CompileGraphsFromText(
       const std::vector<std::vector<int32> >  &word_grammar,
       std::vector<fst::VectorFst<fst::StdArc> *> *out_fsts);
 
+  // CompileLinearGraph builds the graph for a word sequence without the
+  // general machinery of CompileGraph.  It walks the lexicon along the words,
+  // expanding alternative pronunciations and optional silence, and
+  // determinizes that phone graph (which is small) in the log semiring.  Then
+  // it walks the phone graph keeping the left context of each state, splices
+  // in the HMM of each phone in context (from GetHmmAsFsa(), which uses
+  // ContextDependency::Compute()), and adds the self-loops.  The output is not
+  // minimized, but it has the same paths with the same weights as
+  // CompileGraph's output; the words may be on different arcs.  Returns false
+  // if the words have no path through the lexicon.  It may be called from
+  // several threads at once.
+  bool CompileLinearGraph(const std::vector<int32> &transcript,
+                          fst::VectorFst<fst::StdArc> *out_fst);
+
+  // Makes the compiler take the HMMs of phones in context from "cache" (which
+  // it does not take ownership of) rather than from its own, e.g. so that the
+  // compilers of several threads share one.  "cache" must be for the same
+  // models, with the same transition scale.
+  void SetHmmCache(HmmFsaCache *cache);
+
+  // Makes CompileGraph() and CompileGraphs() start from "cl_fst", the context
+  // FST composed with the lexicon (C o L, made once e.g. by
+  // make-context-lexicon), rather than composing the words with the lexicon
+  // and then with the context FST.  Its input labels are phones in context,
+  // described by "ilabel_info" (see ComposeContext()), and it must be sorted
+  // on output labels.  A graph is then TableCompose(CL, G), determinized in
+  // the log semiring, with the HMM of each phone in context spliced in as
+  // CompileLinearGraph() does.  The graphs are not minimized, and so differ
+  // from CompileGraph()'s in the same way as CompileLinearGraph()'s; the
+  // graphs of a batch are compiled fully in parallel.  Neither argument is
+  // copied; they must outlive the compiler, and may be shared by the
+  // compilers of several threads.  CL must be made from the same lexicon,
+  // disambiguation symbols and context width.
+  void SetContextLexicon(
+      const fst::Fst<fst::StdArc> *cl_fst,
+      const std::vector<std::vector<int32> > *ilabel_info);
 
-  ~TrainingGraphCompiler() { delete lex_fst_; }
+  ~TrainingGraphCompiler();
  private:
+  // The part of the constructors after the lexicon is set.
+  void Init();
+
+  // The symbol of the subsequential loop (see ../fstext/context-fst.h).
+  static int32 SubsequentialSymbol(const TransitionModel &trans_model,
+                                   const std::vector<int32> &disambig_syms);
+
+  // The compose caches of one thread, which hold matchers for the lexicon,
+  // for h_fst_ and for cl_fst_.
+  struct ComposeCaches {
+    fst::TableComposeCache<fst::Fst<fst::StdArc> > lex_cache;
+    fst::TableComposeCache<fst::Fst<fst::StdArc> > h_cache;
+    fst::TableComposeCache<fst::Fst<fst::StdArc> > cl_cache;
+  };
+
+  // Calls task(i, caches) for i = 0 ... num_tasks - 1 in opts_.num_threads
+  // threads, where "caches" are those of the calling thread.  An exception in
+  // a task is rethrown once the threads are done.
+  void RunInThreads(
+      size_t num_tasks,
+      const std::function<void(size_t, ComposeCaches*)> &task);
+
+  // CompileGraph() with cl_fst_, using "caches".
+  bool CompileGraphWithContextLexicon(
+      const fst::VectorFst<fst::StdArc> &word_fst, ComposeCaches *caches,
+      fst::VectorFst<fst::StdArc> *out_fst);
+
+  // Drops the matchers for h_fst_, which has changed.
+  void ClearHCaches();
+
+  // Discards inv_cfst_ and h_fst_ if they have grown too big, and creates
+  // inv_cfst_ if needed.
+  void ResetContextIfTooBig();
+
+  // Adds to h_fst_ the phones in context that inv_cfst_ has met since the
+  // last call.
+  void UpdateHTransducer();
+
+  // Outputs the part of the lexicon that transcribes "transcript", as
+  // TableCompose(lexicon, linear acceptor of "transcript") would, but without
+  // the subsequential loop or disambiguation symbols.
+  void ExpandLexicon(const std::vector<int32> &transcript,
+                     fst::VectorFst<fst::StdArc> *phone2word_fst);
+
+  // Outputs the phone graph "phone2word_fst" expanded to phones in context
+  // and then to HMMs, without self-loops.
+  void ExpandContextAndHmms(const fst::VectorFst<fst::StdArc> &phone2word_fst,
+                            fst::VectorFst<fst::StdArc> *ofst);
+
+  // Outputs "ctx2word_fst", whose input labels are those of cl_fst_, with
+  // the HMM of each phone in context spliced in, without self-loops.
+  void ExpandHmms(const fst::VectorFst<fst::StdArc> &ctx2word_fst,
+                  fst::VectorFst<fst::StdArc> *ofst);
+
+  // Adds to "ofst" a path from "src" to "dest" through the HMM of the central
+  // phone of "phone_window", whose first arcs carry "olabel" and "weight"; or
+  // an epsilon arc if the central phone is 0.
+  void AddPhoneInContext(const std::vector<int32> &phone_window,
+                         fst::StdArc::StateId src, fst::StdArc::StateId dest,
+                         fst::StdArc::Label olabel, fst::StdArc::Weight weight,
+                         fst::VectorFst<fst::StdArc> *ofst);
+
   const TransitionModel &trans_model_;
   const ContextDependency &ctx_dep_;
-  fst::VectorFst<fst::StdArc> *lex_fst_; // lexicon FST (an input; we take
-  // ownership as we need to modify it).
+  const fst::Fst<fst::StdArc> *lex_fst_;  // lexicon FST, prepared by
+  // PrepareLexicon(); own_lex_fst_ or one we were given.
+  std::unique_ptr<fst::VectorFst<fst::StdArc> > own_lex_fst_;
   std::vector<int32> disambig_syms_; // disambig symbols (if any) in the phone
   int32 subsequential_symbol_;  // search in ../fstext/context-fst.h for more info.
   // symbol table.
-  fst::TableComposeCache<fst::Fst<fst::StdArc> > lex_cache_;  // stores matcher..
-  // this is one of Dan's extensions.
+
+  // Compose caches (stores matchers.. this is one of Dan's extensions), one
+  // per thread of CompileGraphs(); CompileGraph() uses the first.  The
+  // lexicon, h_fst_ and cl_fst_ they match on are shared by the threads (and
+  // cl_fst_ by other compilers), so they are only ever composed with through
+  // a ReadOnlyFst: OpenFst's matchers would otherwise store the properties
+  // they test in the shared FSTs.
+  std::vector<ComposeCaches*> compose_caches_;
 
   TrainingGraphCompilerOptions opts_;
+
+  // The HMMs of phones in context: own_hmm_cache_, or the one given to
+  // SetHmmCache().
+  std::unique_ptr<HmmFsaCache> own_hmm_cache_;
+  HmmFsaCache *hmm_cache_;
+
+  // For CompileGraph and CompileGraphs, the inverse context FST and the H
+  // transducer for its ilabels are kept from one call to the next, so H only
+  // gets the phones in context that are new.  h_fst_ covers the ilabels of
+  // inv_cfst_ below h_num_ilabels_.
+  fst::InverseContextFst *inv_cfst_;
+  fst::VectorFst<fst::StdArc> h_fst_;
+  int32 h_num_ilabels_;
+  std::vector<int32> disambig_syms_h_;  // disambig symbols on input of H.
+
+  // If set by SetContextLexicon(), C o L and its ilabel info; not owned.
+  const fst::Fst<fst::StdArc> *cl_fst_;
+  const std::vector<std::vector<int32> > *cl_ilabel_info_;
 };
 
 
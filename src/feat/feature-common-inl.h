@@ -68,7 +68,7 @@ void OfflineFeatureTpl<F>::ComputeFeatures(
   // calls the non-const ComputeFeatures() on a temporary object
   // that is a copy of *this.  It is not as efficient because of the
   // overhead of copying *this.
-  temp.ComputeFeatures(wave, vtln_warp, output);
+  temp.ComputeFeatures(wave, sample_freq, vtln_warp, output);
 }
 
 template <class F>
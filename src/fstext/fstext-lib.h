@@ -26,6 +26,7 @@
 #include "fstext/fst-test-utils.h"
 #include "fstext/fstext-utils.h"
 #include "fstext/pre-determinize.h"
+#include "fstext/read-only-fst.h"
 #include "fstext/table-matcher.h"
 #include "fstext/trivial-factor-weight.h"
 #include "fstext/lattice-weight.h"
@@ -0,0 +1,104 @@
+// fstext/read-only-fst.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_FSTEXT_READ_ONLY_FST_H_
+#define KALDI_FSTEXT_READ_ONLY_FST_H_
+#include <fst/fstlib.h>
+#include <fst/fst-decl.h>
+
+namespace fst {
+
+/// ReadOnlyFst is a view of an FST that other threads read at the same time,
+/// e.g. a lexicon shared by the graph compilers of several threads.  OpenFst
+/// operations call Properties(mask, true) on their inputs, and that stores
+/// the result in the FST (also in copies of it, which share the
+/// implementation), so it is a write even if the properties were known.  The
+/// view takes a snapshot of the properties when it is made and keeps any it
+/// has to compute to itself; everything else is passed on to the FST.  It is
+/// cheap to make, so make one per use (or per thread), and make the
+/// properties of the shared FST known before sharing it, or they are
+/// recomputed by each view that needs them.  The FST must outlive the view
+/// and its copies, and must not change while they are in use.
+template<class A>
+class ReadOnlyFst : public Fst<A> {
+ public:
+  typedef A Arc;
+  typedef typename Arc::Weight Weight;
+  typedef typename Arc::StateId StateId;
+
+  explicit ReadOnlyFst(const Fst<Arc> &fst):
+      fst_(&fst), props_(fst.Properties(kFstProperties, false)) { }
+
+  ReadOnlyFst(const ReadOnlyFst<Arc> &other, bool safe = false):
+      fst_(other.fst_), props_(other.props_) { }
+
+  StateId Start() const override { return fst_->Start(); }
+
+  Weight Final(StateId s) const override { return fst_->Final(s); }
+
+  size_t NumArcs(StateId s) const override { return fst_->NumArcs(s); }
+
+  size_t NumInputEpsilons(StateId s) const override {
+    return fst_->NumInputEpsilons(s);
+  }
+
+  size_t NumOutputEpsilons(StateId s) const override {
+    return fst_->NumOutputEpsilons(s);
+  }
+
+  uint64 Properties(uint64 mask, bool test) const override {
+    if (test && (KnownProperties(props_) & mask) != mask) {
+      uint64 known;
+      uint64 props = ComputeProperties(*this, mask, &known, true);
+      props_ = (props_ & ~known) | (props & known);
+    }
+    return props_ & mask;
+  }
+
+  const string &Type() const override { return fst_->Type(); }
+
+  ReadOnlyFst<Arc> *Copy(bool safe = false) const override {
+    return new ReadOnlyFst<Arc>(*this, safe);
+  }
+
+  const SymbolTable *InputSymbols() const override {
+    return fst_->InputSymbols();
+  }
+
+  const SymbolTable *OutputSymbols() const override {
+    return fst_->OutputSymbols();
+  }
+
+  void InitStateIterator(StateIteratorData<Arc> *data) const override {
+    fst_->InitStateIterator(data);
+  }
+
+  void InitArcIterator(StateId s, ArcIteratorData<Arc> *data) const override {
+    fst_->InitArcIterator(s, data);
+  }
+
+ private:
+  const Fst<Arc> *fst_;
+  mutable uint64 props_;
+  ReadOnlyFst<Arc> &operator = (const ReadOnlyFst<Arc> &);  // disallow.
+};
+
+} // end namespace fst
+
+#endif  // KALDI_FSTEXT_READ_ONLY_FST_H_
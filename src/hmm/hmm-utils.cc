@@ -332,6 +332,133 @@ fst::VectorFst<fst::StdArc> *GetHTransducer(const std::vector<std::vector<int32>
 }
 
 
+HmmFsaCache::HmmFsaCache(const ContextDependencyInterface &ctx_dep,
+                         const TransitionModel &trans_model,
+                         const HTransducerConfig &config,
+                         size_t max_size):
+    ctx_dep_(ctx_dep), trans_model_(trans_model), config_(config),
+    max_size_(max_size), num_hits_(0), num_misses_(0) {
+  KALDI_ASSERT(max_size > 0);
+}
+
+HmmFsaCache::FsaPtr HmmFsaCache::GetHmm(
+    const std::vector<int32> &phone_window) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unordered_map<std::vector<int32>, Entry,
+                  VectorHasher<int32> >::iterator iter =
+        map_.find(phone_window);
+    if (iter != map_.end()) {
+      num_hits_++;
+      lru_.splice(lru_.begin(), lru_, iter->second.lru_pos);
+      return iter->second.fsa;
+    }
+    num_misses_++;
+  }
+  // Build it without holding the lock; if another thread does the same
+  // meanwhile, the first one to finish is kept.  Its properties are computed
+  // now, while no other thread can see it: Properties(mask, true) stores them
+  // in the FST, so users of the shared acceptor may only ask with test=false.
+  fst::VectorFst<fst::StdArc> *new_fsa =
+      GetHmmAsFsa(phone_window, ctx_dep_, trans_model_, config_);
+  new_fsa->Properties(fst::kFstProperties, true);
+  FsaPtr fsa(new_fsa);
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::pair<unordered_map<std::vector<int32>, Entry,
+                          VectorHasher<int32> >::iterator, bool> ins =
+      map_.insert(std::make_pair(phone_window, Entry()));
+  if (!ins.second)
+    return ins.first->second.fsa;
+  lru_.push_front(phone_window);
+  ins.first->second.fsa = fsa;
+  ins.first->second.lru_pos = lru_.begin();
+  if (map_.size() > max_size_) {
+    map_.erase(lru_.back());
+    lru_.pop_back();
+  }
+  return fsa;
+}
+
+int64 HmmFsaCache::NumHits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_hits_;
+}
+
+int64 HmmFsaCache::NumMisses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_misses_;
+}
+
+
+void ExtendHTransducer(const std::vector<std::vector<int32> > &ilabel_info,
+                       int32 first_ilabel,
+                       const TransitionModel &trans_model,
+                       HmmFsaCache *cache,
+                       fst::VectorFst<fst::StdArc> *h_fst,
+                       std::vector<int32> *disambig_syms_left) {
+  using namespace fst;
+  typedef StdArc Arc;
+  typedef Arc::Weight Weight;
+  typedef Arc::StateId StateId;
+
+  KALDI_ASSERT(ilabel_info.size() >= 1 && ilabel_info[0].size() == 0);
+  KALDI_ASSERT(first_ilabel >= 1 && cache != NULL && h_fst != NULL &&
+               disambig_syms_left != NULL);
+  StateId loop_state = 0;
+  if (first_ilabel == 1) {
+    KALDI_ASSERT(h_fst->NumStates() == 0);
+    disambig_syms_left->clear();
+    h_fst->AddState();
+    h_fst->SetStart(loop_state);
+    h_fst->SetFinal(loop_state, Weight::One());
+  }
+  // As in GetHTransducer().
+  int32 first_disambig_sym = trans_model.NumTransitionIds() + 1;
+
+  for (int32 j = first_ilabel; j < static_cast<int32>(ilabel_info.size());
+       j++) {
+    const std::vector<int32> &info = ilabel_info[j];
+    KALDI_ASSERT(!info.empty());
+    if (info[0] < 0 || (info[0] == 0 && info.size() == 1)) {
+      if (info.size() != 1)
+        KALDI_ERR << "ExtendHTransducer() does not handle the symbols of "
+                  << "grammar FSTs; use GetHTransducer().";
+      int32 disambig_sym_left = first_disambig_sym +
+          disambig_syms_left->size();
+      disambig_syms_left->push_back(disambig_sym_left);
+      StateId s = h_fst->AddState();
+      h_fst->AddArc(loop_state, Arc(disambig_sym_left, j, Weight::One(), s));
+      h_fst->AddArc(s, Arc(0, 0, Weight::One(), loop_state));
+      continue;
+    }
+    // A phone in context; this is what MakeLoopFst() does with it.
+    HmmFsaCache::FsaPtr fsa = cache->GetHmm(info);
+    StateId num_states = fsa->NumStates(), start = fsa->Start();
+    if (start == kNoStateId) continue;
+    bool share_start_state =
+        fsa->Properties(kInitialAcyclic, false) == kInitialAcyclic &&
+        fsa->NumArcs(start) == 1 && fsa->Final(start) == Weight::Zero();
+    std::vector<StateId> state_map(num_states);
+    for (StateId s = 0; s < num_states; s++)
+      state_map[s] = (s == start && share_start_state ? loop_state :
+                      h_fst->AddState());
+    if (!share_start_state)
+      h_fst->AddArc(loop_state, Arc(0, j, Weight::One(), state_map[start]));
+    for (StateId s = 0; s < num_states; s++) {
+      for (ArcIterator<VectorFst<Arc> > aiter(*fsa, s); !aiter.Done();
+           aiter.Next()) {
+        const Arc &arc = aiter.Value();
+        int32 olabel = (s == start && share_start_state ? j : 0);
+        h_fst->AddArc(state_map[s], Arc(arc.ilabel, olabel, arc.weight,
+                                        state_map[arc.nextstate]));
+      }
+      if (fsa->Final(s) != Weight::Zero())
+        h_fst->AddArc(state_map[s], Arc(0, 0, fsa->Final(s), loop_state));
+    }
+  }
+}
+
+
 void GetIlabelMapping (const std::vector<std::vector<int32> > &ilabel_info_old,
                        const ContextDependencyInterface &ctx_dep,
                        const TransitionModel &trans_model,
@@ -20,9 +20,14 @@
 #ifndef KALDI_HMM_HMM_UTILS_H_
 #define KALDI_HMM_HMM_UTILS_H_
 
+#include <list>
+#include <memory>
+#include <mutex>
+
 #include "hmm/hmm-topology.h"
 #include "hmm/transition-model.h"
 #include "lat/kaldi-lattice.h"
+#include "util/stl-utils.h"
 
 namespace kaldi {
 
@@ -130,6 +135,72 @@ GetHTransducer(const std::vector<std::vector<int32> > &ilabel_info,
                const HTransducerConfig &config,
                std::vector<int32> *disambig_syms_left);
 
+
+/// HmmFsaCache keeps the acceptors from GetHmmAsFsa() by phone window, so that
+/// graph compilation need not build them again for each utterance: a corpus
+/// uses the same few thousand phones in context over and over.  It is
+/// thread-safe, so the graph compilers of several threads can share one.  It
+/// keeps at most "max_size" acceptors, dropping the least recently used; they
+/// are handed out as shared pointers, so this does not affect their users.
+class HmmFsaCache {
+ public:
+  typedef std::shared_ptr<const fst::VectorFst<fst::StdArc> > FsaPtr;
+
+  /// Keeps references to "ctx_dep" and "trans_model".
+  HmmFsaCache(const ContextDependencyInterface &ctx_dep,
+              const TransitionModel &trans_model,
+              const HTransducerConfig &config,
+              size_t max_size);
+
+  /// Returns GetHmmAsFsa(phone_window, ...), from the cache if it is there.
+  /// Its properties are known, so ask for them with Properties(mask, false):
+  /// with test=true the call writes to the acceptor, which other threads may
+  /// be reading.
+  FsaPtr GetHmm(const std::vector<int32> &phone_window);
+
+  const HTransducerConfig &Config() const { return config_; }
+
+  /// Number of calls to GetHmm() that did, and did not, find the acceptor
+  /// in the cache.
+  int64 NumHits() const;
+  int64 NumMisses() const;
+
+ private:
+  typedef std::list<std::vector<int32> > LruList;
+  struct Entry {
+    FsaPtr fsa;
+    LruList::iterator lru_pos;
+  };
+
+  const ContextDependencyInterface &ctx_dep_;
+  const TransitionModel &trans_model_;
+  HTransducerConfig config_;
+  size_t max_size_;
+
+  mutable std::mutex mutex_;
+  LruList lru_;  // phone windows in the cache, most recently used first.
+  unordered_map<std::vector<int32>, Entry, VectorHasher<int32> > map_;
+  int64 num_hits_;
+  int64 num_misses_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(HmmFsaCache);
+};
+
+/**
+  * ExtendHTransducer() is a version of GetHTransducer() for an ilabel_info
+  * that grows, as that of an InverseContextFst that is kept from one graph to
+  * the next does.  It adds to "h_fst" (which must be empty if
+  * "first_ilabel" is 1) the entries of "ilabel_info" from "first_ilabel" on,
+  * taking the HMMs from "cache", and appends any new disambiguation symbols to
+  * "disambig_syms_left".  The transition scale is that of the cache's config.
+  * It does not handle the special symbols of grammar FSTs.
+  */
+void ExtendHTransducer(const std::vector<std::vector<int32> > &ilabel_info,
+                       int32 first_ilabel,
+                       const TransitionModel &trans_model,
+                       HmmFsaCache *cache,
+                       fst::VectorFst<fst::StdArc> *h_fst,
+                       std::vector<int32> *disambig_syms_left);
+
 /**
   * GetIlabelMapping produces a mapping that's similar to HTK's logical-to-physical
   * model mapping (i.e. the xwrd.clustered.mlist files).   It groups together
@@ -0,0 +1,138 @@
+// util/bounded-queue.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_BOUNDED_QUEUE_H_
+#define KALDI_UTIL_BOUNDED_QUEUE_H_ 1
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+#include "base/kaldi-common.h"
+#include "base/timer.h"
+
+namespace kaldi {
+
+// BoundedQueue is a first-in first-out queue for passing work between the
+// stages of a producer/consumer pipeline.  Push() blocks while the queue is
+// full and Pop() blocks while it is empty, so a slow stage holds back the
+// stages in front of it instead of letting memory grow.  Once Close() has been
+// called, Push() fails and Pop() fails as soon as the queue is drained.
+//
+// The queue keeps some counters (depth, and how long producers and consumers
+// were blocked) that are useful for sizing the stages: a queue that is
+// usually full means the stage reading from it is the bottleneck, one that is
+// usually empty means the stage writing to it is.
+template<class T>
+class BoundedQueue {
+ public:
+  struct Stats {
+    int64 num_pushed;
+    size_t max_depth;
+    double tot_depth;  // summed over Push() calls, for the average depth.
+    double push_wait;  // seconds Push() was blocked on a full queue.
+    double pop_wait;   // seconds Pop() was blocked on an empty queue.
+    Stats(): num_pushed(0), max_depth(0), tot_depth(0.0),
+             push_wait(0.0), pop_wait(0.0) { }
+  };
+
+  explicit BoundedQueue(size_t capacity): capacity_(capacity), closed_(false) {
+    KALDI_ASSERT(capacity > 0);
+  }
+
+  /// Appends "item"; blocks while the queue is full.  Returns false (and
+  /// does not add the item) if the queue has been closed.
+  bool Push(const T &item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_.size() >= capacity_ && !closed_) {
+      Timer timer;
+      not_full_.wait(lock, [this] {
+          return queue_.size() < capacity_ || closed_; });
+      stats_.push_wait += timer.Elapsed();
+    }
+    if (closed_)
+      return false;
+    queue_.push_back(item);
+    stats_.num_pushed++;
+    stats_.tot_depth += queue_.size();
+    if (queue_.size() > stats_.max_depth)
+      stats_.max_depth = queue_.size();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  /// Removes the oldest item into "item"; blocks while the queue is empty.
+  /// Returns false once the queue is closed and empty.
+  bool Pop(T *item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_.empty() && !closed_) {
+      Timer timer;
+      not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+      stats_.pop_wait += timer.Elapsed();
+    }
+    if (queue_.empty())
+      return false;
+    *item = queue_.front();
+    queue_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  /// After Close(), Push() fails and Pop() returns what is left, then fails.
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+  Stats GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  /// Logs the counters in a single line, prefixed by "name".
+  void PrintStats(const std::string &name) const {
+    Stats stats = GetStats();
+    KALDI_LOG << "Queue " << name << ": " << stats.num_pushed
+              << " items, average depth "
+              << (stats.num_pushed > 0 ? stats.tot_depth / stats.num_pushed :
+                  0.0)
+              << ", max depth " << stats.max_depth << " of " << capacity_
+              << "; producers blocked " << stats.push_wait
+              << "s, consumers blocked " << stats.pop_wait << "s.";
+  }
+
+ private:
+  size_t capacity_;
+  bool closed_;
+  std::deque<T> queue_;
+  Stats stats_;
+  mutable std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(BoundedQueue);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_UTIL_BOUNDED_QUEUE_H_
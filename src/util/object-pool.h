@@ -0,0 +1,102 @@
+// util/object-pool.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_OBJECT_POOL_H_
+#define KALDI_UTIL_OBJECT_POOL_H_ 1
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// ObjectPool hands out objects of type T from blocks of kBlockSize, and keeps
+// the ones given back with Delete() on a free list for reuse, the way HashList
+// manages its Elems.  It is meant for the decoders' tokens and forward links,
+// which are created and destroyed by the million: after the first frames of
+// the first utterance, New() and Delete() are a few pointer operations, and
+// the blocks stay allocated from one utterance (or retry) to the next.
+//
+// It is not thread-safe; each decoder has its own.  Objects that are never
+// given back are not destroyed, which is fine for plain structs like tokens.
+template<class T>
+class ObjectPool {
+ public:
+  ObjectPool(): free_head_(NULL), num_new_(0) { }
+
+  ~ObjectPool() {
+    for (size_t i = 0; i < blocks_.size(); i++)
+      delete[] blocks_[i];
+  }
+
+  /// Like "new T(args...)".
+  template<typename... Args>
+  T *New(Args&&... args) {
+    if (free_head_ == NULL)
+      AllocateBlock();
+    Slot *slot = free_head_;
+    free_head_ = slot->next;
+    num_new_++;
+    return new (&(slot->storage)) T(std::forward<Args>(args)...);
+  }
+
+  /// Like "delete t", for a "t" from New().
+  void Delete(T *t) {
+    t->~T();
+    Slot *slot = reinterpret_cast<Slot*>(t);
+    slot->next = free_head_;
+    free_head_ = slot;
+  }
+
+  /// Number of calls to New() so far.
+  int64 NumNew() const { return num_new_; }
+
+  /// Number of heap allocations that New() avoided: its calls, less the
+  /// blocks it allocated.
+  int64 NumAllocationsSaved() const { return num_new_ - blocks_.size(); }
+
+ private:
+  static const size_t kBlockSize = 1024;
+
+  union Slot {
+    Slot *next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  void AllocateBlock() {
+    Slot *block = new Slot[kBlockSize];
+    for (size_t i = 0; i + 1 < kBlockSize; i++)
+      block[i].next = block + i + 1;
+    block[kBlockSize - 1].next = NULL;
+    free_head_ = block;
+    blocks_.push_back(block);
+  }
+
+  Slot *free_head_;
+  std::vector<Slot*> blocks_;
+  int64 num_new_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ObjectPool);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_UTIL_OBJECT_POOL_H_
@@ -340,4 +340,29 @@ bool StringsApproxEqual(const std::string &a,
 }
 
 
+void WriteJsonString(const std::string &s, std::ostream &os) {
+  os << '"';
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    switch (c) {
+      case '"': os << "\\\""; break;
+      case '\\': os << "\\\\"; break;
+      case '\b': os << "\\b"; break;
+      case '\f': os << "\\f"; break;
+      case '\n': os << "\\n"; break;
+      case '\r': os << "\\r"; break;
+      case '\t': os << "\\t"; break;
+      default:
+        if (c < 0x20) {
+          static const char *kHex = "0123456789abcdef";
+          os << "\\u00" << kHex[c >> 4] << kHex[c & 0xf];
+        } else {
+          os << s[i];
+        }
+    }
+  }
+  os << '"';
+}
+
+
 }  // end namespace kaldi
@@ -183,6 +183,10 @@ bool StringsApproxEqual(const std::string &a,
                         const std::string &b,
                         int32 decimal_places_check = 2);
 
+/// Writes "s" to "os" as a JSON string: in double quotes, with quotes,
+/// backslashes and control characters escaped.  Other bytes, e.g. UTF-8,
+/// are written as they are.
+void WriteJsonString(const std::string &s, std::ostream &os);
 
 }  // namespace kaldi
 
@@ -0,0 +1,166 @@
+// util/trace-recorder.cc
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+
+#include "util/trace-recorder.h"
+#include "util/kaldi-io.h"
+#include "util/text-utils.h"
+
+namespace kaldi {
+
+namespace {
+
+struct TraceEvent {
+  const char *name;
+  int64 begin_ns;
+  int64 end_ns;
+};
+
+// Events are appended to a list of blocks.  Only the owning thread writes a
+// block; "size" and "next" are published with release stores so that
+// WriteJson() sees complete events even if a thread is still recording.
+struct TraceBlock {
+  static const int32 kSize = 4096;
+  TraceEvent events[kSize];
+  std::atomic<int32> size;
+  std::atomic<TraceBlock*> next;
+  TraceBlock(): size(0), next(NULL) { }
+};
+
+struct ThreadTrace {
+  int32 tid;
+  std::string name;  // guarded by the registry mutex.
+  TraceBlock *head, *tail;
+  explicit ThreadTrace(int32 tid): tid(tid), head(new TraceBlock()),
+                                   tail(head) { }
+};
+
+// All the threads' buffers, in the order the threads first recorded.  They
+// are never freed: a thread may exit before the trace is written.
+std::mutex registry_mutex;
+std::vector<ThreadTrace*> registry;
+
+std::atomic<int64> epoch_ns(0);
+std::once_flag epoch_once;
+
+thread_local ThreadTrace *this_thread_trace = NULL;
+
+int64 SteadyNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ThreadTrace *GetThreadTrace() {
+  if (this_thread_trace == NULL) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    this_thread_trace = new ThreadTrace(registry.size() + 1);
+    registry.push_back(this_thread_trace);
+  }
+  return this_thread_trace;
+}
+
+}  // namespace
+
+std::atomic<bool> TraceRecorder::enabled_(false);
+
+void TraceRecorder::Start() {
+  std::call_once(epoch_once, [] { epoch_ns.store(SteadyNs()); });
+  enabled_.store(true);
+}
+
+void TraceRecorder::Stop() {
+  enabled_.store(false);
+}
+
+int64 TraceRecorder::NowNs() {
+  return SteadyNs() - epoch_ns.load(std::memory_order_relaxed);
+}
+
+void TraceRecorder::SetThreadName(const char *name) {
+  if (!Enabled())
+    return;
+  ThreadTrace *trace = GetThreadTrace();
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  trace->name = name;
+}
+
+void TraceRecorder::Record(const char *name, int64 begin_ns, int64 end_ns) {
+  ThreadTrace *trace = GetThreadTrace();
+  TraceBlock *block = trace->tail;
+  int32 size = block->size.load(std::memory_order_relaxed);
+  if (size == TraceBlock::kSize) {
+    TraceBlock *next = new TraceBlock();
+    block->next.store(next, std::memory_order_release);
+    trace->tail = block = next;
+    size = 0;
+  }
+  TraceEvent &event = block->events[size];
+  event.name = name;
+  event.begin_ns = begin_ns;
+  event.end_ns = end_ns;
+  block->size.store(size + 1, std::memory_order_release);
+}
+
+void TraceRecorder::WriteJson(const std::string &wxfilename) {
+  Stop();
+  Output ko(wxfilename, false, false);
+  std::ostream &os = ko.Stream();
+  os << std::fixed << std::setprecision(3);
+  int32 pid = getpid();
+  int64 num_events = 0;
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  // Complete ("X") events with times in microseconds, and a metadata event
+  // naming each thread.
+  os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+  os << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+     << ", \"args\": {\"name\": \"speech-aligner\"}}";
+  for (size_t t = 0; t < registry.size(); t++) {
+    const ThreadTrace *trace = registry[t];
+    std::string name = trace->name;
+    if (name.empty())
+      name = "thread " + std::to_string(trace->tid);
+    os << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid
+       << ", \"tid\": " << trace->tid << ", \"args\": {\"name\": ";
+    WriteJsonString(name, os);
+    os << "}}";
+    for (const TraceBlock *block = trace->head; block != NULL;
+         block = block->next.load(std::memory_order_acquire)) {
+      int32 size = block->size.load(std::memory_order_acquire);
+      for (int32 i = 0; i < size; i++) {
+        const TraceEvent &event = block->events[i];
+        os << ",\n{\"name\": \"" << event.name
+           << "\", \"ph\": \"X\", \"pid\": " << pid
+           << ", \"tid\": " << trace->tid
+           << ", \"ts\": " << event.begin_ns * 1.0e-3
+           << ", \"dur\": " << (event.end_ns - event.begin_ns) * 1.0e-3 << "}";
+      }
+      num_events += size;
+    }
+  }
+  os << "\n]}\n";
+  KALDI_LOG << "Wrote " << num_events << " trace events from "
+            << registry.size() << " threads to " << wxfilename;
+}
+
+}  // namespace kaldi
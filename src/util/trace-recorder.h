@@ -0,0 +1,95 @@
+// util/trace-recorder.h
+
+// Copyright 2018  open-speech
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_TRACE_RECORDER_H_
+#define KALDI_UTIL_TRACE_RECORDER_H_ 1
+
+#include <atomic>
+#include <string>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+// TraceRecorder records a timeline of named spans ("compose", "decode", ...)
+// on every thread, and writes it as a Chrome trace-event JSON file, which
+// chrome://tracing and Perfetto (ui.perfetto.dev) display with one track per
+// thread.  That shows how the stages of different utterances interleave, and
+// where a thread sat idle.
+//
+// It is process-wide and off until Start() is called.  While it is off a
+// TraceScope costs one relaxed atomic load.  While it is on, each thread
+// appends to its own buffer, which no other thread writes, so recording takes
+// no lock (a mutex is taken only the first time a thread records anything, to
+// register its buffer).  The buffers grow in fixed-size blocks and are kept
+// until the end of the process, so threads that have exited still appear in
+// the trace.
+class TraceRecorder {
+ public:
+  static bool Enabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /// Turns recording on; time zero of the trace is the first call.
+  static void Start();
+
+  /// Turns recording off; spans that are already open are still recorded.
+  static void Stop();
+
+  /// Names the calling thread in the trace, e.g. "decode"; threads that are
+  /// not named are shown by number.  Does nothing while recording is off.
+  static void SetThreadName(const char *name);
+
+  /// Records a span on the calling thread; "name" must be a string literal
+  /// (or otherwise outlive the recorder), and the times are from NowNs().
+  static void Record(const char *name, int64 begin_ns, int64 end_ns);
+
+  /// Monotonic time in nanoseconds since Start().
+  static int64 NowNs();
+
+  /// Stops recording and writes what was recorded to "wxfilename".  Should be
+  /// called once the threads being traced are done.
+  static void WriteJson(const std::string &wxfilename);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+// TraceScope records a span from its construction to its destruction on the
+// calling thread, if the TraceRecorder is on when it is constructed:
+//   { TraceScope trace("determinize"); ... }
+class TraceScope {
+ public:
+  explicit TraceScope(const char *name):
+      name_(TraceRecorder::Enabled() ? name : NULL),
+      begin_ns_(name_ != NULL ? TraceRecorder::NowNs() : 0) { }
+
+  ~TraceScope() {
+    if (name_ != NULL)
+      TraceRecorder::Record(name_, begin_ns_, TraceRecorder::NowNs());
+  }
+ private:
+  const char *name_;
+  int64 begin_ns_;
+  KALDI_DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_UTIL_TRACE_RECORDER_H_